@@ -49,6 +49,7 @@
 
 //// --- Begin LibAFL code ---
 
+#include "exec/tb-flush.h"
 #include "libafl/defs.h"
 #include "libafl/exit.h"
 #include "libafl/tcg.h"
@@ -234,6 +235,47 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, TCGTBCPUState s)
  *
  * Returns: an existing translation block or NULL.
  */
+//// --- Begin LibAFL code ---
+
+/* Fill a way of @set with @tb, preferably one that is empty. */
+static void tb_jmp_cache_insert(CPUJumpCache *jc, unsigned int set,
+                                vaddr pc, TranslationBlock *tb)
+{
+    unsigned int base = set * jc->ways;
+    unsigned int way;
+
+    for (way = 0; way < jc->ways; way++) {
+        if (!qatomic_read(&jc->array[base + way].tb)) {
+            goto fill;
+        }
+    }
+
+    way = jc->victim++ % jc->ways;
+    jc->conflicts++;
+    jc->window_conflicts++;
+
+fill:
+    jc->array[base + way].pc = pc;
+    qatomic_set(&jc->array[base + way].tb, tb);
+}
+
+/* Grow the jump cache of @cpu if too many lookups missed by conflict. */
+static void tb_jmp_cache_adapt(CPUState *cpu, CPUJumpCache *jc)
+{
+    bool grow = jc->adaptive && jc->bits < TB_JMP_CACHE_MAX_BITS &&
+                jc->window_conflicts * TB_JMP_CACHE_GROW_RATIO >
+                    jc->window_lookups;
+
+    jc->window_lookups = 0;
+    jc->window_conflicts = 0;
+
+    if (grow) {
+        tcg_resize_jmp_cache(cpu, jc->bits + 1, jc->ways);
+    }
+}
+
+//// --- End LibAFL code ---
+
 static inline TranslationBlock *tb_lookup(CPUState *cpu, TCGTBCPUState s)
 {
     TranslationBlock *tb;
@@ -243,25 +285,49 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, TCGTBCPUState s)
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(s.cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(s.pc);
-    jc = cpu->tb_jmp_cache;
+    //// --- Begin LibAFL code ---
 
-    tb = qatomic_read(&jc->array[hash].tb);
-    if (likely(tb &&
-               jc->array[hash].pc == s.pc &&
-               tb->cs_base == s.cs_base &&
-               tb->flags == s.flags &&
-               tb_cflags(tb) == s.cflags)) {
-        goto hit;
+    jc = cpu->tb_jmp_cache;
+    hash = tb_jmp_cache_hash_func(jc, s.pc);
+    jc->window_lookups++;
+
+    for (unsigned int i = hash * jc->ways; i < (hash + 1) * jc->ways; i++) {
+        tb = qatomic_read(&jc->array[i].tb);
+        if (likely(tb &&
+                   jc->array[i].pc == s.pc &&
+                   tb->cs_base == s.cs_base &&
+                   tb->flags == s.flags &&
+                   tb_cflags(tb) == s.cflags)) {
+            jc->hits++;
+            goto hit;
+        }
     }
 
+    jc->misses++;
+
+    //// --- End LibAFL code ---
+
     tb = tb_htable_lookup(cpu, s);
     if (tb == NULL) {
+        //// --- Begin LibAFL code ---
+        jc->qht_misses++;
+        //// --- End LibAFL code ---
         return NULL;
     }
 
-    jc->array[hash].pc = s.pc;
-    qatomic_set(&jc->array[hash].tb, tb);
+    //// --- Begin LibAFL code ---
+    /*
+     * Age the code cache regions, for eviction. The jump caches are flushed
+     * by every eviction, so hot TBs come back here and get stamped again.
+     */
+    tcg_region_touch(tb->tc.ptr);
+
+    tb_jmp_cache_insert(jc, hash, s.pc, tb);
+
+    if (unlikely(jc->window_lookups >= TB_JMP_CACHE_WINDOW)) {
+        tb_jmp_cache_adapt(cpu, jc);
+    }
+    //// --- End LibAFL code ---
 
 hit:
     /*
@@ -414,6 +480,59 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Slow path of the LibAFL indirect branch caches: lookup_tb_ptr, which also
+ * fills the cache entry of the branch site with the TB found, if that TB can
+ * be reused from the site, i.e. it was translated for the cpu state of the
+ * site TB.
+ */
+const void *libafl_ibc_lookup_tb_ptr(CPUArchState *env, uint64_t site,
+                                     uint64_t pc, uint32_t set)
+{
+    CPUState *cpu = env_cpu(env);
+    const TranslationBlock *site_tb = (const TranslationBlock *)site;
+    struct libafl_ibc_entry *ways = &cpu->libafl_ibc[set * LIBAFL_IBC_WAYS];
+    /* Read before the lookup: an invalidation racing with it bumps it. */
+    uintptr_t epoch = qatomic_load_acquire(&cpu->libafl_ibc_epoch);
+    TranslationBlock *tb;
+
+    cpu->neg.can_do_io = true;
+    cpu->libafl_ibc_misses++;
+
+    TCGTBCPUState s = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
+    s.cflags = curr_cflags(cpu);
+
+    if (check_for_breakpoints(cpu, s.pc, &s.cflags)) {
+        cpu_loop_exit(cpu);
+    }
+
+    tb = tb_lookup(cpu, s);
+    if (tb == NULL) {
+        return tcg_code_gen_epilogue;
+    }
+
+    if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        log_cpu_exec(s.pc, cpu, tb);
+    }
+
+    if (s.flags == site_tb->flags && s.cs_base == site_tb->cs_base &&
+        s.cflags == tb_cflags(site_tb)) {
+        memmove(&ways[1], &ways[0],
+                (LIBAFL_IBC_WAYS - 1) * sizeof(struct libafl_ibc_entry));
+        ways[0].site = site;
+        ways[0].pc = pc;
+        ways[0].epoch = epoch;
+        ways[0].host = tb->tc.ptr;
+        cpu->libafl_ibc_fills++;
+    }
+
+    return tb->tc.ptr;
+}
+
+//// --- End LibAFL code ---
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
@@ -995,19 +1114,30 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             if (tb == NULL) {
                 CPUJumpCache *jc;
                 uint32_t h;
+//// --- Begin LibAFL code ---
+                unsigned evict_count = qatomic_read(&tb_ctx.tb_evict_count);
+//// --- End LibAFL code ---
 
                 mmap_lock();
                 tb = tb_gen_code(cpu, s);
                 mmap_unlock();
 
+//// --- Begin LibAFL code ---
+                /* last_tb may have been freed to make room for tb */
+                if (evict_count != qatomic_read(&tb_ctx.tb_evict_count)) {
+                    last_tb = NULL;
+                }
+//// --- End LibAFL code ---
+
                 /*
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(s.pc);
+                //// --- Begin LibAFL code ---
                 jc = cpu->tb_jmp_cache;
-                jc->array[h].pc = s.pc;
-                qatomic_set(&jc->array[h].tb, tb);
+                h = tb_jmp_cache_hash_func(jc, s.pc);
+                tb_jmp_cache_insert(jc, h, s.pc, tb);
+                //// --- End LibAFL code ---
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1032,8 +1162,12 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 // tb_add_jump(last_tb, tb_exit, tb);
 
                 if (last_tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID) {
+                    vaddr src_block = last_tb->libafl_trace_tail
+                                          ? last_tb->libafl_trace_tail
+                                          : last_tb->pc;
+
                     mmap_lock();
-                    edge = libafl_gen_edge(cpu, last_tb->pc, s.pc, tb_exit, s);
+                    edge = libafl_gen_edge(cpu, src_block, s.pc, tb_exit, s);
                     mmap_unlock();
 
                     if (edge) {
@@ -1125,7 +1259,9 @@ bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
 
-    cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    //// --- Begin LibAFL code ---
+    cpu->tb_jmp_cache = tb_jmp_cache_new(TB_JMP_CACHE_BITS, 1);
+    //// --- End LibAFL code ---
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -155,17 +155,29 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
-    CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    //// --- Begin LibAFL code ---
+    /* The cache may be resized concurrently by its cpu */
+    RCU_READ_LOCK_GUARD();
+
+    CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    size_t i, i0, n;
 
     if (unlikely(!jc)) {
         return;
     }
 
-    i0 = tb_jmp_cache_hash_page(page_addr);
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    /* The sets of a page are contiguous, and so are their ways */
+    i0 = tb_jmp_cache_hash_page(jc, page_addr) * jc->ways;
+    n = (size_t)jc->ways << tb_jmp_page_bits(jc);
+    for (i = 0; i < n; i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
+    //// --- End LibAFL code ---
+
+    //// --- Begin LibAFL code ---
+    /* The indirect branch caches are not indexed by pc */
+    libafl_ibc_invalidate(cpu);
+    //// --- End LibAFL code ---
 }
 
 /**
@@ -397,6 +409,11 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
+//// --- Begin LibAFL code ---
+    qatomic_set(&cpu->neg.tlb.c.libafl_flush_gen,
+                cpu->neg.tlb.c.libafl_flush_gen + 1);
+//// --- End LibAFL code ---
+
     tcg_flush_jmp_cache(cpu);
 
     if (to_clean == ALL_MMUIDX_BITS) {
@@ -552,6 +569,11 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
+//// --- Begin LibAFL code ---
+    qatomic_set(&cpu->neg.tlb.c.libafl_flush_gen,
+                cpu->neg.tlb.c.libafl_flush_gen + 1);
+//// --- End LibAFL code ---
+
     /*
      * Discard jump cache entries for any tb which might potentially
      * overlap the flushed page, which includes the previous.
@@ -742,6 +764,11 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
+//// --- Begin LibAFL code ---
+    qatomic_set(&cpu->neg.tlb.c.libafl_flush_gen,
+                cpu->neg.tlb.c.libafl_flush_gen + 1);
+//// --- End LibAFL code ---
+
     /*
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
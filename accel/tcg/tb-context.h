@@ -35,6 +35,11 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+//// --- Begin LibAFL code ---
+    unsigned tb_evict_count;
+    size_t tb_evicted_count;
+    size_t tb_retranslate_count;
+//// --- End LibAFL code ---
 };
 
 extern TBContext tb_ctx;
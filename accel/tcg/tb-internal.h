@@ -52,4 +52,9 @@ void tb_invalidate_phys_range_fast(CPUState *cpu, ram_addr_t ram_addr,
 bool tb_invalidate_phys_page_unwind(CPUState *cpu, tb_page_addr_t addr,
                                     uintptr_t pc);
 
+//// --- Begin LibAFL code ---
+/* Count @tb as a retranslation if its pc was evicted before. */
+void tb_count_retranslation(const TranslationBlock *tb);
+//// --- End LibAFL code ---
+
 #endif
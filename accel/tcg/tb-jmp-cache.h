@@ -15,19 +15,62 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+//// --- Begin LibAFL code ---
+
+/*
+ * The jump cache has 1 << bits sets of ways entries each.  TB_JMP_CACHE_BITS
+ * is only the default number of sets: the cache grows at runtime (up to
+ * TB_JMP_CACHE_MAX_BITS) when too many lookups miss because of conflicts,
+ * and can be resized explicitly with tcg_resize_jmp_cache().
+ */
+#define TB_JMP_CACHE_MIN_BITS 6
+#define TB_JMP_CACHE_MAX_BITS 16
+#define TB_JMP_CACHE_MAX_WAYS 4
+
+/* Lookups between two decisions of the adaptive sizing */
+#define TB_JMP_CACHE_WINDOW (1 << 18)
+/* Grow when more than 1/TB_JMP_CACHE_GROW_RATIO of them were conflicts */
+#define TB_JMP_CACHE_GROW_RATIO 32
+
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
  * A valid entry is read/written by a single CPU, therefore there is
  * no need for qatomic_rcu_read() and pc is always consistent with a
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
+ *
+ * The cache is only resized by its own CPU, which publishes the new one
+ * with qatomic_rcu_set(): the other threads must access it under the RCU
+ * read lock.  The statistics are only written by the CPU as well.
  */
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
+    unsigned bits;
+    unsigned ways;
+    unsigned victim;            /* round-robin replacement within a set */
+    bool adaptive;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t conflicts;         /* misses that replaced a valid entry */
+    uint64_t resizes;
+    uint64_t qht_misses;
+    uint64_t window_lookups;
+    uint64_t window_conflicts;
+
     struct {
         TranslationBlock *tb;
         vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    } array[];
 } CPUJumpCache;
 
+CPUJumpCache *tb_jmp_cache_new(unsigned bits, unsigned ways);
+
+static inline size_t tb_jmp_cache_entries(const CPUJumpCache *jc)
+{
+    return (size_t)jc->ways << jc->bits;
+}
+
+//// --- End LibAFL code ---
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -64,11 +64,28 @@ static bool tb_cmp(const void *ap, const void *bp)
             tb_page_addr1(a) == tb_page_addr1(b));
 }
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Guest pcs of the evicted TBs, to count retranslations.
+ * Bounded, and emptied on every flush.
+ */
+#define TB_EVICTED_PCS_MAX (1 << 20)
+static QemuMutex tb_evicted_lock;
+static GHashTable *tb_evicted_pcs;
+
+//// --- End LibAFL code ---
+
 void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+
+//// --- Begin LibAFL code ---
+    qemu_mutex_init(&tb_evicted_lock);
+    tb_evicted_pcs = g_hash_table_new(NULL, NULL);
+//// --- End LibAFL code ---
 }
 
 typedef struct PageDesc PageDesc;
@@ -785,6 +802,11 @@ void tb_flush__exclusive_or_serial(void)
     tb_remove_all();
 
     tcg_region_reset_all();
+//// --- Begin LibAFL code ---
+    qemu_mutex_lock(&tb_evicted_lock);
+    g_hash_table_remove_all(tb_evicted_pcs);
+    qemu_mutex_unlock(&tb_evicted_lock);
+//// --- End LibAFL code ---
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
     qemu_plugin_flush_cb();
@@ -906,15 +928,24 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             tcg_flush_jmp_cache(cpu);
         }
     } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb->pc);
+        //// --- Begin LibAFL code ---
+        /* The caches may be resized concurrently by their cpu */
+        RCU_READ_LOCK_GUARD();
 
         CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+            uint32_t h = tb_jmp_cache_hash_func(jc, tb->pc) * jc->ways;
 
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+            for (uint32_t i = h; i < h + jc->ways; i++) {
+                if (qatomic_read(&jc->array[i].tb) == tb) {
+                    qatomic_set(&jc->array[i].tb, NULL);
+                }
             }
+
+            /* The indirect branch caches are not indexed by pc */
+            libafl_ibc_invalidate(cpu);
         }
+        //// --- End LibAFL code ---
     }
 }
 
@@ -985,6 +1016,132 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+//// --- Begin LibAFL code ---
+
+bool tb_evict_enabled = true;
+
+/*
+ * Like do_tb_phys_invalidate, for a TB about to be freed along with its
+ * region.  The jump caches are flushed once by the caller instead of once
+ * per TB, and edges (which are not in the QHT) are unlinked as well.
+ */
+static gboolean tb_evict_one(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    size_t *nb_evicted = data;
+    uint32_t orig_cflags = tb_cflags(tb);
+
+    /* Invalidated TBs are already unlinked from everything. */
+    if (orig_cflags & CF_INVALID) {
+        return false;
+    }
+
+    qemu_spin_lock(&tb->jmp_lock);
+    qatomic_set(&tb->cflags, tb->cflags | CF_INVALID);
+    qemu_spin_unlock(&tb->jmp_lock);
+
+    if (!(orig_cflags & CF_IS_EDGE)) {
+        tb_page_addr_t phys_pc = tb_page_addr0(tb);
+        uint32_t h = tb_hash_func(phys_pc,
+                                  (orig_cflags & CF_PCREL ? 0 : tb->pc),
+                                  tb->flags, tb->cs_base, orig_cflags);
+
+        if (qht_remove(&tb_ctx.htable, tb, h)) {
+            tb_lock_pages(tb);
+            tb_remove(tb);
+            tb_unlock_pages(tb);
+        }
+
+        if (g_hash_table_size(tb_evicted_pcs) < TB_EVICTED_PCS_MAX) {
+            g_hash_table_add(tb_evicted_pcs, (gpointer)(uintptr_t)tb->pc);
+        }
+    }
+
+    tb_remove_from_jmp_list(tb, 0);
+    tb_remove_from_jmp_list(tb, 1);
+    tb_jmp_unlink(tb);
+
+    (*nb_evicted)++;
+    return false;
+}
+
+/*
+ * Evict the least recently used region of the code cache and make the
+ * current TCG context translate into it.
+ * Returns false if there is no region to evict, in which case the caller
+ * must flush everything.
+ * Same calling context as tb_flush__exclusive_or_serial.
+ */
+bool tb_evict_region__exclusive_or_serial(void)
+{
+    size_t nb_evicted = 0;
+    ssize_t victim;
+    CPUState *cpu;
+
+    assert(tcg_enabled());
+    assert(!runstate_is_running() ||
+           (current_cpu && cpu_in_serial_context(current_cpu)));
+
+    victim = tcg_region_evict_victim();
+    if (victim < 0) {
+        return false;
+    }
+
+    mmap_lock();
+    qemu_mutex_lock(&tb_evicted_lock);
+    tcg_region_foreach_tb(victim, tb_evict_one, &nb_evicted);
+    qemu_mutex_unlock(&tb_evicted_lock);
+    mmap_unlock();
+
+    CPU_FOREACH(cpu) {
+        tcg_flush_jmp_cache(cpu);
+    }
+
+    tcg_region_reuse(tcg_ctx, victim);
+
+    qatomic_inc(&tb_ctx.tb_evict_count);
+    qatomic_set(&tb_ctx.tb_evicted_count,
+                tb_ctx.tb_evicted_count + nb_evicted);
+    return true;
+}
+
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data counts)
+{
+    /* Another CPU already made room, just retry. */
+    if (tb_ctx.tb_flush_count + tb_ctx.tb_evict_count != counts.host_int) {
+        return;
+    }
+
+    if (!tb_evict_region__exclusive_or_serial()) {
+        tb_flush__exclusive_or_serial();
+    }
+}
+
+void queue_tb_evict(CPUState *cs)
+{
+    if (tcg_enabled()) {
+        unsigned counts = qatomic_read(&tb_ctx.tb_flush_count) +
+                          qatomic_read(&tb_ctx.tb_evict_count);
+        async_safe_run_on_cpu(cs, do_tb_evict, RUN_ON_CPU_HOST_INT(counts));
+    }
+}
+
+void tb_count_retranslation(const TranslationBlock *tb)
+{
+    if (!qatomic_read(&tb_ctx.tb_evict_count)) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_evicted_lock);
+    if (g_hash_table_remove(tb_evicted_pcs, (gpointer)(uintptr_t)tb->pc)) {
+        qatomic_set(&tb_ctx.tb_retranslate_count,
+                    tb_ctx.tb_retranslate_count + 1);
+    }
+    qemu_mutex_unlock(&tb_evicted_lock);
+}
+
+//// --- End LibAFL code ---
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
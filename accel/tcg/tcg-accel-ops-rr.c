@@ -27,6 +27,9 @@
 #include "qemu/lockable.h"
 #include "system/tcg.h"
 #include "system/replay.h"
+//// --- Begin LibAFL code ---
+#include "system/cpu-timers.h"
+//// --- End LibAFL code ---
 #include "exec/icount.h"
 #include "qemu/main-loop.h"
 #include "qemu/notify.h"
@@ -117,6 +120,9 @@ static void rr_wait_io_event(void)
 
     while (all_cpu_threads_idle()) {
         rr_stop_kick_timer();
+//// --- Begin LibAFL code ---
+        libafl_idle_skip_warp();
+//// --- End LibAFL code ---
         qemu_cond_wait_bql(first_cpu->halt_cond);
     }
 
@@ -16,6 +16,7 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#include "exec/tb-flush.h"
 #include <math.h>
 
 static void dump_drift_info(GString *buf)
@@ -155,6 +156,33 @@ static void tcg_dump_flush_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+//// --- Begin LibAFL code ---
+    g_string_append_printf(buf, "TB region evictions %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
+    g_string_append_printf(buf, "TB evicted count    %zu\n",
+                           qatomic_read(&tb_ctx.tb_evicted_count));
+    g_string_append_printf(buf, "TB retranslations   %zu\n",
+                           qatomic_read(&tb_ctx.tb_retranslate_count));
+
+    CPUState *cpu;
+    CPU_FOREACH(cpu) {
+        TCGJumpCacheStats jst;
+        uint64_t lookups;
+
+        tcg_jmp_cache_stats(cpu, &jst);
+        lookups = jst.hits + jst.misses;
+        g_string_append_printf(buf, "CPU %d jump cache    %u sets x %u ways, "
+                               "%" PRIu64 " resizes\n",
+                               cpu->cpu_index, jst.sets, jst.ways,
+                               jst.resizes);
+        g_string_append_printf(buf, "  hits %" PRIu64 " (%0.1f%%) "
+                               "misses %" PRIu64 " conflicts %" PRIu64
+                               " not in QHT %" PRIu64 "\n",
+                               jst.hits,
+                               lookups ? jst.hits * 100.0 / lookups : 0,
+                               jst.misses, jst.conflicts, jst.qht_misses);
+    }
+//// --- End LibAFL code ---
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
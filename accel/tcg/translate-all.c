@@ -42,6 +42,7 @@
 
 #include "libafl/hooks/tcg/block.h"
 #include "libafl/hooks/tcg/edge.h"
+#include "libafl/profile.h"
 
 //// --- End LibAFL code ---
 
@@ -285,6 +286,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     int gen_code_size, search_size, max_insns;
     int64_t ti;
     void *host_pc;
+    //// --- Begin LibAFL code ---
+    int64_t libafl_gen_start;
+    //// --- End LibAFL code ---
 
     assert_memory_lock();
     qemu_thread_jit_write();
@@ -309,10 +313,24 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
         /* flush must be done */
         if (cpu_in_serial_context(cpu)) {
             trace_tb_gen_code_buffer_overflow("tcg_tb_alloc");
-            tb_flush__exclusive_or_serial();
+//// --- Begin LibAFL code ---
+            /*
+             * The caller drops its last_tb when an eviction happened, see
+             * cpu_exec_loop.
+             */
+            if (!tb_evict_enabled || !tb_evict_region__exclusive_or_serial()) {
+                tb_flush__exclusive_or_serial();
+            }
+//// --- End LibAFL code ---
             goto buffer_overflow;
         }
-        queue_tb_flush(cpu);
+//// --- Begin LibAFL code ---
+        if (tb_evict_enabled) {
+            queue_tb_evict(cpu);
+        } else {
+            queue_tb_flush(cpu);
+        }
+//// --- End LibAFL code ---
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -340,6 +358,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     tcg_ctx->addr_type = target_long_bits() == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
     tcg_ctx->guest_mo = cpu->cc->tcg_ops->guest_default_memory_order;
 
+    //// --- Begin LibAFL code ---
+    libafl_gen_start = libafl_profile_gen_clock();
+    //// --- End LibAFL code ---
+
  restart_translate:
     trace_translate_block(tb, s.pc, tb->tc.ptr);
 
@@ -418,6 +440,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     }
     tb->tc.size = gen_code_size;
 
+    //// --- Begin LibAFL code ---
+    libafl_profile_gen_end(tb, s.pc, libafl_gen_start);
+    //// --- End LibAFL code ---
+
     /*
      * For CF_PCREL, attribute all executions of the generated code
      * to its first mapping.
@@ -563,6 +589,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
         // return existing_tb;
 //// --- Begin LibAFL code ---
         tb = existing_tb;
+    } else {
+        tb_count_retranslation(tb);
 //// --- End LibAFL code ---
     }
 
@@ -658,14 +686,92 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
  */
 void tcg_flush_jmp_cache(CPUState *cpu)
 {
-    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    //// --- Begin LibAFL code ---
+    /* The cache may be resized concurrently by its cpu */
+    RCU_READ_LOCK_GUARD();
+
+    CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    //// --- End LibAFL code ---
 
     /* During early initialization, the cache may not yet be allocated. */
     if (unlikely(jc == NULL)) {
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    //// --- Begin LibAFL code ---
+    for (size_t i = 0; i < tb_jmp_cache_entries(jc); i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
+
+    libafl_ibc_invalidate(cpu);
+    //// --- End LibAFL code ---
+}
+
+//// --- Begin LibAFL code ---
+
+CPUJumpCache *tb_jmp_cache_new(unsigned bits, unsigned ways)
+{
+    CPUJumpCache *jc;
+
+    jc = g_malloc0(sizeof(*jc) + ((size_t)ways << bits) * sizeof(jc->array[0]));
+    jc->bits = bits;
+    jc->ways = ways;
+    jc->adaptive = true;
+
+    return jc;
+}
+
+/*
+ * Replace the jump cache of @cpu by an empty one of 1 << @bits sets of
+ * @ways entries.  Must be called by @cpu itself.
+ */
+void tcg_resize_jmp_cache(CPUState *cpu, unsigned bits, unsigned ways)
+{
+    CPUJumpCache *old = cpu->tb_jmp_cache;
+    CPUJumpCache *jc;
+
+    bits = MIN(MAX(bits, TB_JMP_CACHE_MIN_BITS), TB_JMP_CACHE_MAX_BITS);
+    ways = ways >= 4 ? 4 : ways >= 2 ? 2 : 1;
+
+    if (old->bits == bits && old->ways == ways) {
+        return;
+    }
+
+    jc = tb_jmp_cache_new(bits, ways);
+    jc->adaptive = old->adaptive;
+    jc->hits = old->hits;
+    jc->misses = old->misses;
+    jc->conflicts = old->conflicts;
+    jc->resizes = old->resizes + 1;
+    jc->qht_misses = old->qht_misses;
+
+    qatomic_rcu_set(&cpu->tb_jmp_cache, jc);
+    g_free_rcu(old, rcu);
 }
+
+void tcg_jmp_cache_set_adaptive(CPUState *cpu, bool adaptive)
+{
+    cpu->tb_jmp_cache->adaptive = adaptive;
+}
+
+void tcg_jmp_cache_stats(CPUState *cpu, TCGJumpCacheStats *stats)
+{
+    RCU_READ_LOCK_GUARD();
+
+    CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+
+    if (!jc) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    stats->sets = 1u << jc->bits;
+    stats->ways = jc->ways;
+    stats->hits = jc->hits;
+    stats->misses = jc->misses;
+    stats->conflicts = jc->conflicts;
+    stats->resizes = jc->resizes;
+    stats->qht_misses = jc->qht_misses;
+}
+
+//// --- End LibAFL code ---
@@ -26,8 +26,13 @@
 #include "libafl/exit.h"
 #include "libafl/hook.h"
 
+#include "libafl/profile.h"
+#include "libafl/trace.h"
+
 #include "libafl/hooks/tcg/instruction.h"
 #include "libafl/hooks/tcg/backdoor.h"
+#include "libafl/hooks/tcg/block.h"
+#include "libafl/hooks/tcg/edge.h"
 
 //// --- End LibAFL code ---
 
@@ -130,6 +135,40 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return translator_is_same_page(db, dest);
 }
 
+//// --- Begin LibAFL code ---
+
+/* Longest insn of all the targets, see translator_trace_can_continue. */
+#define LIBAFL_TRACE_MAX_INSN_LEN 16
+
+bool translator_trace_can_continue(DisasContextBase *db, vaddr dest)
+{
+    /*
+     * Only follow forward jumps, and make sure the insn at dest cannot
+     * cross into the next page: the trace then covers exactly the range
+     * [pc_first, pc_next) of a single page, as any other TB.
+     */
+    return db->libafl_trace &&
+           db->libafl_trace_blocks < LIBAFL_TRACE_MAX_BLOCKS &&
+           dest > db->pc_next &&
+           translator_is_same_page(db, dest + LIBAFL_TRACE_MAX_INSN_LEN - 1) &&
+           db->num_insns < db->max_insns && !tcg_op_buf_full();
+}
+
+void translator_trace_continue(DisasContextBase *db, vaddr dest)
+{
+    /* Same ids as the edge TB of a separate translation. */
+    bool no_exec_hook = libafl_qemu_hook_edge_gen(db->libafl_trace_block, dest);
+    if (!no_exec_hook) {
+        libafl_qemu_hook_edge_run();
+    }
+
+    /* The block hooks follow once the jump insn is complete. */
+    db->libafl_trace_dest = dest;
+    db->libafl_trace_jumped = true;
+}
+
+//// --- End LibAFL code ---
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -154,6 +193,16 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->record_len = 0;
     db->code_mmuidx = cpu_mmu_index(cpu, true);
 
+    //// --- Begin LibAFL code ---
+
+    db->libafl_trace = false;
+    db->libafl_trace_jumped = false;
+    db->libafl_trace_blocks = 1;
+    db->libafl_trace_block = pc;
+    db->libafl_trace_dest = 0;
+
+    //// --- End LibAFL code ---
+
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -165,6 +214,16 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     plugin_enabled = plugin_gen_tb_start(cpu, db);
     db->plugin_enabled = plugin_enabled;
 
+    //// --- Begin LibAFL code ---
+
+    /* Plugins expect the insns of a TB to be contiguous. */
+    if (!plugin_enabled) {
+        db->libafl_trace = libafl_trace_gen_start(tb, pc);
+    }
+    libafl_profile_gen_start(tb, pc);
+
+    //// --- End LibAFL code ---
+
     while (true) {
         *max_insns = ++db->num_insns;
         ops->insn_start(db, cpu);
@@ -247,6 +306,27 @@ post_translate_insn:
             plugin_gen_insn_end();
         }
 
+        //// --- Begin LibAFL code ---
+
+        /*
+         * The insn was a jump merged into the trace: its block ends here,
+         * and the next one starts at its target, with the same block hooks
+         * as in separate TBs.
+         */
+        if (db->libafl_trace_jumped) {
+            libafl_qemu_hook_block_post_gen(db->libafl_trace_block,
+                                            db->pc_next -
+                                                db->libafl_trace_block);
+            libafl_qemu_hook_block_pre_run(db->libafl_trace_dest);
+
+            db->libafl_trace_block = db->libafl_trace_dest;
+            db->libafl_trace_blocks++;
+            db->pc_next = db->libafl_trace_dest;
+            db->libafl_trace_jumped = false;
+        }
+
+        //// --- End LibAFL code ---
+
         /* Stop translation if translate_insn so indicated.  */
         if (db->is_jmp != DISAS_NEXT) {
             break;
@@ -279,10 +359,25 @@ post_translate_insn:
     set_can_do_io(db, true);
     tcg_ctx->emit_before_op = NULL;
 
-    /* May be used by disas_log or plugin callbacks. */
+    /*
+     * May be used by disas_log or plugin callbacks.
+     * For a trace, this includes the code jumped over between its blocks:
+     * writes there invalidate it as well, which is only conservative.
+     */
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
 
+    //// --- Begin LibAFL code ---
+
+    /* The exits of a trace are the ones of its last block. */
+    tb->libafl_trace_tail = 0;
+    if (db->libafl_trace_blocks > 1) {
+        tb->libafl_trace_tail = db->libafl_trace_block;
+        libafl_trace_count(db->libafl_trace_blocks);
+    }
+
+    //// --- End LibAFL code ---
+
     if (plugin_enabled) {
         plugin_gen_tb_end(cpu, db->num_insns);
     }
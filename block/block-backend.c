@@ -1401,6 +1401,12 @@ blk_co_do_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
 
     ret = bdrv_co_preadv_part(blk->root, offset, bytes, qiov, qiov_offset,
                               flags);
+//// --- Begin LibAFL code ---
+    if (ret >= 0) {
+        syx_snapshot_cow_cache_read_entry(blk, offset, bytes, qiov,
+                                          qiov_offset);
+    }
+//// --- End LibAFL code ---
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1477,6 +1483,15 @@ blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
         flags |= BDRV_REQ_FUA;
     }
 
+//// --- Begin LibAFL code ---
+    if (syx_snapshot_cow_cache_enabled()) {
+        ret = syx_snapshot_cow_cache_write_entry(blk, blk->root, offset, bytes,
+                                                 qiov, qiov_offset, flags);
+        bdrv_dec_in_flight(bs);
+        return ret;
+    }
+//// --- End LibAFL code ---
+
     ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
                                flags);
     bdrv_dec_in_flight(bs);
@@ -1661,16 +1676,8 @@ static void coroutine_fn blk_aio_read_entry(void *opaque)
 
     assert(qiov->size == acb->bytes);
 
-//// --- Begin LibAFL code ---
-    if (!syx_snapshot_cow_cache_read_entry(rwco->blk, rwco->offset, acb->bytes, qiov, 0, rwco->flags)) {
-//// --- End LibAFL code ---
-       rwco->ret = blk_co_do_preadv_part(rwco->blk, rwco->offset, acb->bytes, qiov,
+    rwco->ret = blk_co_do_preadv_part(rwco->blk, rwco->offset, acb->bytes, qiov,
                                       0, rwco->flags);
-//// --- Begin LibAFL code ---
-    } else {
-       rwco->ret = 0;
-    }
-//// --- End LibAFL code ---
 
     blk_aio_complete(acb);
 }
@@ -1683,15 +1690,8 @@ static void coroutine_fn blk_aio_write_entry(void *opaque)
 
     assert(!qiov || qiov->size == acb->bytes);
 
-//// --- Begin LibAFL code ---
-   if (!syx_snapshot_cow_cache_write_entry(rwco->blk, rwco->offset, acb->bytes, qiov, 0, rwco->flags)) {
-//// --- End LibAFL code ---
-        rwco->ret = blk_co_do_pwritev_part(rwco->blk, rwco->offset, acb->bytes, qiov, 0, rwco->flags);
-//// --- Begin LibAFL code ---
-   } else {
-       rwco->ret = 0;
-   }
-//// --- End LibAFL code ---
+    rwco->ret = blk_co_do_pwritev_part(rwco->blk, rwco->offset, acb->bytes,
+                                       qiov, 0, rwco->flags);
 
     blk_aio_complete(acb);
 }
@@ -1859,6 +1859,13 @@ blk_co_do_pdiscard(BlockBackend *blk, int64_t offset, int64_t bytes)
         return ret;
     }
 
+//// --- Begin LibAFL code ---
+    /* Discarded data is left as is: reads keep returning the same content */
+    if (syx_snapshot_cow_cache_enabled()) {
+        return 0;
+    }
+//// --- End LibAFL code ---
+
     return bdrv_co_pdiscard(blk->root, offset, bytes);
 }
 
@@ -1904,6 +1911,13 @@ static int coroutine_fn blk_co_do_flush(BlockBackend *blk)
         return -ENOMEDIUM;
     }
 
+//// --- Begin LibAFL code ---
+    /* Nothing reaches the image */
+    if (syx_snapshot_cow_cache_enabled()) {
+        return 0;
+    }
+//// --- End LibAFL code ---
+
     return bdrv_co_flush(blk_bs(blk));
 }
 
@@ -2627,6 +2641,13 @@ int coroutine_fn blk_co_truncate(BlockBackend *blk, int64_t offset, bool exact,
         return -ENOMEDIUM;
     }
 
+//// --- Begin LibAFL code ---
+    if (syx_snapshot_cow_cache_enabled()) {
+        error_setg(errp, "Cannot resize a device behind the SYX COW cache");
+        return -ENOTSUP;
+    }
+//// --- End LibAFL code ---
+
     return bdrv_co_truncate(blk->root, offset, exact, prealloc, flags, errp);
 }
 
@@ -2892,6 +2913,13 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
         return r;
     }
 
+//// --- Begin LibAFL code ---
+    /* Callers fall back to reads and writes, which go through the cache */
+    if (syx_snapshot_cow_cache_enabled()) {
+        return -ENOTSUP;
+    }
+//// --- End LibAFL code ---
+
     return bdrv_co_copy_range(blk_in->root, off_in,
                               blk_out->root, off_out,
                               bytes, read_flags, write_flags);
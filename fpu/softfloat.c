@@ -236,6 +236,35 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Without a sticky inexact flag, add, sub, mul, div, sqrt and the narrowing
+ * conversion still use the host FPU: the inexact flag is then computed from
+ * an exact residual of the host result (see the *_exact functions), which is
+ * much cheaper than the softfloat path.
+ */
+static inline bool can_use_fpu_exact(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_rounding_mode == float_round_nearest_even);
+}
+
+/*
+ * The C conversions of floats to integers truncate whatever the rounding
+ * mode, and the result is exact iff it compares equal to the input.  Only
+ * the in-range conversions of zero or normal inputs use them, the others
+ * need the invalid and denormal flags of softfloat.
+ */
+static inline bool can_use_fpu_trunc(const float_status *s)
+{
+    return !QEMU_NO_HARDFLOAT;
+}
+
+//// --- End LibAFL code ---
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -266,6 +295,38 @@ typedef float64 (*soft_f64_op2_fn)(float64 a, float64 b, float_status *s);
 typedef float   (*hard_f32_op2_fn)(float a, float b);
 typedef double  (*hard_f64_op2_fn)(double a, double b);
 
+//// --- Begin LibAFL code ---
+
+typedef bool (*f32_exact_fn)(union_float32 a, union_float32 b,
+                             union_float32 r);
+typedef bool (*f64_exact_fn)(union_float64 a, union_float64 b,
+                             union_float64 r);
+
+/*
+ * The residuals used to check exactness are themselves exact as long as
+ * neither the operands nor the result are close to the subnormal range or
+ * to overflow.  Everything else goes through softfloat, which also gets the
+ * underflow and overflow flags right.
+ */
+#define F32_EXACT_MIN 0x1p-100f
+#define F32_EXACT_MAX 0x1p+120f
+#define F64_EXACT_MIN 0x1p-960
+#define F64_EXACT_MAX 0x1p+1000
+
+static inline bool f32_in_exact_range(union_float32 a)
+{
+    return a.h == 0 || (fabsf(a.h) >= F32_EXACT_MIN &&
+                        fabsf(a.h) <= F32_EXACT_MAX);
+}
+
+static inline bool f64_in_exact_range(union_float64 a)
+{
+    return a.h == 0 || (fabs(a.h) >= F64_EXACT_MIN &&
+                        fabs(a.h) <= F64_EXACT_MAX);
+}
+
+//// --- End LibAFL code ---
+
 /* 2-input is-zero-or-normal */
 static inline bool f32_is_zon2(union_float32 a, union_float32 b)
 {
@@ -337,16 +398,20 @@ static inline bool f64_is_inf(union_float64 a)
 static inline float32
 float32_gen2(float32 xa, float32 xb, float_status *s,
              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
-             f32_check_fn pre, f32_check_fn post)
+             f32_check_fn pre, f32_check_fn post, f32_exact_fn exact)
 {
     union_float32 ua, ub, ur;
+    bool check_exact;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
+    //// --- Begin LibAFL code ---
+    if (unlikely(!can_use_fpu_exact(s))) {
         goto soft;
     }
+    check_exact = !(s->float_exception_flags & float_flag_inexact);
+    //// --- End LibAFL code ---
 
     float32_input_flush2(&ua.s, &ub.s, s);
     if (unlikely(!pre(ua, ub))) {
@@ -354,6 +419,22 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
     }
 
     ur.h = hard(ua.h, ub.h);
+    //// --- Begin LibAFL code ---
+    if (check_exact) {
+        if (unlikely(!f32_in_exact_range(ua) || !f32_in_exact_range(ub) ||
+                     !f32_in_exact_range(ur))) {
+            goto soft;
+        }
+        // A zero result may come from an underflow, that no residual shows.
+        if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
+            goto soft;
+        }
+        if (!exact(ua, ub, ur)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return ur.s;
+    }
+    //// --- End LibAFL code ---
     if (unlikely(f32_is_inf(ur))) {
         float_raise(float_flag_overflow, s);
     } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
@@ -368,16 +449,20 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
 static inline float64
 float64_gen2(float64 xa, float64 xb, float_status *s,
              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
-             f64_check_fn pre, f64_check_fn post)
+             f64_check_fn pre, f64_check_fn post, f64_exact_fn exact)
 {
     union_float64 ua, ub, ur;
+    bool check_exact;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
+    //// --- Begin LibAFL code ---
+    if (unlikely(!can_use_fpu_exact(s))) {
         goto soft;
     }
+    check_exact = !(s->float_exception_flags & float_flag_inexact);
+    //// --- End LibAFL code ---
 
     float64_input_flush2(&ua.s, &ub.s, s);
     if (unlikely(!pre(ua, ub))) {
@@ -385,6 +470,22 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     }
 
     ur.h = hard(ua.h, ub.h);
+    //// --- Begin LibAFL code ---
+    if (check_exact) {
+        if (unlikely(!f64_in_exact_range(ua) || !f64_in_exact_range(ub) ||
+                     !f64_in_exact_range(ur))) {
+            goto soft;
+        }
+        // A zero result may come from an underflow, that no residual shows.
+        if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
+            goto soft;
+        }
+        if (!exact(ua, ub, ur)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return ur.s;
+    }
+    //// --- End LibAFL code ---
     if (unlikely(f64_is_inf(ur))) {
         float_raise(float_flag_overflow, s);
     } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
@@ -1972,6 +2073,37 @@ static double hard_f64_sub(double a, double b)
     return a - b;
 }
 
+//// --- Begin LibAFL code ---
+
+/* TwoSum: the rounding error of a + b, computed exactly. */
+static bool f32_add_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    float bb = r.h - a.h;
+
+    return (a.h - (r.h - bb)) + (b.h - bb) == 0;
+}
+
+static bool f32_sub_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    b.h = -b.h;
+    return f32_add_exact(a, b, r);
+}
+
+static bool f64_add_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    double bb = r.h - a.h;
+
+    return (a.h - (r.h - bb)) + (b.h - bb) == 0;
+}
+
+static bool f64_sub_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    b.h = -b.h;
+    return f64_add_exact(a, b, r);
+}
+
+//// --- End LibAFL code ---
+
 static bool f32_addsubmul_post(union_float32 a, union_float32 b)
 {
     if (QEMU_HARDFLOAT_2F32_USE_FP) {
@@ -1990,41 +2122,43 @@ static bool f64_addsubmul_post(union_float64 a, union_float64 b)
 }
 
 static float32 float32_addsub(float32 a, float32 b, float_status *s,
-                              hard_f32_op2_fn hard, soft_f32_op2_fn soft)
+                              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                              f32_exact_fn exact)
 {
     return float32_gen2(a, b, s, hard, soft,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, exact);
 }
 
 static float64 float64_addsub(float64 a, float64 b, float_status *s,
-                              hard_f64_op2_fn hard, soft_f64_op2_fn soft)
+                              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                              f64_exact_fn exact)
 {
     return float64_gen2(a, b, s, hard, soft,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, exact);
 }
 
 float32 QEMU_FLATTEN
 float32_add(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add);
+    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add, f32_add_exact);
 }
 
 float32 QEMU_FLATTEN
 float32_sub(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub);
+    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub, f32_sub_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_add(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add);
+    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add, f64_add_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_sub(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
+    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub, f64_sub_exact);
 }
 
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
@@ -2166,18 +2300,33 @@ static double hard_f64_mul(double a, double b)
     return a * b;
 }
 
+//// --- Begin LibAFL code ---
+
+/* The rounding error of a * b is exactly fma(a, b, -r). */
+static bool f32_mul_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    return fmaf(a.h, b.h, -r.h) == 0;
+}
+
+static bool f64_mul_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    return fma(a.h, b.h, -r.h) == 0;
+}
+
+//// --- End LibAFL code ---
+
 float32 QEMU_FLATTEN
 float32_mul(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_mul, soft_f32_mul,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, f32_mul_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_mul(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_mul, soft_f64_mul,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, f64_mul_exact);
 }
 
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
@@ -2574,18 +2723,33 @@ static bool f64_div_post(union_float64 a, union_float64 b)
     return !float64_is_zero(a.s);
 }
 
+//// --- Begin LibAFL code ---
+
+/* a / b is exact iff the remainder a - r * b is zero. */
+static bool f32_div_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    return fmaf(-r.h, b.h, a.h) == 0;
+}
+
+static bool f64_div_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    return fma(-r.h, b.h, a.h) == 0;
+}
+
+//// --- End LibAFL code ---
+
 float32 QEMU_FLATTEN
 float32_div(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_div, soft_f32_div,
-                        f32_div_pre, f32_div_post);
+                        f32_div_pre, f32_div_post, f32_div_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_div(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_div, soft_f64_div,
-                        f64_div_pre, f64_div_post);
+                        f64_div_pre, f64_div_post, f64_div_exact);
 }
 
 float64 float64r32_div(float64 a, float64 b, float_status *status)
@@ -2905,6 +3069,29 @@ float32 float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    //// --- Begin LibAFL code ---
+    if (likely(can_use_fpu_exact(s) && float64_is_zero_or_normal(a))) {
+        union_float64 ud;
+        union_float32 uf;
+
+        ud.s = a;
+        uf.h = ud.h;
+
+        /*
+         * Results that are tiny (before rounding) or overflow need the
+         * softfloat flags.  Otherwise the narrowing is exact iff the
+         * widened result is equal to the input.
+         */
+        if (likely(float64_is_zero(a) ||
+                   (fabsf(uf.h) > FLT_MIN && !f32_is_inf(uf)))) {
+            if (uf.h != ud.h) {
+                float_raise(float_flag_inexact, s);
+            }
+            return uf.s;
+        }
+    }
+    //// --- End LibAFL code ---
+
     float64_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -3437,11 +3624,43 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    //// --- Begin LibAFL code ---
+    if (likely(can_use_fpu_trunc(s) && float32_is_zero_or_normal(a))) {
+        union_float32 ua;
+
+        ua.s = a;
+        if (likely(ua.h >= -0x1p31f && ua.h < 0x1p31f)) {
+            int32_t r = ua.h;
+
+            if (r != ua.h) {
+                float_raise(float_flag_inexact, s);
+            }
+            return r;
+        }
+    }
+    //// --- End LibAFL code ---
+
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    //// --- Begin LibAFL code ---
+    if (likely(can_use_fpu_trunc(s) && float32_is_zero_or_normal(a))) {
+        union_float32 ua;
+
+        ua.s = a;
+        if (likely(ua.h >= -0x1p63f && ua.h < 0x1p63f)) {
+            int64_t r = ua.h;
+
+            if (r != ua.h) {
+                float_raise(float_flag_inexact, s);
+            }
+            return r;
+        }
+    }
+    //// --- End LibAFL code ---
+
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3452,11 +3671,43 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    //// --- Begin LibAFL code ---
+    if (likely(can_use_fpu_trunc(s) && float64_is_zero_or_normal(a))) {
+        union_float64 ua;
+
+        ua.s = a;
+        if (likely(ua.h > -0x1p31 - 1 && ua.h < 0x1p31)) {
+            int32_t r = ua.h;
+
+            if (r != ua.h) {
+                float_raise(float_flag_inexact, s);
+            }
+            return r;
+        }
+    }
+    //// --- End LibAFL code ---
+
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    //// --- Begin LibAFL code ---
+    if (likely(can_use_fpu_trunc(s) && float64_is_zero_or_normal(a))) {
+        union_float64 ua;
+
+        ua.s = a;
+        if (likely(ua.h >= -0x1p63 && ua.h < 0x1p63)) {
+            int64_t r = ua.h;
+
+            if (r != ua.h) {
+                float_raise(float_flag_inexact, s);
+            }
+            return r;
+        }
+    }
+    //// --- End LibAFL code ---
+
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3965,6 +4216,21 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
         return ur.s;
     }
 
+    //// --- Begin LibAFL code ---
+    /*
+     * The conversion is exact iff the result converts back to a.  2**63,
+     * which a rounds to at most, is out of range and cannot be exact.
+     */
+    if (likely(scale == 0) && can_use_fpu_exact(status)) {
+        union_float32 ur;
+        ur.h = a;
+        if (ur.h >= 0x1p63f || (int64_t)ur.h != a) {
+            float_raise(float_flag_inexact, status);
+        }
+        return ur.s;
+    }
+    //// --- End LibAFL code ---
+
     parts64_sint_to_float(&p, a, scale, status);
     return float32_round_pack_canonical(&p, status);
 }
@@ -4005,6 +4271,21 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
         return ur.s;
     }
 
+    //// --- Begin LibAFL code ---
+    /*
+     * The conversion is exact iff the result converts back to a.  2**63,
+     * which a rounds to at most, is out of range and cannot be exact.
+     */
+    if (likely(scale == 0) && can_use_fpu_exact(status)) {
+        union_float64 ur;
+        ur.h = a;
+        if (ur.h >= 0x1p63 || (int64_t)ur.h != a) {
+            float_raise(float_flag_inexact, status);
+        }
+        return ur.s;
+    }
+    //// --- End LibAFL code ---
+
     parts_sint_to_float(&p, a, scale, status);
     return float64_round_pack_canonical(&p, status);
 }
@@ -4361,6 +4642,25 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    //// --- Begin LibAFL code ---
+    /*
+     * Between zeros or normals that are not both zeros, all the variants
+     * but the magnitude ones simply select an operand, and raise no flag.
+     */
+    if (!QEMU_NO_HARDFLOAT && !(flags & minmax_ismag) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b) &&
+        !(float32_is_zero(a) && float32_is_zero(b))) {
+        union_float32 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (flags & minmax_ismin) {
+            return ua.h < ub.h ? a : b;
+        }
+        return ua.h < ub.h ? b : a;
+    }
+    //// --- End LibAFL code ---
+
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -4372,6 +4672,25 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    //// --- Begin LibAFL code ---
+    /*
+     * Between zeros or normals that are not both zeros, all the variants
+     * but the magnitude ones simply select an operand, and raise no flag.
+     */
+    if (!QEMU_NO_HARDFLOAT && !(flags & minmax_ismag) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b) &&
+        !(float64_is_zero(a) && float64_is_zero(b))) {
+        union_float64 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (flags & minmax_ismin) {
+            return ua.h < ub.h ? a : b;
+        }
+        return ua.h < ub.h ? b : a;
+    }
+    //// --- End LibAFL code ---
+
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -4706,9 +5025,11 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
     union_float32 ua, ur;
 
     ua.s = xa;
-    if (unlikely(!can_use_fpu(s))) {
+    //// --- Begin LibAFL code ---
+    if (unlikely(!can_use_fpu_exact(s))) {
         goto soft;
     }
+    //// --- End LibAFL code ---
 
     float32_input_flush1(&ua.s, s);
     if (QEMU_HARDFLOAT_1F32_USE_FP) {
@@ -4722,6 +5043,17 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
         goto soft;
     }
     ur.h = sqrtf(ua.h);
+    //// --- Begin LibAFL code ---
+    if (!(s->float_exception_flags & float_flag_inexact)) {
+        if (unlikely(!f32_in_exact_range(ua))) {
+            goto soft;
+        }
+        /* sqrt(a) is exact iff a - r * r is zero. */
+        if (fmaf(-ur.h, ur.h, ua.h) != 0) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    //// --- End LibAFL code ---
     return ur.s;
 
  soft:
@@ -4733,9 +5065,11 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
     union_float64 ua, ur;
 
     ua.s = xa;
-    if (unlikely(!can_use_fpu(s))) {
+    //// --- Begin LibAFL code ---
+    if (unlikely(!can_use_fpu_exact(s))) {
         goto soft;
     }
+    //// --- End LibAFL code ---
 
     float64_input_flush1(&ua.s, s);
     if (QEMU_HARDFLOAT_1F64_USE_FP) {
@@ -4749,6 +5083,17 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
         goto soft;
     }
     ur.h = sqrt(ua.h);
+    //// --- Begin LibAFL code ---
+    if (!(s->float_exception_flags & float_flag_inexact)) {
+        if (unlikely(!f64_in_exact_range(ua))) {
+            goto soft;
+        }
+        /* sqrt(a) is exact iff a - r * r is zero. */
+        if (fma(-ur.h, ur.h, ua.h) != 0) {
+            float_raise(float_flag_inexact, s);
+        }
+    }
+    //// --- End LibAFL code ---
     return ur.s;
 
  soft:
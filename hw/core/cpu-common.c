@@ -359,6 +359,9 @@ static void cpu_common_finalize(Object *obj)
     qemu_cond_destroy(cpu->halt_cond);
     g_free(cpu->halt_cond);
     g_free(cpu->thread);
+//// --- Begin LibAFL code ---
+    g_free(cpu->libafl_mem_cache);
+//// --- End LibAFL code ---
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
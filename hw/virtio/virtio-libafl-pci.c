@@ -0,0 +1,89 @@
+/*
+ * Virtio LibAFL test case injection device PCI Bindings
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "hw/virtio/virtio-pci.h"
+#include "hw/virtio/virtio-libafl.h"
+#include "hw/qdev-properties.h"
+#include "qapi/error.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+
+typedef struct VirtIOLibAFLPCI VirtIOLibAFLPCI;
+
+/*
+ * virtio-libafl-pci: This extends VirtioPCIProxy.
+ */
+#define TYPE_VIRTIO_LIBAFL_PCI "virtio-libafl-pci-base"
+DECLARE_INSTANCE_CHECKER(VirtIOLibAFLPCI, VIRTIO_LIBAFL_PCI,
+                         TYPE_VIRTIO_LIBAFL_PCI)
+
+struct VirtIOLibAFLPCI {
+    VirtIOPCIProxy parent_obj;
+    VirtIOLibAFL vdev;
+};
+
+static const Property virtio_libafl_pci_properties[] = {
+    DEFINE_PROP_BIT("ioeventfd", VirtIOPCIProxy, flags,
+                    VIRTIO_PCI_FLAG_USE_IOEVENTFD_BIT, true),
+    DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors,
+                       DEV_NVECTORS_UNSPECIFIED),
+};
+
+static void virtio_libafl_pci_realize(VirtIOPCIProxy *vpci_dev, Error **errp)
+{
+    VirtIOLibAFLPCI *vl = VIRTIO_LIBAFL_PCI(vpci_dev);
+    DeviceState *vdev = DEVICE(&vl->vdev);
+
+    if (vpci_dev->nvectors == DEV_NVECTORS_UNSPECIFIED) {
+        vpci_dev->nvectors = 2;
+    }
+
+    qdev_realize(vdev, BUS(&vpci_dev->bus), errp);
+}
+
+static void virtio_libafl_pci_class_init(ObjectClass *klass, const void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioPCIClass *k = VIRTIO_PCI_CLASS(klass);
+    PCIDeviceClass *pcidev_k = PCI_DEVICE_CLASS(klass);
+
+    k->realize = virtio_libafl_pci_realize;
+    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+
+    pcidev_k->vendor_id = PCI_VENDOR_ID_REDHAT_QUMRANET;
+    pcidev_k->device_id = PCI_DEVICE_ID_VIRTIO_10_BASE + VIRTIO_ID_LIBAFL;
+    pcidev_k->revision = VIRTIO_PCI_ABI_VERSION;
+    pcidev_k->class_id = PCI_CLASS_OTHERS;
+    device_class_set_props(dc, virtio_libafl_pci_properties);
+}
+
+static void virtio_libafl_initfn(Object *obj)
+{
+    VirtIOLibAFLPCI *dev = VIRTIO_LIBAFL_PCI(obj);
+
+    virtio_instance_init_common(obj, &dev->vdev, sizeof(dev->vdev),
+                                TYPE_VIRTIO_LIBAFL);
+}
+
+/* No legacy interface: there is no transitional device ID for it. */
+static const VirtioPCIDeviceTypeInfo virtio_libafl_pci_info = {
+    .base_name             = TYPE_VIRTIO_LIBAFL_PCI,
+    .non_transitional_name = "virtio-libafl-pci",
+    .instance_size = sizeof(VirtIOLibAFLPCI),
+    .instance_init = virtio_libafl_initfn,
+    .class_init    = virtio_libafl_pci_class_init,
+};
+
+static void virtio_libafl_pci_register(void)
+{
+    virtio_pci_types_register(&virtio_libafl_pci_info);
+}
+
+type_init(virtio_libafl_pci_register)
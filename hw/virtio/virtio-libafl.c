@@ -0,0 +1,353 @@
+/*
+ * Virtio LibAFL test case injection device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/memfd.h"
+#include "qemu/module.h"
+#include "hw/virtio/virtio.h"
+#include "hw/qdev-properties.h"
+#include "hw/virtio/virtio-libafl.h"
+#include "migration/qemu-file-types.h"
+#include "exec/cpu-common.h"
+
+static VirtIOLibAFL *virtio_libafl;
+
+/* Whether the buffer of elem can be backed by buf. */
+static bool virtio_libafl_can_map(VirtIOLibAFL *vl, VirtQueueElement *elem)
+{
+    size_t page_size = qemu_real_host_page_size();
+    size_t size = 0;
+
+    if (elem->out_num) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < elem->in_num; i++) {
+        RAMBlock *rb;
+        ram_addr_t offset;
+
+        if (!QEMU_PTR_IS_ALIGNED(elem->in_sg[i].iov_base, page_size) ||
+            !QEMU_IS_ALIGNED(elem->in_sg[i].iov_len, page_size)) {
+            return false;
+        }
+
+        rb = qemu_ram_block_from_host(elem->in_sg[i].iov_base, false, &offset);
+        if (!rb || qemu_ram_get_fd(rb) >= 0 || qemu_ram_is_shared(rb)) {
+            return false;
+        }
+
+        size += elem->in_sg[i].iov_len;
+    }
+
+    return size <= vl->buf_size;
+}
+
+static bool virtio_libafl_is_mapped(VirtIOLibAFL *vl, VirtQueueElement *elem)
+{
+    if (elem->in_num != vl->nb_mapped_sg) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < elem->in_num; i++) {
+        if (elem->in_sg[i].iov_base != vl->mapped_sg[i].iov_base ||
+            elem->in_sg[i].iov_len != vl->mapped_sg[i].iov_len) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Gives the pages back to guest RAM, with their content. */
+static void virtio_libafl_unmap(VirtIOLibAFL *vl)
+{
+    size_t offset = 0;
+
+    for (unsigned int i = 0; i < vl->nb_mapped_sg; i++) {
+        struct iovec *sg = &vl->mapped_sg[i];
+
+        if (mmap(sg->iov_base, sg->iov_len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+            MAP_FAILED) {
+            error_report("virtio-libafl: could not unmap the shared buffer");
+            abort();
+        }
+        memcpy(sg->iov_base, vl->buf + offset, sg->iov_len);
+        offset += sg->iov_len;
+    }
+
+    g_free(vl->mapped_sg);
+    vl->mapped_sg = NULL;
+    vl->nb_mapped_sg = 0;
+}
+
+static void virtio_libafl_map(VirtIOLibAFL *vl, VirtQueueElement *elem)
+{
+    size_t offset = 0;
+
+    if (virtio_libafl_is_mapped(vl, elem)) {
+        return;
+    }
+
+    virtio_libafl_unmap(vl);
+
+    if (!virtio_libafl_can_map(vl, elem)) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < elem->in_num; i++) {
+        if (mmap(elem->in_sg[i].iov_base, elem->in_sg[i].iov_len,
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, vl->buf_fd,
+                 offset) == MAP_FAILED) {
+            error_report("virtio-libafl: could not map the shared buffer");
+            abort();
+        }
+        offset += elem->in_sg[i].iov_len;
+    }
+
+    vl->mapped_sg = g_memdup2(elem->in_sg, elem->in_num * sizeof(struct iovec));
+    vl->nb_mapped_sg = elem->in_num;
+}
+
+static void virtio_libafl_drop_elem(VirtIOLibAFL *vl)
+{
+    if (vl->elem) {
+        virtqueue_detach_element(vl->vq, vl->elem, 0);
+        g_free(vl->elem);
+        vl->elem = NULL;
+    }
+}
+
+static void handle_output(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(vdev);
+    VirtQueueElement *elem;
+
+    /* Further buffers wait in the queue until this one is used */
+    if (vl->elem) {
+        return;
+    }
+
+    elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+    if (!elem) {
+        return;
+    }
+
+    virtio_libafl_map(vl, elem);
+    vl->elem = elem;
+
+    if (vl->delivered) {
+        vl->delivered = false;
+        vl->nb_completed++;
+    }
+}
+
+uint8_t *libafl_qemu_virtio_buffer(uint32_t *size)
+{
+    if (!virtio_libafl) {
+        return NULL;
+    }
+
+    *size = virtio_libafl->buf_size;
+    return virtio_libafl->buf;
+}
+
+bool libafl_qemu_virtio_deliver(uint32_t len)
+{
+    VirtIOLibAFL *vl = virtio_libafl;
+    VirtQueueElement *elem;
+
+    if (!vl || !vl->elem) {
+        return false;
+    }
+
+    elem = vl->elem;
+    len = MIN(len, iov_size(elem->in_sg, elem->in_num));
+    len = MIN(len, vl->buf_size);
+
+    /*
+     * The guest owns the buffer again once it is used: its pages go back to
+     * guest RAM, with the test case, before the guest can see it in the used
+     * ring.
+     */
+    if (virtio_libafl_is_mapped(vl, elem)) {
+        virtio_libafl_unmap(vl);
+    } else {
+        iov_from_buf(elem->in_sg, elem->in_num, 0, vl->buf, len);
+    }
+
+    virtqueue_push(vl->vq, elem, len);
+    virtio_notify(VIRTIO_DEVICE(vl), vl->vq);
+    g_free(elem);
+    vl->elem = NULL;
+
+    vl->delivered = true;
+    vl->nb_delivered++;
+    return true;
+}
+
+bool libafl_qemu_virtio_done(void)
+{
+    return virtio_libafl && !virtio_libafl->delivered;
+}
+
+static uint64_t get_features(VirtIODevice *vdev, uint64_t f, Error **errp)
+{
+    return f;
+}
+
+static void virtio_libafl_get_config(VirtIODevice *vdev, uint8_t *config)
+{
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(vdev);
+    struct virtio_libafl_config cfg;
+
+    cfg.buf_size = cpu_to_le32(vl->buf_size);
+    memcpy(config, &cfg, sizeof(cfg));
+}
+
+static void virtio_libafl_reset(VirtIODevice *vdev)
+{
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(vdev);
+
+    virtio_libafl_drop_elem(vl);
+    virtio_libafl_unmap(vl);
+    vl->delivered = false;
+}
+
+static void virtio_libafl_save(VirtIODevice *vdev, QEMUFile *f)
+{
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(vdev);
+
+    qemu_put_byte(f, vl->elem != NULL);
+    if (vl->elem) {
+        qemu_put_virtqueue_element(vdev, f, vl->elem);
+    }
+    qemu_put_byte(f, vl->delivered);
+}
+
+static int virtio_libafl_load(VirtIODevice *vdev, QEMUFile *f,
+                              int version_id)
+{
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(vdev);
+
+    virtio_libafl_drop_elem(vl);
+
+    if (qemu_get_byte(f)) {
+        vl->elem = qemu_get_virtqueue_element(vdev, f,
+                                              sizeof(VirtQueueElement));
+        /* Already mapped when restoring a snapshot of the same run */
+        virtio_libafl_map(vl, vl->elem);
+    } else {
+        virtio_libafl_unmap(vl);
+    }
+    vl->delivered = qemu_get_byte(f);
+
+    return 0;
+}
+
+static void virtio_libafl_device_realize(DeviceState *dev, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(dev);
+    size_t page_size = qemu_real_host_page_size();
+
+    if (virtio_libafl) {
+        error_setg(errp, "only one virtio-libafl device is supported");
+        return;
+    }
+
+    if (vl->buf_size == 0 || !QEMU_IS_ALIGNED(vl->buf_size, page_size)) {
+        error_setg(errp, "'buf-size' must be a non-zero multiple of %zu",
+                   page_size);
+        return;
+    }
+
+    vl->buf_fd = qemu_memfd_create("virtio-libafl", vl->buf_size, false, 0, 0,
+                                   errp);
+    if (vl->buf_fd < 0) {
+        return;
+    }
+
+    vl->buf = mmap(NULL, vl->buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   vl->buf_fd, 0);
+    if (vl->buf == MAP_FAILED) {
+        error_setg_errno(errp, errno, "could not map the shared buffer");
+        close(vl->buf_fd);
+        vl->buf = NULL;
+        return;
+    }
+
+    virtio_init(vdev, VIRTIO_ID_LIBAFL, sizeof(struct virtio_libafl_config));
+
+    vl->vq = virtio_add_queue(vdev, 8, handle_output);
+
+    virtio_libafl = vl;
+}
+
+static void virtio_libafl_device_unrealize(DeviceState *dev)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    VirtIOLibAFL *vl = VIRTIO_LIBAFL(dev);
+
+    virtio_libafl_drop_elem(vl);
+    virtio_libafl_unmap(vl);
+    virtio_del_queue(vdev, 0);
+    virtio_cleanup(vdev);
+
+    munmap(vl->buf, vl->buf_size);
+    close(vl->buf_fd);
+    virtio_libafl = NULL;
+}
+
+static const VMStateDescription vmstate_virtio_libafl = {
+    .name = "virtio-libafl",
+    .minimum_version_id = 1,
+    .version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_VIRTIO_DEVICE,
+        VMSTATE_END_OF_LIST()
+    },
+};
+
+static const Property virtio_libafl_properties[] = {
+    DEFINE_PROP_UINT32("buf-size", VirtIOLibAFL, buf_size, 1 << 20),
+};
+
+static void virtio_libafl_class_init(ObjectClass *klass, const void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioDeviceClass *vdc = VIRTIO_DEVICE_CLASS(klass);
+
+    device_class_set_props(dc, virtio_libafl_properties);
+    dc->vmsd = &vmstate_virtio_libafl;
+    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+    vdc->realize = virtio_libafl_device_realize;
+    vdc->unrealize = virtio_libafl_device_unrealize;
+    vdc->get_features = get_features;
+    vdc->get_config = virtio_libafl_get_config;
+    vdc->reset = virtio_libafl_reset;
+    vdc->save = virtio_libafl_save;
+    vdc->load = virtio_libafl_load;
+}
+
+static const TypeInfo virtio_libafl_info = {
+    .name = TYPE_VIRTIO_LIBAFL,
+    .parent = TYPE_VIRTIO_DEVICE,
+    .instance_size = sizeof(VirtIOLibAFL),
+    .class_init = virtio_libafl_class_init,
+};
+
+static void virtio_register_types(void)
+{
+    type_register_static(&virtio_libafl_info);
+}
+
+type_init(virtio_register_types)
@@ -49,6 +49,10 @@
 #include "standard-headers/linux/virtio_mem.h"
 #include "standard-headers/linux/virtio_vsock.h"
 
+//// --- Begin LibAFL code ---
+#include "hw/virtio/virtio-libafl.h"
+//// --- End LibAFL code ---
+
 /*
  * Maximum size of virtio device config space
  */
@@ -196,7 +200,10 @@ const char *virtio_device_names[] = {
     [VIRTIO_ID_PARAM_SERV] = "virtio-param-serv",
     [VIRTIO_ID_AUDIO_POLICY] = "virtio-audio-pol",
     [VIRTIO_ID_BT] = "virtio-bluetooth",
-    [VIRTIO_ID_GPIO] = "virtio-gpio"
+    [VIRTIO_ID_GPIO] = "virtio-gpio",
+//// --- Begin LibAFL code ---
+    [VIRTIO_ID_LIBAFL] = "virtio-libafl",
+//// --- End LibAFL code ---
 };
 
 static const char *virtio_id_to_name(uint16_t device_id)
@@ -35,4 +35,56 @@ void queue_tb_flush(CPUState *cs);
 
 void tcg_flush_jmp_cache(CPUState *cs);
 
+//// --- Begin LibAFL code ---
+
+/* Evict a single region instead of flushing, when the buffer is full. */
+extern bool tb_evict_enabled;
+
+/**
+ * tb_evict_region__exclusive_or_serial()
+ *
+ * Invalidate all the translation blocks of the least recently used region
+ * of the code generation buffer, and make the current TCG context reuse it.
+ * Returns false if no region can be evicted.
+ *
+ * Same calling context as tb_flush__exclusive_or_serial().
+ */
+bool tb_evict_region__exclusive_or_serial(void);
+
+/**
+ * queue_tb_evict() - add eviction to the cpu work queue
+ * @cs: CPUState
+ *
+ * Like queue_tb_flush(), falling back to a flush if nothing can be evicted.
+ */
+void queue_tb_evict(CPUState *cs);
+
+typedef struct TCGJumpCacheStats {
+    unsigned sets;
+    unsigned ways;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t conflicts;
+    uint64_t resizes;
+    uint64_t qht_misses;        /* misses that were not in the QHT either */
+} TCGJumpCacheStats;
+
+/**
+ * tcg_resize_jmp_cache() - change the geometry of the jump cache of @cs
+ * @cs: CPUState
+ * @bits: log2 of the number of sets
+ * @ways: associativity, 1, 2 or 4
+ *
+ * The cache is emptied.  Must be called from the thread of @cs, e.g. with
+ * run_on_cpu().
+ */
+void tcg_resize_jmp_cache(CPUState *cs, unsigned bits, unsigned ways);
+
+/* Let the jump cache of @cs grow when it has too many conflict misses. */
+void tcg_jmp_cache_set_adaptive(CPUState *cs, bool adaptive);
+
+void tcg_jmp_cache_stats(CPUState *cs, TCGJumpCacheStats *stats);
+
+//// --- End LibAFL code ---
+
 #endif /* _TB_FLUSH_H_ */
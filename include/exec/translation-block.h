@@ -147,6 +147,17 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    //// --- Begin LibAFL code ---
+
+    /*
+     * For hot traces made of several guest blocks, the start of the last
+     * one, i.e. the source of the edges leaving the TB.  0 otherwise.
+     * size then spans from the first block to the end of the last one.
+     */
+    vaddr libafl_trace_tail;
+
+    //// --- End LibAFL code ---
 };
 
 /* The alignment given to TranslationBlock during allocation. */
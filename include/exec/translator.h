@@ -88,6 +88,17 @@ struct DisasContextBase {
     int record_start;
     int record_len;
     uint8_t record[32];
+
+    //// --- Begin LibAFL code ---
+
+    /* Hot trace state, see libafl/trace.h. */
+    bool libafl_trace;          /* translating a hot trace */
+    bool libafl_trace_jumped;   /* the current insn continued the trace */
+    int libafl_trace_blocks;    /* number of guest blocks merged so far */
+    vaddr libafl_trace_block;   /* start of the current guest block */
+    vaddr libafl_trace_dest;    /* target of the jump continuing the trace */
+
+    //// --- End LibAFL code ---
 };
 
 /**
@@ -159,6 +170,34 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+//// --- Begin LibAFL code ---
+
+/**
+ * translator_trace_can_continue
+ * @db: Disassembly context
+ * @dest: target pc of an unconditional direct jump
+ *
+ * Return true if a hot trace is being translated and the translation
+ * may go on at @dest instead of ending the TB with a goto_tb.
+ * @dest must lie after the end of the jump insn.
+ */
+bool translator_trace_can_continue(DisasContextBase *db, vaddr dest);
+
+/**
+ * translator_trace_continue
+ * @db: Disassembly context
+ * @dest: target pc of the jump
+ *
+ * Emit the edge hooks of the jump to @dest, and continue the translation
+ * there once the current insn is translated, after the post-gen block hooks
+ * of the current block and the block hooks of @dest.  The target
+ * must have written @dest to its pc before the call, and must leave
+ * db->is_jmp to DISAS_NEXT.
+ */
+void translator_trace_continue(DisasContextBase *db, vaddr dest);
+
+//// --- End LibAFL code ---
+
 /**
  * translator_io_start
  * @db: Disassembly context
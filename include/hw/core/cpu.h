@@ -316,6 +316,14 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+//// --- Begin LibAFL code ---
+    /*
+     * Bumped by every flush, full or not, even of a clean TLB: the
+     * translations cached outside of the TLB, see libafl/memory.c, are
+     * dropped when it changes.  Written by the vCPU thread only.
+     */
+    size_t libafl_flush_gen;
+//// --- End LibAFL code ---
 } CPUTLBCommon;
 
 /*
@@ -378,6 +386,32 @@ typedef struct CPUNegativeOffsetState {
 //// --- End LibAFL code ---
 } CPUNegativeOffsetState;
 
+//// --- Begin LibAFL code ---
+
+/* Depth of the LibAFL shadow call stack ring, must be a power of 2 */
+#define LIBAFL_CALL_STACK_SIZE 64
+
+/* Geometry of the LibAFL indirect branch caches, sets must be a power of 2 */
+#define LIBAFL_IBC_SETS 256
+#define LIBAFL_IBC_WAYS 2
+
+/*
+ * Inline cache entry of an indirect branch site.  Only written by the vCPU
+ * owning it; other threads invalidate all the entries of a vCPU at once by
+ * bumping its libafl_ibc_epoch.
+ */
+struct libafl_ibc_entry {
+    uint64_t site;      /* TranslationBlock of the branch */
+    uint64_t pc;        /* guest target, as seen by the branch */
+    uintptr_t epoch;    /* libafl_ibc_epoch when filled */
+    const void* host;   /* code of the target TB */
+};
+
+/* Invalidates all the indirect branch cache entries of @cpu. */
+void libafl_ibc_invalidate(CPUState *cpu);
+
+//// --- End LibAFL code ---
+
 struct KVMState;
 struct kvm_run;
 
@@ -588,6 +622,24 @@ struct CPUState {
     /* track IOMMUs whose translations we've cached in the TCG TLB */
     GArray *iommu_notifiers;
 
+//// --- Begin LibAFL code ---
+
+    /* Shadow call stack maintained inline by the LibAFL call hooks */
+    uint64_t libafl_call_ctx;
+    uint32_t libafl_call_depth;
+    uint64_t libafl_call_stack[LIBAFL_CALL_STACK_SIZE];
+
+    /* Indirect branch caches, see libafl/ibc.c */
+    uintptr_t libafl_ibc_epoch;
+    uint64_t libafl_ibc_misses;
+    uint64_t libafl_ibc_fills;
+    struct libafl_ibc_entry libafl_ibc[LIBAFL_IBC_SETS * LIBAFL_IBC_WAYS];
+
+    /* Translations of the memory API, see libafl/memory.c */
+    struct libafl_mem_cache *libafl_mem_cache;
+
+//// --- End LibAFL code ---
+
     /*
      * MUST BE LAST in order to minimize the displacement to CPUArchState.
      */
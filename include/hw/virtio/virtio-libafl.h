@@ -0,0 +1,78 @@
+/*
+ * Virtio LibAFL test case injection device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef QEMU_VIRTIO_LIBAFL_H
+#define QEMU_VIRTIO_LIBAFL_H
+
+#include "hw/virtio/virtio.h"
+#include "qom/object.h"
+
+/*
+ * The guest agent posts a single device-writable buffer of buf_size bytes on
+ * the queue. The device keeps it until the fuzzer delivers a test case, then
+ * returns it with the length of the test case as used length. The agent posts
+ * the buffer again to signal that it is done with the test case.
+ *
+ * When the buffer is made of whole host pages of anonymous guest RAM, the
+ * device backs those pages with the shared buffer of the fuzzer while it
+ * holds them: test cases are written by the fuzzer straight into guest
+ * memory, and the pages are given back to guest RAM, with their content, when
+ * the buffer is returned. Otherwise test cases are copied at delivery.
+ */
+
+/*
+ * Not allocated by the virtio specification, which has no range reserved for
+ * private devices: 63 is merely unused so far, and must be changed if it gets
+ * assigned. The guest agent matches the PCI device ID derived from it.
+ */
+#define VIRTIO_ID_LIBAFL 63
+
+#define TYPE_VIRTIO_LIBAFL "virtio-libafl-device"
+OBJECT_DECLARE_SIMPLE_TYPE(VirtIOLibAFL, VIRTIO_LIBAFL)
+
+struct virtio_libafl_config {
+    uint32_t buf_size;
+} QEMU_PACKED;
+
+struct VirtIOLibAFL {
+    VirtIODevice parent_obj;
+
+    VirtQueue *vq;
+    uint32_t buf_size;
+
+    /* Shared with the fuzzer */
+    int buf_fd;
+    uint8_t *buf;
+
+    /* Posted by the guest, waiting for a test case */
+    VirtQueueElement *elem;
+    /* Ranges of guest RAM of elem backed by buf, in the order of buf */
+    struct iovec *mapped_sg;
+    unsigned int nb_mapped_sg;
+
+    uint64_t nb_delivered;
+    uint64_t nb_completed;
+    bool delivered;
+};
+
+/*
+ * Fuzzer side, for the single instance of the device. Returns the shared
+ * buffer and its size, NULL if there is no device.
+ */
+uint8_t *libafl_qemu_virtio_buffer(uint32_t *size);
+
+/*
+ * Hands the len first bytes of the shared buffer to the guest. Returns false
+ * if the guest has no buffer posted.
+ */
+bool libafl_qemu_virtio_deliver(uint32_t len);
+
+/* True once the guest posted its buffer again after the last delivery. */
+bool libafl_qemu_virtio_done(void);
+
+#endif
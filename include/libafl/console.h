@@ -0,0 +1,62 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+/*
+ * Guest console capture.
+ *
+ * A chardev of type libafl keeps the output of the guest in memory instead of
+ * sending it to the host, e.g. for a serial port:
+ *
+ *   -chardev libafl,id=con0,size=65536 -serial chardev:con0
+ *
+ * The output is written to a ring read directly by the fuzzer, and matched
+ * against byte patterns (kernel oops, assertion messages, ...) as it is
+ * written. The first match exits with a CRASH exit reason: the vCPU which
+ * wrote the last byte of the pattern stops at the end of its current
+ * translation block, which may be a few instructions later. Patterns spanning
+ * several writes are matched as well.
+ */
+
+#define TYPE_CHARDEV_LIBAFL "chardev-libafl"
+
+struct libafl_console_trigger;
+
+struct libafl_console {
+    // Ring of size bytes, a power of two.
+    uint8_t* buf;
+    uint64_t size;
+
+    // Number of bytes written since the last reset, modulo SIZE_MAX + 1.
+    // Byte i is at buf[i & (size - 1)], for the last size bytes only. Only
+    // the guest writes to the ring, read head with an acquire load if the VM
+    // runs.
+    size_t head;
+    // End of the bytes being written, at least head. After copying bytes out
+    // of the ring while the VM runs, those before reserved - size may have
+    // been overwritten: see libafl_qemu_console_read.
+    size_t reserved;
+
+    // Index of the trigger which matched since the last reset, -1 if none.
+    int triggered;
+
+    GPtrArray* triggers;
+};
+
+// Returns the console of the libafl chardev with the given id, NULL if there
+// is none.
+struct libafl_console* libafl_qemu_console(const char* id);
+
+// Adds a pattern to match on the output. Returns the index of the trigger.
+int libafl_qemu_console_add_trigger(struct libafl_console* console,
+                                    const uint8_t* pattern, size_t len);
+void libafl_qemu_console_clear_triggers(struct libafl_console* console);
+
+// Forgets the output, the partial matches and the triggered pattern. To call
+// when restoring the VM.
+void libafl_qemu_console_reset(struct libafl_console* console);
+
+// Copies the last output, at most len bytes. Returns the number of bytes
+// copied. Does not take any lock, and can be called while the VM runs.
+size_t libafl_qemu_console_read(struct libafl_console* console, uint8_t* out,
+                                 size_t len);
@@ -24,6 +24,21 @@ int libafl_qemu_write_reg(CPUState* cpu, int reg, uint8_t* val);
 int libafl_qemu_read_reg(CPUState* cpu, int reg, uint8_t* val);
 int libafl_qemu_num_regs(CPUState* cpu);
 void libafl_flush_jit(void);
+
+// When the code cache is full, evict its least recently used region instead
+// of flushing everything. Enabled by default.
+void libafl_qemu_set_tb_eviction(bool enable);
+void libafl_qemu_tb_eviction_stats(uint64_t* evictions, uint64_t* evicted_tbs,
+                                   uint64_t* retranslations);
+
+// Per-vCPU TB jump cache: 1 << bits sets of 1, 2 or 4 ways. When adaptive,
+// the number of sets doubles whenever too many lookups miss by conflict.
+// Defaults to 4096 direct-mapped sets, adaptive.
+void libafl_qemu_set_jmp_cache(CPUState* cpu, unsigned bits, unsigned ways,
+                               bool adaptive);
+void libafl_qemu_jmp_cache_stats(CPUState* cpu, uint64_t* hits,
+                                 uint64_t* misses, uint64_t* conflicts,
+                                 unsigned* sets, unsigned* ways);
 void libafl_breakpoint_invalidate(CPUState* cpu, vaddr pc);
 
 #ifdef CONFIG_USER_ONLY
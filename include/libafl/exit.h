@@ -81,6 +81,10 @@ void libafl_exit_request_breakpoint(CPUState* cpu, vaddr pc);
 void libafl_exit_request_custom_insn(CPUState* cpu, vaddr pc,
                                      enum libafl_custom_insn_kind kind);
 void libafl_exit_request_crash(CPUState* cpu);
+// For crashes detected by a device rather than by the guest code: the vCPU
+// stops at the end of its current translation block. The exit reason records
+// the running vCPU, or the first one if the device runs from the main loop.
+void libafl_exit_request_crash_async(void);
 void libafl_exit_request_timeout(void);
 
 struct libafl_exit_reason* libafl_get_exit_reason(void);
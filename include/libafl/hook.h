@@ -4,6 +4,7 @@
 #include "tcg/tcg.h"
 
 #include "libafl/cpu.h"
+#include "libafl/profile.h"
 
 #define LIBAFL_MAX_INSNS 16
 
@@ -42,4 +42,5 @@ bool libafl_qemu_block_hook_set_jit(
 int libafl_qemu_remove_block_hook(size_t num, int invalidate);
 
 void libafl_qemu_hook_block_pre_run(vaddr pc);
+void libafl_qemu_hook_block_post_gen(vaddr pc, vaddr block_length);
 void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "tcg/tcg-op.h"
+
+enum libafl_call_kind {
+    LIBAFL_CALL_KIND_CALL = 0,
+    LIBAFL_CALL_KIND_RET = 1,
+};
+
+typedef uint64_t (*libafl_call_gen_cb)(uint64_t data, vaddr pc,
+                                       enum libafl_call_kind kind);
+typedef void (*libafl_call_exec_cb)(uint64_t data, uint64_t id,
+                                    uint64_t ret_addr);
+typedef void (*libafl_ret_exec_cb)(uint64_t data, uint64_t id);
+
+struct libafl_call_hook {
+    // functions
+    libafl_call_gen_cb gen_cb;
+
+    // data
+    uint64_t data;
+    size_t num;
+
+    // Maintain the per-vCPU shadow call stack inline, using the id returned
+    // by gen_cb for calls as the hash of the call site.
+    bool shadow_stack;
+
+    // helpers
+    TCGHelperInfo helper_info_call;
+    TCGHelperInfo helper_info_ret;
+
+    // next
+    struct libafl_call_hook* next;
+};
+
+// Called by the translators, once the call (resp. return) cannot fault
+// anymore.
+void libafl_gen_call(vaddr pc, vaddr ret_addr);
+void libafl_gen_ret(vaddr pc);
+
+size_t libafl_add_call_hook(libafl_call_gen_cb gen_cb,
+                            libafl_call_exec_cb call_exec_cb,
+                            libafl_ret_exec_cb ret_exec_cb, uint64_t data);
+
+bool libafl_qemu_call_hook_set_shadow_stack(size_t num, bool enable);
+
+int libafl_qemu_remove_call_hook(size_t num, int invalidate);
+
+// Calling context hash of cpu, to be mixed into coverage map indexes.
+uint64_t libafl_qemu_call_ctx(CPUState* cpu);
+
+// Empties the shadow call stack of cpu, e.g. before each run.
+void libafl_qemu_call_ctx_reset(CPUState* cpu);
+
+// Empties the shadow call stacks of all the vCPUs. They are not part of the
+// snapshots, which call this when restoring the VM.
+void libafl_call_ctx_reset_all(void);
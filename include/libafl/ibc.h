@@ -0,0 +1,27 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/core/cpu.h"
+#include "tcg/tcg-op.h"
+
+/*
+ * Inline indirect branch caches.
+ *
+ * Each indirect branch site checks a small per-vCPU set of (guest pc, host
+ * code) entries inline before falling back to lookup_tb_ptr. Entries are
+ * tagged by the TB of the site, so that a TB found from one site is only
+ * reused by sites translated for the same cpu state. They are invalidated
+ * whenever the jump cache is, i.e. on TB invalidation, flush, eviction and
+ * TLB flush.
+ */
+
+// Enabled by default. Flushes the JIT when the setting changes.
+void libafl_qemu_set_ibc(bool enable);
+
+// misses: slow path lookups; fills: entries written by the slow path.
+void libafl_qemu_ibc_stats(CPUState* cpu, uint64_t* misses, uint64_t* fills);
+
+// Called by the translators instead of tcg_gen_lookup_and_goto_ptr, for
+// branches to the value of pc that cannot change the TB flags (near indirect
+// jumps, calls and returns).
+void libafl_gen_lookup_and_goto_ptr(TCGv pc);
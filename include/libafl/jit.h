@@ -5,5 +5,30 @@
 size_t libafl_jit_trace_edge_hitcount(uint64_t data, uint64_t id);
 size_t libafl_jit_trace_edge_single(uint64_t data, uint64_t id);
 
+// Same as above, with the calling context of the call hooks shadow stack
+// mixed into the map index.
+size_t libafl_jit_trace_edge_hitcount_ctx(uint64_t data, uint64_t id);
+size_t libafl_jit_trace_edge_single_ctx(uint64_t data, uint64_t id);
+
 size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id);
 size_t libafl_jit_trace_block_single(uint64_t data, uint64_t id);
+
+// Touched indexes tracking.
+// The _tracked variants append the index of a map slot to a per-run list the
+// first time it is hit, and use NeverZero counters so that a touched slot
+// never goes back to 0 before the next reset. Resetting the map and checking
+// for novelty then only need to look at the touched slots.
+// The list is shared by all the vCPUs, and sized after __afl_map_size once it
+// is set.
+size_t libafl_jit_trace_edge_hitcount_tracked(uint64_t data, uint64_t id);
+size_t libafl_jit_trace_block_hitcount_tracked(uint64_t data, uint64_t id);
+
+// Indexes of the map slots hit since the last reset, in first hit order.
+// Returns NULL if they did not fit in the list (e.g. __afl_map_size was not
+// set yet): the whole map must be looked at then.
+const uint32_t* libafl_jit_touched_indexes(size_t* len);
+
+// Zeroes the touched slots of the map (the whole map if they did not fit in
+// the list) and empties the touched list. Must be used instead of clearing the
+// whole map while tracking is in use, with the vCPUs stopped.
+void libafl_jit_touched_reset(void);
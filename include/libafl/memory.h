@@ -0,0 +1,91 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "exec/vaddr.h"
+#include "exec/hwaddr.h"
+#include "exec/cpu-common.h"
+#include "exec/memattrs.h"
+#include "hw/core/cpu.h"
+
+// Number of entries of the per-CPU translation cache. Must be a power of 2.
+#define LIBAFL_MEM_CACHE_SIZE 64
+
+// One element of a scatter-gather guest memory access.
+struct libafl_mem_op {
+    vaddr addr;
+    uint8_t* buf;
+    size_t len;
+};
+
+// A cached guest virtual page -> host translation.
+struct libafl_mem_cache_entry {
+    hwaddr paging_id;
+    vaddr page; // -1 if the entry is invalid
+
+    hwaddr phys_page;
+    MemTxAttrs attrs;
+    int asidx;
+
+    // Only valid if the page can be accessed directly.
+    MemoryRegion* mr;
+    hwaddr mr_offset;
+    uint8_t* host_page;
+    bool direct_read;
+    bool direct_write;
+};
+
+struct libafl_mem_cache {
+    struct libafl_mem_cache_entry entries[LIBAFL_MEM_CACHE_SIZE];
+
+    // libafl_flush_gen of the softmmu TLB when the cache was last validated.
+    // Any TLB flush (full, page or range, for a paging change or a memory
+    // topology change) drops the cache, and so does a pending one.
+    size_t tlb_flush_gen;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Performs all the reads in ops, in order, from the virtual address space of
+// cpu. Returns the number of operations fully performed: processing stops at
+// the first operation touching an unmapped page.
+size_t libafl_qemu_read_vectored(CPUState* cpu, struct libafl_mem_op* ops,
+                                 size_t nb_ops);
+
+// Same as libafl_qemu_read_vectored, for writes.
+// Written RAM pages are marked dirty for SYX snapshots in bulk.
+size_t libafl_qemu_write_vectored(CPUState* cpu, struct libafl_mem_op* ops,
+                                  size_t nb_ops);
+
+// Drops every cached translation of cpu.
+void libafl_qemu_mem_cache_flush(CPUState* cpu);
+
+void libafl_qemu_mem_cache_stats(CPUState* cpu, uint64_t* hits,
+                                 uint64_t* misses);
+
+// Defined in system/physmem.c
+void libafl_invalidate_and_set_dirty(MemoryRegion* mr, hwaddr addr,
+                                     hwaddr length);
+
+// Makes the loads of the generated code access the guest physical range
+// [base, base + size) directly, with a range check and an add instead of the
+// softmmu TLB lookup. The range must be backed by a single RAM (or ROM)
+// region. Only valid for MMU-less (and MPU-less) CPUs, where virtual and
+// physical addresses are the same: only the loads of the current data MMU
+// index of cpu are direct-mapped, the other indexes keep the TLB. All the
+// ranges must be added for the same index. Stores keep going through the
+// TLB, so that the self-modifying code detection and the SYX dirty tracking
+// keep working. Only implemented by the x86-64 host backend. Flushes the JIT.
+//
+// Direct-mapped loads bypass the softmmu slow path: read watchpoints (gdb
+// stub, guest debug registers) do not fire on the range, nor does any read
+// instrumentation relying on TLB flags. The LibAFL read hooks, emitted inline
+// before the load, still run.
+// All the ranges must be in the same address space. A range is dropped, and
+// the JIT flushed, when a change of the memory topology moves it or makes it
+// something else than RAM. With the BQL held.
+// Returns false if the range cannot be direct-mapped.
+bool libafl_qemu_add_direct_map(CPUState* cpu, hwaddr base, uint64_t size);
+
+// Removes all the direct-mapped ranges, and flushes the JIT. With the BQL held.
+void libafl_qemu_clear_direct_map(void);
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/core/cpu.h"
+
+/*
+ * Nyx / kAFL hypercall ABI.
+ *
+ * Agents built for kAFL or Nyx issue `vmcall` with rax = 0x1f, the hypercall
+ * number in rbx and its argument in rcx. The hypercalls that only configure
+ * the run (payload buffer, cr3, panic handlers, ranges, host and agent
+ * configuration, printf, ...) are handled here without leaving the vCPU. Only
+ * the ones that need the fuzzer exit, with a custom instruction exit of kind
+ * LIBAFL_CUSTOM_INSN_NYX: the start and the end of an iteration, lock and
+ * temporary snapshots, aborts. Panics and KASAN reports exit as crashes. The
+ * fuzzer reads the hypercall which caused the exit from libafl_qemu_nyx().
+ *
+ * The payload is delivered through shared memory: the pages of the guest
+ * buffer given to GET_PAYLOAD are replaced by the pages of a memfd, whose
+ * other mapping is returned to the fuzzer by libafl_qemu_nyx_init. The fuzzer
+ * thus writes its inputs directly into guest memory, as a kAFL_payload
+ * (32-bit size followed by the data). The agent must keep the buffer mapped
+ * and locked, as it does for Nyx, and must not write to it: the pages are not
+ * tracked by the snapshots.
+ *
+ * Only available in systemmode for x86 guests with TCG, with 4KiB host pages.
+ * Elsewhere, every vmcall exits with the registers left untouched, as before.
+ */
+
+#define LIBAFL_NYX_HYPERCALL_RAX_ID 0x1f
+
+#define LIBAFL_NYX_ACQUIRE 0
+#define LIBAFL_NYX_GET_PAYLOAD 1
+#define LIBAFL_NYX_GET_PROGRAM 2
+#define LIBAFL_NYX_GET_ARGV 3
+#define LIBAFL_NYX_RELEASE 4
+#define LIBAFL_NYX_SUBMIT_CR3 5
+#define LIBAFL_NYX_SUBMIT_PANIC 6
+#define LIBAFL_NYX_SUBMIT_KASAN 7
+#define LIBAFL_NYX_PANIC 8
+#define LIBAFL_NYX_KASAN 9
+#define LIBAFL_NYX_LOCK 10
+#define LIBAFL_NYX_INFO 11
+#define LIBAFL_NYX_NEXT_PAYLOAD 12
+#define LIBAFL_NYX_PRINTF 13
+#define LIBAFL_NYX_PRINTK_ADDR 14
+#define LIBAFL_NYX_PRINTK 15
+#define LIBAFL_NYX_USER_RANGE_ADVISE 16
+#define LIBAFL_NYX_USER_SUBMIT_MODE 17
+#define LIBAFL_NYX_USER_FAST_ACQUIRE 18
+#define LIBAFL_NYX_USER_ABORT 20
+#define LIBAFL_NYX_RANGE_SUBMIT 29
+#define LIBAFL_NYX_REQ_STREAM_DATA 30
+#define LIBAFL_NYX_PANIC_EXTENDED 32
+#define LIBAFL_NYX_CREATE_TMP_SNAPSHOT 33
+#define LIBAFL_NYX_DEBUG_TMP_SNAPSHOT 34
+#define LIBAFL_NYX_GET_HOST_CONFIG 35
+#define LIBAFL_NYX_SET_AGENT_CONFIG 36
+#define LIBAFL_NYX_DUMP_FILE 37
+#define LIBAFL_NYX_REQ_STREAM_DATA_BULK 38
+#define LIBAFL_NYX_PERSIST_PAGE_PAST_SNAPSHOT 39
+
+#define LIBAFL_NYX_HOST_MAGIC 0x4878794e
+#define LIBAFL_NYX_AGENT_MAGIC 0x4178794e
+#define LIBAFL_NYX_HOST_VERSION 2
+#define LIBAFL_NYX_AGENT_VERSION 1
+
+// Number of IP ranges an agent can submit.
+#define LIBAFL_NYX_MAX_RANGES 4
+
+// Layouts shared with the agents.
+struct QEMU_PACKED libafl_nyx_host_config {
+    uint32_t host_magic;
+    uint32_t host_version;
+    uint32_t bitmap_size;
+    uint32_t ijon_bitmap_size;
+    uint32_t payload_buffer_size;
+    uint32_t worker_id;
+};
+
+struct QEMU_PACKED libafl_nyx_agent_config {
+    uint32_t agent_magic;
+    uint32_t agent_version;
+    uint8_t agent_timeout_detection;
+    uint8_t agent_tracing;
+    uint8_t agent_ijon_tracing;
+    uint8_t agent_non_reload_mode;
+    uint64_t trace_buffer_vaddr;
+    uint64_t ijon_trace_buffer_vaddr;
+    uint32_t coverage_bitmap_size;
+    uint32_t input_buffer_size;
+    uint8_t dump_payloads;
+};
+
+struct libafl_nyx_range {
+    uint64_t start;
+    uint64_t end;
+};
+
+struct libafl_nyx {
+    // Hypercall which caused the last exit, and its argument.
+    uint64_t hypercall;
+    uint64_t arg;
+
+    // Submitted by the agent.
+    uint64_t cr3;
+    uint64_t mode;
+    uint64_t payload_vaddr;
+    uint64_t panic_handler;
+    uint64_t kasan_handler;
+    struct libafl_nyx_range ranges[LIBAFL_NYX_MAX_RANGES];
+    struct libafl_nyx_agent_config agent_config;
+    bool has_agent_config;
+};
+
+// Enables the hypercalls, with a payload buffer of payload_size bytes.
+// Returns the mapping of the buffer for the fuzzer, NULL if not supported.
+uint8_t* libafl_qemu_nyx_init(uint32_t payload_size, uint32_t bitmap_size,
+                              uint32_t ijon_bitmap_size, uint32_t worker_id);
+
+// State of the agent, valid for the lifetime of the process.
+struct libafl_nyx* libafl_qemu_nyx(void);
+
+// Called by the vmcall helper, pc is the next instruction.
+void libafl_nyx_handle_hypercall(CPUState* cpu, vaddr pc);
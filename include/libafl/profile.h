@@ -0,0 +1,107 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "exec/translation-block.h"
+#include "tcg/tcg.h"
+
+/*
+ * Profiling surface.
+ *
+ * Statistics about the JIT, to find where the instrumentation overhead goes
+ * without an external profiler: execution counts and translation times per
+ * guest block, call counts per helper and per hook, lookup hit rates and code
+ * cache occupancy.
+ *
+ * The fuzzer reads the tables in place (zero copy): they are allocated once,
+ * never move, and the records are only appended. Counters are updated by
+ * the generated code without synchronization, so reading them while the
+ * vCPUs run gives approximate values.
+ *
+ * The edge TBs (see libafl_gen_edge) have no record of their own, their pc
+ * being made up: their translations are only counted in nb_translations and
+ * gen_time_ns, and the calls of their hooks in the helper records.
+ */
+
+// Maximum number of guest blocks (by start pc) and helpers profiled, the
+// next ones are counted in nb_dropped only.
+#define LIBAFL_PROFILE_MAX_TBS (1 << 16)
+#define LIBAFL_PROFILE_MAX_HELPERS 1024
+
+// Record the translations of every block: count, time and sizes.
+#define LIBAFL_PROFILE_TRANSLATION (1 << 0)
+// Count the executions of (a sample of) the blocks inline.
+#define LIBAFL_PROFILE_TB_EXECS (1 << 1)
+// Count the calls to the helpers, including the exec callbacks of the hooks.
+#define LIBAFL_PROFILE_HELPER_CALLS (1 << 2)
+
+struct libafl_profile_tb {
+    vaddr pc;
+    // Only counted when sampled.
+    uint64_t execs;
+    // Over all the translations of pc.
+    uint64_t gen_time_ns;
+    uint32_t translations;
+    // Of the last translation.
+    uint32_t guest_size;
+    uint32_t host_size;
+    uint32_t icount;
+    bool sampled;
+};
+
+struct libafl_profile_helper {
+    const char* name;
+    // Kind of hook ("block", "edge", "read", ...) and its id, as returned by
+    // its libafl_add_*_hook. NULL for the helpers of QEMU.
+    const char* hook;
+    uint64_t hook_id;
+    uint64_t calls;
+};
+
+struct libafl_profile {
+    // Code cache, refreshed by libafl_qemu_profile.
+    uint64_t code_capacity;
+    uint64_t code_size;
+    uint64_t nb_tbs;
+    uint64_t nb_flushes;
+    uint64_t nb_evictions;
+
+    // TB lookups, summed over the vCPUs and refreshed by libafl_qemu_profile.
+    uint64_t jmp_cache_hits;
+    uint64_t jmp_cache_misses;
+    uint64_t qht_misses;
+
+    // Translations.
+    uint64_t nb_translations;
+    uint64_t gen_time_ns;
+
+    struct libafl_profile_tb* tbs;
+    size_t nb_tbs_records;
+    struct libafl_profile_helper* helpers;
+    size_t nb_helpers_records;
+    uint64_t nb_dropped;
+};
+
+// flags is a set of LIBAFL_PROFILE_*. With LIBAFL_PROFILE_TB_EXECS, only the
+// blocks whose pc hashes to 0 modulo tb_sample_period are counted (1 counts
+// them all). Flushes the JIT when the generated code changes.
+void libafl_qemu_set_profiling(uint32_t flags, uint32_t tb_sample_period);
+
+// Refreshes the aggregated statistics and returns the profile, valid for the
+// lifetime of the process.
+const struct libafl_profile* libafl_qemu_profile(void);
+
+// Zeroes the counters, keeping the records.
+void libafl_qemu_profile_reset(void);
+
+// Names the helper of a hook, called when the hook is added.
+void libafl_profile_name_hook(const TCGHelperInfo* info, const char* hook,
+                              uint64_t hook_id);
+
+// Translation side, see accel/tcg/translate-all.c and translator.c.
+int64_t libafl_profile_gen_clock(void);
+void libafl_profile_gen_start(TranslationBlock* tb, vaddr pc);
+void libafl_profile_gen_end(TranslationBlock* tb, vaddr pc, int64_t start);
+
+// Called by tcg_gen_callN when helper calls are profiled.
+extern bool libafl_profile_helper_calls;
+void libafl_profile_gen_call(const TCGHelperInfo* info);
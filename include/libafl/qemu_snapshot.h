@@ -2,5 +2,41 @@
 
 #include "qemu/osdep.h"
 
+enum libafl_qemu_snapshot_backend {
+    // Internal snapshots of the qcow2 disks, with the VM state.
+    LIBAFL_QEMU_SNAPSHOT_QCOW2 = 0,
+    // VM state in anonymous memory, with zero pages reduced to their header.
+    // The disks are not part of it, put them behind the SYX COW cache.
+    LIBAFL_QEMU_SNAPSHOT_MEMORY = 1,
+};
+
+// Only for the memory backend: compressing trades save and load time for
+// memory.
+enum libafl_qemu_snapshot_compression {
+    LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE = 0,
+    LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZLIB = 1,
+    LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZSTD = 2,
+};
+
+// Selects where the next snapshots are saved and loaded from. Returns false
+// if the compression is not supported by this build.
+bool libafl_set_qemu_snapshot_backend(
+    enum libafl_qemu_snapshot_backend backend,
+    enum libafl_qemu_snapshot_compression compression);
+
 void libafl_save_qemu_snapshot(char* name, bool sync);
 void libafl_load_qemu_snapshot(char* name, bool sync);
+
+// Frees a snapshot of the memory backend.
+void libafl_delete_qemu_snapshot(char* name);
+
+// Loads a full VM snapshot from a file written by a QMP migrate to "file:"
+// with the mapped-ram capability. The disks
+// are not part of it.
+//
+// With lazy, guest RAM is mapped privately from the file instead of read: the
+// load only costs the device state, the pages are brought in by the kernel
+// when first touched, and loading the file again drops the pages written
+// since. The file must then not be modified while the VM runs. RAM backed by
+// a file, shared or using huge pages is read as usual.
+void libafl_load_qemu_snapshot_file(char* path, bool lazy, bool sync);
@@ -7,6 +7,21 @@ int libafl_qemu_remove_hw_breakpoint(vaddr addr);
 
 void libafl_qemu_init(int argc, char** argv);
 int libafl_qemu_run(void);
+#ifdef AS_LIB
+// Same as libafl_qemu_run, which runs the main loop until the next return
+// request: timers, bottom halves and I/O are handled the same way. Only the
+// return and the next resume are cheaper: the VM stays in RUN_STATE_RUNNING
+// with its vCPUs and virtual clock paused, so they skip the runstate
+// transitions, the VM state change notifiers and the drain and flush of the
+// block devices. See tests/libafl/run-fast-bench.c.
+int libafl_qemu_run_fast(void);
+#endif
+
+// When every vCPU is halted (hlt, wfi, ...), make the virtual clock jump to
+// the next QEMU_CLOCK_VIRTUAL timer instead of waiting for it in real time.
+// Has no effect with icount, which has its own sleep=off.
+void libafl_qemu_set_idle_skip(bool enable);
+void libafl_qemu_idle_skip_stats(uint64_t* nb_skips, uint64_t* skipped_ns);
 
 size_t libafl_target_page_size(void);
 int libafl_target_page_mask(void);
@@ -6,6 +6,7 @@
 #include "qemu/osdep.h"
 
 #include "qemu/iov.h"
+#include "qemu/thread.h"
 #include "block/block.h"
 
 #define INITIAL_NB_CHUNKS_PER_DEVICE (1024 * 64)
@@ -18,15 +19,20 @@ typedef struct SyxCowCacheDevice {
 typedef struct SyxCowCacheLayer SyxCowCacheLayer;
 
 typedef struct SyxCowCacheLayer {
-    GHashTable* cow_cache_devices; // H(device) -> SyxCowCacheDevice
+    GHashTable* cow_cache_devices; // BlockBackend -> SyxCowCacheDevice
     uint64_t chunk_size;
     uint64_t max_nb_chunks;
 
     QTAILQ_ENTRY(SyxCowCacheLayer) next;
 } SyxCowCacheLayer;
 
+// All the layers share the same chunk size.
 typedef struct SyxCowCache {
     QTAILQ_HEAD(, SyxCowCacheLayer) layers;
+
+    // Requests may come from several iothreads at once. Never held across a
+    // coroutine yield.
+    QemuMutex lock;
 } SyxCowCache;
 
 SyxCowCache* syx_cow_cache_new(void);
@@ -41,11 +47,27 @@ void syx_cow_cache_pop_layer(SyxCowCache* scc);
 
 void syx_cow_cache_flush_highest_layer(SyxCowCache* scc);
 
+// Appends the layers below the highest one to out. Those are not written to
+// anymore. Chunks of block devices without a name are left out.
+void syx_cow_cache_save_lower_layers(SyxCowCache* scc, GByteArray* out);
+
+// Adds layers saved by syx_cow_cache_save_lower_layers below the existing
+// ones, matching block devices by name. Returns false if buf is malformed.
+bool syx_cow_cache_load_lower_layers(SyxCowCache* scc, const uint8_t* buf,
+                                     size_t size);
+
+// Overwrites the bytes of qiov read from the image of blk with the chunks
+// written to the cache.
 void syx_cow_cache_read_entry(SyxCowCache* scc, BlockBackend* blk,
                               int64_t offset, int64_t bytes, QEMUIOVector* qiov,
-                              size_t qiov_offset, BdrvRequestFlags flags);
+                              size_t qiov_offset);
 
-bool syx_cow_cache_write_entry(SyxCowCache* scc, BlockBackend* blk,
-                               int64_t offset, int64_t bytes,
-                               QEMUIOVector* qiov, size_t qiov_offset,
-                               BdrvRequestFlags flags);
+// Writes to the highest layer instead of the image. Offsets and sizes do not
+// have to be aligned on chunks: partial chunks are completed from the lower
+// layers, or from the image through backing. qiov is ignored with
+// BDRV_REQ_ZERO_WRITE. Returns -ENOSPC if the layer is full.
+int coroutine_fn GRAPH_RDLOCK
+syx_cow_cache_write_entry(SyxCowCache* scc, BlockBackend* blk,
+                          BdrvChild* backing, int64_t offset, int64_t bytes,
+                          QEMUIOVector* qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags);
@@ -0,0 +1,56 @@
+#pragma once
+
+// Content-addressed store of the RAM pages saved by SYX snapshots.
+//
+// Snapshots do not own copies of the pages they save: they hold a reference
+// to a page of the store, keyed by its content. Identical pages (the same page
+// saved by several increments, or by snapshots of similar states) are thus
+// only kept once. Zero pages are not stored at all, they are represented by
+// the NULL page.
+//
+// Pages have the size of a target page. The store is not thread-safe, it is
+// used with the BQL held, except for syx_page_store_prepare,
+// syx_page_store_data and syx_page_store_cmp.
+
+#include "qemu/osdep.h"
+
+typedef struct SyxPage SyxPage;
+
+typedef struct SyxPageStoreStats {
+    // Distinct non-zero pages stored.
+    uint64_t nb_pages;
+    // References to stored pages, and to the zero page.
+    uint64_t nb_refs;
+    uint64_t nb_zero_refs;
+} SyxPageStoreStats;
+
+void syx_page_store_init(uint64_t page_size);
+
+// Returns a reference to a page holding a copy of data.
+SyxPage* syx_page_store_get(const void* data);
+
+// syx_page_store_get in two steps, for the hashing and the copy of many pages
+// to be spread over several threads. syx_page_store_prepare returns a page
+// with a copy of data, not in the store yet, or NULL for the zero page.
+// syx_page_store_add takes the prepared page, and returns a reference to the
+// page of the store with its content.
+SyxPage* syx_page_store_prepare(const void* data);
+SyxPage* syx_page_store_add(SyxPage* prepared);
+
+// Returns a new reference to page.
+SyxPage* syx_page_store_ref(SyxPage* page);
+
+// Drops a reference, the page is freed with its last one.
+void syx_page_store_put(SyxPage* page);
+
+// Copies the content of page to dst.
+void syx_page_store_restore(void* dst, SyxPage* page);
+
+// Returns the content of page, NULL for the zero page. The content of a page
+// never changes: it can be read from any thread while a reference is held.
+const void* syx_page_store_data(SyxPage* page);
+
+// Compares the content of page with data, memcmp-style.
+int syx_page_store_cmp(SyxPage* page, const void* data);
+
+SyxPageStoreStats syx_page_store_stats(void);
@@ -9,9 +9,12 @@
 #pragma once
 
 #include "qemu/osdep.h"
+#include "exec/cpu-common.h"
+#include "block/thread-pool.h"
 
 #include "device-save.h"
 #include "syx-cow-cache.h"
+#include "syx-page-store.h"
 
 #define SYX_SNAPSHOT_COW_CACHE_DEFAULT_CHUNK_SIZE 64
 #define SYX_SNAPSHOT_COW_CACHE_DEFAULT_MAX_BLOCKS (1024 * 1024)
@@ -55,11 +58,25 @@ typedef struct SyxSnapshotState {
     // snapshot used to restore bdrv cache if enabled.
     SyxSnapshot* active_bdrv_cache_snapshot;
 
+    // Creation and check of root snapshots are spread over these threads.
+    ThreadPool* workers;
+    guint nb_workers;
+
     // Root
 } SyxSnapshotState;
 
+typedef struct SyxSnapshotInconsistentRange {
+    RAMBlock* rb;
+    ram_addr_t offset;
+    uint64_t len;
+} SyxSnapshotInconsistentRange;
+
 typedef struct SyxSnapshotCheckResult {
+    // Pages of guest RAM differing from the root snapshot.
     uint64_t nb_inconsistencies;
+    // The same pages, as ranges of contiguous pages. NULL if there is none.
+    SyxSnapshotInconsistentRange* inconsistent_ranges;
+    uint64_t nb_inconsistent_ranges;
 } SyxSnapshotCheckResult;
 
 void syx_snapshot_init(bool cached_bdrvs);
@@ -75,8 +92,11 @@ void syx_snapshot_free(SyxSnapshot* snapshot);
 
 void syx_snapshot_root_restore(SyxSnapshot* snapshot);
 
+// Compares the whole guest RAM with the root snapshot. The VM must be stopped.
 SyxSnapshotCheckResult syx_snapshot_check(SyxSnapshot* ref_snapshot);
 
+void syx_snapshot_check_result_free(SyxSnapshotCheckResult* res);
+
 // Push the current RAM state and saves it
 void syx_snapshot_increment_push(SyxSnapshot* snapshot, DeviceSnapshotKind kind,
                                  char** devices);
@@ -87,6 +107,34 @@ void syx_snapshot_increment_pop(SyxSnapshot* snapshot);
 
 void syx_snapshot_increment_restore_last(SyxSnapshot* snapshot);
 
+//
+// Export / import API
+//
+// A snapshot, with its increments and the lower layers of its block device
+// cache, can be written to a file and loaded back into a VM with the same
+// machine configuration, without booting the guest again.
+//
+
+typedef struct SyxSnapshotExport SyxSnapshotExport;
+
+// Starts writing the snapshot to path from a background thread. The snapshot
+// is captured when the call returns: the pages of the page store are
+// immutable and referenced by the export, so the VM can keep running and the
+// snapshot can be restored, changed or freed meanwhile.
+SyxSnapshotExport* syx_snapshot_export(SyxSnapshot* snapshot,
+                                       const char* path);
+
+bool syx_snapshot_export_done(SyxSnapshotExport* ex);
+
+// Waits for the export, then frees it. Returns whether the file was written.
+// With the BQL held.
+bool syx_snapshot_export_finish(SyxSnapshotExport* ex);
+
+// Loads a snapshot exported with syx_snapshot_export, and restores the VM to
+// its root. The VM must be stopped. Returns NULL if the file cannot be loaded.
+SyxSnapshot* syx_snapshot_import(const char* path, bool track,
+                                 bool is_active_bdrv_cache);
+
 //
 // Snapshot tracker API
 //
@@ -112,6 +160,11 @@ void syx_snapshot_dirty_list_add_hostaddr(void* host_addr);
 
 void syx_snapshot_dirty_list_add_hostaddr_range(void* host_addr, uint64_t len);
 
+// Marks every page of [offset, offset + len) in rb as dirty, without looking up
+// the RAMBlock again for each page.
+void syx_snapshot_dirty_list_add_ramblock_range(RAMBlock* rb,
+                                                ram_addr_t offset, uint64_t len);
+
 /**
  * @brief Same as syx_snapshot_dirty_list_add. The difference
  * being that it has been specially compiled for full context
@@ -126,12 +179,27 @@ void syx_snapshot_dirty_list_add_hostaddr_range(void* host_addr, uint64_t len);
  */
 void syx_snapshot_dirty_list_add_tcg_target(uint64_t dummy, void* host_addr);
 
-bool syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
+/**
+ * @brief Whether the block devices are behind the COW cache. If so, every
+ * request of a BlockBackend must go through the functions below and
+ * never reach its image: writes, zero writes, discards, flushes and resizes.
+ * Called from any AioContext.
+ */
+bool syx_snapshot_cow_cache_enabled(void);
+
+/**
+ * @brief Applies the cached writes to data just read from the image of blk.
+ */
+void syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
                                        int64_t bytes, QEMUIOVector* qiov,
-                                       size_t qiov_offset,
-                                       BdrvRequestFlags flags);
+                                       size_t qiov_offset);
 
-bool syx_snapshot_cow_cache_write_entry(BlockBackend* blk, int64_t offset,
-                                        int64_t bytes, QEMUIOVector* qiov,
-                                        size_t qiov_offset,
-                                        BdrvRequestFlags flags);
+/**
+ * @brief Writes to the cache instead of backing, the root child of blk.
+ * Handles BDRV_REQ_ZERO_WRITE and unaligned requests.
+ *
+ * @return 0 on success, a negative errno otherwise.
+ */
+int coroutine_fn GRAPH_RDLOCK syx_snapshot_cow_cache_write_entry(
+    BlockBackend* blk, BdrvChild* backing, int64_t offset, int64_t bytes,
+    QEMUIOVector* qiov, size_t qiov_offset, BdrvRequestFlags flags);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/core/cpu.h"
+
+/*
+ * Persistent list of translated blocks, used to prewarm the code cache of a
+ * fresh process.
+ *
+ * This is not a cache of host code: generated code embeds absolute host
+ * addresses (helpers, hook data, coverage maps) that differ from one process
+ * to the other, so nothing generated is persisted. The export stores the CPU
+ * state needed to translate each block again together with a hash of its
+ * guest code, and the import translates again, before the first run, the
+ * blocks whose guest code is unchanged. It saves the translations the first
+ * executions would do, not the cost of translating.
+ *
+ * The translators may read CPU state that is not part of the TB flags, so a
+ * block is only translated again when its flags, cs_base and cflags are those
+ * of the CPU at the time of the import. The others are skipped and counted:
+ * export and import at the same point of the guest, e.g. at the snapshot the
+ * fuzzer restores.
+ */
+
+#define LIBAFL_TB_CACHE_MAGIC "LAFLTBC"
+#define LIBAFL_TB_CACHE_VERSION 1
+
+struct libafl_tb_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t target_long_bits;
+    char target_name[16];
+    uint64_t nb_records;
+};
+
+struct libafl_tb_cache_record {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t hash; // crc32c of the guest code of the block
+};
+
+// Returns the number of exported blocks, or -1 on error.
+int64_t libafl_tb_cache_export(CPUState* cpu, const char* path);
+
+struct libafl_tb_cache_import_stats {
+    // Blocks translated.
+    uint64_t nb_translated;
+    // Blocks skipped because they were translated for another CPU state.
+    uint64_t nb_other_state;
+    // Blocks skipped because their guest code changed or is not mapped.
+    uint64_t nb_changed;
+    // Blocks skipped because the code buffer reached LIBAFL_TB_CACHE_MAX_FILL.
+    uint64_t nb_no_room;
+};
+
+// Stop importing once the code buffer is this full (in percent), so that the
+// warm up never triggers a tb_flush by itself.
+#define LIBAFL_TB_CACHE_MAX_FILL 75
+
+// Returns the number of translated blocks, or -1 on error. stats, if not NULL,
+// tells why the other blocks were skipped. Must be called while cpu is not
+// running.
+int64_t libafl_tb_cache_import(CPUState* cpu, const char* path,
+                               struct libafl_tb_cache_import_stats* stats);
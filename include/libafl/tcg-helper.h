@@ -2,3 +2,5 @@ DEF_HELPER_FLAGS_2(libafl_qemu_handle_breakpoint, TCG_CALL_NO_RWG, void, env,
                    i64)
 DEF_HELPER_FLAGS_3(libafl_qemu_handle_custom_insn, TCG_CALL_NO_RWG, void, env,
                    i64, i32)
+// Reads and writes the guest registers.
+DEF_HELPER_FLAGS_2(libafl_qemu_handle_nyx_hypercall, 0, void, env, i64)
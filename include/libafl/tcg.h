@@ -11,3 +11,7 @@ void libafl_gen_loop_exit_check(void);
 
 // exit via longjmp if libafl_loop_exit is set
 void libafl_loop_exit_if_requested(void);
+
+// Slow path of the indirect branch caches, see libafl/ibc.c
+const void* libafl_ibc_lookup_tb_ptr(CPUArchState* env, uint64_t site,
+                                     uint64_t pc, uint32_t set);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "exec/translation-block.h"
+
+/*
+ * Hot traces.
+ *
+ * When enabled, every TB counts its executions inline. Once a TB reached the
+ * threshold, its start pc is marked hot and the TB is invalidated. The next
+ * translation of a hot pc is a trace: the translator keeps going through the
+ * direct jumps it meets instead of ending the TB there, so that the optimizer
+ * and the register allocator see the whole chain at once. Cold code is
+ * translated as before.
+ *
+ * A trace only follows forward jumps staying on the page of its first
+ * instruction, so the TB still covers a single contiguous guest range and the
+ * self-modifying code tracking is unchanged. Block and edge hooks of the
+ * merged blocks are emitted inline, with the same ids as in separate TBs, and
+ * the post-gen block hooks see each block with its own length.
+ *
+ * Tiered translation.
+ *
+ * With a tier threshold, cold TBs are translated at tier-0: the TCG optimizer
+ * is skipped (on hosts that do not depend on it to lower TST conditions) to
+ * cut the translation cost of code that runs a few times only. Once hot,
+ * they are retranslated at tier-1 with the full pipeline, the same way as the
+ * traces above and sharing their counters. Liveness analysis and register
+ * allocation are kept in both tiers: the backend relies on them.
+ */
+
+// Maximum number of guest blocks merged in a single trace.
+#define LIBAFL_TRACE_MAX_BLOCKS 16
+
+// Size of the (hashed) table of execution counters.
+#define LIBAFL_TRACE_COUNTERS_SIZE (1 << 16)
+
+// 0 disables hot traces (the default). Flushes the JIT when the threshold
+// changes. Only RISC-V (jal) and AArch64 (b) merge their jumps for now: on
+// the other targets, the threshold has no effect and cold TBs do not count
+// their executions.
+void libafl_qemu_set_trace_threshold(uint32_t threshold);
+
+// 0 disables tiered translation (the default): every TB is then optimized.
+// When both this and the trace threshold are set, the lowest one promotes the
+// hot pcs. Flushes the JIT when the threshold changes.
+void libafl_qemu_set_tier_threshold(uint32_t threshold);
+
+// Number of TBs translated at tier-0 and retranslated at tier-1.
+void libafl_qemu_tier_stats(uint64_t* nb_tier0, uint64_t* nb_tier1);
+
+// Forgets all the hot pcs, and flushes the JIT.
+void libafl_qemu_trace_reset(void);
+
+void libafl_qemu_trace_stats(uint64_t* nb_hot, uint64_t* nb_traces,
+                             uint64_t* nb_merged_blocks);
+
+// Called by the translator loop when the translation of pc starts.
+// Returns true if pc is hot and should be translated as a trace, otherwise
+// emits the execution counter of the TB if traces or tiers are enabled, and
+// selects tier-0 for it.
+bool libafl_trace_gen_start(TranslationBlock* tb, vaddr pc);
+
+// Called once a trace of nb_blocks guest blocks has been translated.
+void libafl_trace_count(int nb_blocks);
@@ -68,4 +68,40 @@ bool delete_snapshot(const char *name,
  */
 void load_snapshot_resume(RunState state);
 
+//// --- Begin LibAFL code ---
+
+/**
+ * libafl_load_snapshot_file: Load a full VM snapshot from a mapped-ram file.
+ * @filename: file written by a migration to "file:" with mapped-ram enabled
+ * @lazy: map guest RAM from the file instead of reading it
+ * @errp: pointer to error object
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool libafl_load_snapshot_file(const char *filename, bool lazy, Error **errp);
+
+/**
+ * libafl_save_snapshot_buffer: Save the VM state to memory.
+ * @size: set to the size of the migration stream
+ * @errp: pointer to error object
+ * The disks are not part of the snapshot.
+ * On success, return the migration stream, to be freed with g_free().  The
+ * allocation may be larger than @size.
+ * On failure, store an error through @errp and return %NULL.
+ */
+uint8_t *libafl_save_snapshot_buffer(size_t *size, Error **errp);
+
+/**
+ * libafl_load_snapshot_buffer: Load a VM state saved to memory.
+ * @buf: migration stream written by libafl_save_snapshot_buffer
+ * @size: size of the stream
+ * @errp: pointer to error object
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool libafl_load_snapshot_buffer(const uint8_t *buf, size_t size,
+                                 Error **errp);
+
+//// --- End LibAFL code ---
+
 #endif
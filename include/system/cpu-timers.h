@@ -43,4 +43,13 @@ int64_t cpus_get_virtual_clock(void);
 void cpus_set_virtual_clock(int64_t new_time);
 int64_t cpus_get_elapsed_ticks(void);
 
+//// --- Begin LibAFL code ---
+
+/* Idle-skip clock, see libafl_qemu_set_idle_skip */
+void libafl_set_idle_skip(bool enable);
+void libafl_idle_skip_stats(uint64_t *nb_skips, uint64_t *skipped_ns);
+void libafl_idle_skip_warp(void);
+
+//// --- End LibAFL code ---
+
 #endif /* SYSTEM_CPU_TIMERS_H */
@@ -36,6 +36,11 @@ struct RAMBlock {
     char idstr[256];
 //// --- Begin LibAFL code ---
     guint idstr_hash;
+    /*
+     * The pages are a private mapping of a snapshot file: discarding them
+     * must map anonymous memory again. Protected by the BQL.
+     */
+    bool libafl_file_mapped;
 //// --- End LibAFL code ---
     /* RCU-enabled, writes protected by the ramlist lock */
     QLIST_ENTRY(RAMBlock) next;
@@ -108,6 +113,13 @@ struct RamBlockAttributes {
 
 /* @offset: the offset within the RAMBlock */
 int ram_block_discard_range(RAMBlock *rb, uint64_t offset, size_t length);
+//// --- Begin LibAFL code ---
+/*
+ * Applies the madvise() state of guest RAM (merging, dump, THP, fork) to
+ * [@host, @host + @length) of @rb, after it was mapped again.
+ */
+void libafl_ram_block_setup_madvise(RAMBlock *rb, void *host, size_t length);
+//// --- End LibAFL code ---
 /* @offset: the offset within the RAMBlock */
 int ram_block_discard_guest_memfd_range(RAMBlock *rb, uint64_t offset,
                                         size_t length);
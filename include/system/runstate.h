@@ -159,6 +159,17 @@ bool qemu_system_dump_in_progress(void);
 //// --- Begin LibAFL code ---
 #ifdef AS_LIB
 void qemu_system_return_request(void);
+
+// When enabled, returns to the harness only pause the vCPUs and the virtual
+// clock, and libafl_vm_resume_fast() restarts them.
+void libafl_set_fast_return(bool enabled);
+bool libafl_vm_fast_paused(void);
+// Returns false if the VM was not fast paused, vm_start() is needed then.
+bool libafl_vm_resume_fast(void);
+// Turns a fast pause into a regular stop in RUN_STATE_RET, as if the last run
+// had not been fast. For code which stops and restarts the VM itself, e.g.
+// snapshots: it would otherwise see RUN_STATE_RUNNING and start the guest.
+void libafl_vm_leave_fast_pause(void);
 #endif
 //// --- End LibAFL code ---
 
@@ -75,6 +75,19 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+//// --- Begin LibAFL code ---
+
+/**
+ * tcg_gen_goto_ptr() - jump to the host code of a TB
+ * @ptr: host code pointer, e.g. found by a previous lookup_tb_ptr
+ *
+ * The caller is responsible for @ptr being the code of a valid TB for
+ * the current cpu state, or the epilogue.
+ */
+void tcg_gen_goto_ptr(TCGv_ptr ptr);
+
+//// --- End LibAFL code ---
+
 void tcg_gen_plugin_cb(unsigned from);
 void tcg_gen_plugin_mem_cb(TCGv_i64 addr, unsigned meminfo);
 
@@ -442,6 +442,16 @@ struct TCGContext {
      */
     TCGOp *emit_before_op;
 
+    //// --- Begin LibAFL code ---
+
+    /*
+     * Tier-0 translation of a cold TB: skip the optimizer, see
+     * libafl/trace.c.  Reset by tcg_func_start.
+     */
+    bool libafl_tier0;
+
+    //// --- End LibAFL code ---
+
     /* Tells which temporary holds a given register.
        It does not take into account fixed registers */
     TCGTemp *reg_to_temp[TCG_TARGET_NB_REGS];
@@ -655,6 +665,42 @@ void tcg_region_reset_all(void);
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Region-granular eviction of the code cache, see tb_evict_region.
+ * tcg_region_touch marks the region holding @tc_ptr as recently used (meant
+ * for the slow path of TB lookups), tcg_region_evict_victim returns the least
+ * recently used region that is not assigned to any context (or -1), and
+ * tcg_region_reuse assigns that region, emptied of its TBs, to @s.
+ */
+void tcg_region_touch(const void *tc_ptr);
+ssize_t tcg_region_evict_victim(void);
+void tcg_region_foreach_tb(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_reuse(TCGContext *s, size_t idx);
+
+/*
+ * Guest RAM ranges that softmmu loads access directly, without the TLB
+ * lookup, at host address guest address + @addend.  Only for flat address
+ * spaces, see libafl_qemu_add_direct_map, and only for the loads of
+ * libafl_direct_map_mmu_idx, the MMU-less index the ranges were added for.
+ * Entries are published before libafl_direct_map_nb is incremented, and
+ * only removed or moved in an exclusive context, together with a tb_flush.
+ */
+#define LIBAFL_DIRECT_MAP_MAX 4
+
+typedef struct LibaflDirectMap {
+    uint64_t guest_base;
+    uint64_t size;
+    uintptr_t addend;
+} LibaflDirectMap;
+
+extern LibaflDirectMap libafl_direct_map[LIBAFL_DIRECT_MAP_MAX];
+extern int libafl_direct_map_nb;
+extern int libafl_direct_map_mmu_idx;
+
+//// --- End LibAFL code ---
+
 /**
  * tcg_tb_insert:
  * @tb: translation block to insert
@@ -0,0 +1,260 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qapi/error.h"
+#include "chardev/char.h"
+#include "qom/object.h"
+
+#include "libafl/console.h"
+#include "libafl/exit.h"
+
+typedef struct LibAFLChardev {
+    Chardev parent;
+    struct libafl_console console;
+} LibAFLChardev;
+
+DECLARE_INSTANCE_CHECKER(LibAFLChardev, LIBAFL_CHARDEV, TYPE_CHARDEV_LIBAFL)
+
+// Knuth-Morris-Pratt matcher, fed one byte at a time.
+struct libafl_console_trigger {
+    uint8_t* pattern;
+    size_t len;
+    // Length of the longest proper prefix of pattern[0..i] which is also a
+    // suffix of it.
+    size_t* fail;
+    // Length of the prefix of pattern matched by the last bytes.
+    size_t matched;
+};
+
+static struct libafl_console_trigger* trigger_new(const uint8_t* pattern,
+                                                  size_t len)
+{
+    struct libafl_console_trigger* trigger =
+        g_new0(struct libafl_console_trigger, 1);
+    size_t k = 0;
+
+    trigger->pattern = g_memdup2(pattern, len);
+    trigger->len = len;
+    trigger->fail = g_new0(size_t, len);
+
+    for (size_t i = 1; i < len; i++) {
+        while (k && pattern[i] != pattern[k]) {
+            k = trigger->fail[k - 1];
+        }
+        if (pattern[i] == pattern[k]) {
+            k++;
+        }
+        trigger->fail[i] = k;
+    }
+
+    return trigger;
+}
+
+static void trigger_free(gpointer data)
+{
+    struct libafl_console_trigger* trigger = data;
+
+    g_free(trigger->pattern);
+    g_free(trigger->fail);
+    g_free(trigger);
+}
+
+static bool trigger_feed(struct libafl_console_trigger* trigger, uint8_t c)
+{
+    while (trigger->matched && c != trigger->pattern[trigger->matched]) {
+        trigger->matched = trigger->fail[trigger->matched - 1];
+    }
+
+    if (c == trigger->pattern[trigger->matched]) {
+        trigger->matched++;
+    }
+
+    if (trigger->matched == trigger->len) {
+        trigger->matched = trigger->fail[trigger->len - 1];
+        return true;
+    }
+
+    return false;
+}
+
+static int libafl_chr_write(Chardev* chr, const uint8_t* buf, int len)
+{
+    struct libafl_console* console = &LIBAFL_CHARDEV(chr)->console;
+    size_t head = console->head;
+
+    if (!buf || len < 0) {
+        return -1;
+    }
+
+    // Pairs with the smp_rmb in libafl_qemu_console_read
+    qatomic_set(&console->reserved, head + len);
+    smp_wmb();
+
+    for (int i = 0; i < len; i++) {
+        qatomic_set(&console->buf[head++ & (console->size - 1)], buf[i]);
+
+        if (console->triggered >= 0) {
+            continue;
+        }
+
+        for (guint t = 0; t < console->triggers->len; t++) {
+            if (trigger_feed(g_ptr_array_index(console->triggers, t),
+                             buf[i])) {
+                console->triggered = t;
+                libafl_exit_request_crash_async();
+                break;
+            }
+        }
+    }
+
+    qatomic_store_release(&console->head, head);
+
+    return len;
+}
+
+static void libafl_chr_open(Chardev* chr, ChardevBackend* backend,
+                            bool* be_opened, Error** errp)
+{
+    ChardevLibafl* opts = backend->u.libafl.data;
+    struct libafl_console* console = &LIBAFL_CHARDEV(chr)->console;
+
+    console->size = opts->has_size ? opts->size : 65536;
+
+    if (!console->size || (console->size & (console->size - 1))) {
+        error_setg(errp, "size of libafl chardev must be power of two");
+        return;
+    }
+
+    console->buf = g_malloc0(console->size);
+    console->head = 0;
+    console->reserved = 0;
+    console->triggered = -1;
+    console->triggers = g_ptr_array_new_with_free_func(trigger_free);
+}
+
+static void libafl_chr_parse(QemuOpts* opts, ChardevBackend* backend,
+                             Error** errp)
+{
+    ChardevLibafl* libafl;
+    uint64_t val;
+
+    backend->type = CHARDEV_BACKEND_KIND_LIBAFL;
+    libafl = backend->u.libafl.data = g_new0(ChardevLibafl, 1);
+    qemu_chr_parse_common(opts, qapi_ChardevLibafl_base(libafl));
+
+    val = qemu_opt_get_size(opts, "size", 0);
+    if (val != 0) {
+        libafl->has_size = true;
+        libafl->size = val;
+    }
+}
+
+static void libafl_chr_finalize(Object* obj)
+{
+    struct libafl_console* console = &LIBAFL_CHARDEV(obj)->console;
+
+    g_free(console->buf);
+    if (console->triggers) {
+        g_ptr_array_free(console->triggers, true);
+    }
+}
+
+static void libafl_chr_class_init(ObjectClass* oc, const void* data)
+{
+    ChardevClass* cc = CHARDEV_CLASS(oc);
+
+    cc->parse = libafl_chr_parse;
+    cc->open = libafl_chr_open;
+    cc->chr_write = libafl_chr_write;
+}
+
+static const TypeInfo libafl_chr_type_info = {
+    .name = TYPE_CHARDEV_LIBAFL,
+    .parent = TYPE_CHARDEV,
+    .class_init = libafl_chr_class_init,
+    .instance_size = sizeof(LibAFLChardev),
+    .instance_finalize = libafl_chr_finalize,
+};
+
+static void libafl_chr_register_types(void)
+{
+    type_register_static(&libafl_chr_type_info);
+}
+
+type_init(libafl_chr_register_types);
+
+static Chardev* console_chr(struct libafl_console* console)
+{
+    return &container_of(console, LibAFLChardev, console)->parent;
+}
+
+struct libafl_console* libafl_qemu_console(const char* id)
+{
+    Chardev* chr = qemu_chr_find(id);
+
+    if (!chr || !object_dynamic_cast(OBJECT(chr), TYPE_CHARDEV_LIBAFL)) {
+        return NULL;
+    }
+
+    return &LIBAFL_CHARDEV(chr)->console;
+}
+
+int libafl_qemu_console_add_trigger(struct libafl_console* console,
+                                    const uint8_t* pattern, size_t len)
+{
+    assert(len > 0);
+
+    QEMU_LOCK_GUARD(&console_chr(console)->chr_write_lock);
+    g_ptr_array_add(console->triggers, trigger_new(pattern, len));
+
+    return console->triggers->len - 1;
+}
+
+void libafl_qemu_console_clear_triggers(struct libafl_console* console)
+{
+    QEMU_LOCK_GUARD(&console_chr(console)->chr_write_lock);
+    g_ptr_array_set_size(console->triggers, 0);
+    console->triggered = -1;
+}
+
+void libafl_qemu_console_reset(struct libafl_console* console)
+{
+    QEMU_LOCK_GUARD(&console_chr(console)->chr_write_lock);
+
+    for (guint t = 0; t < console->triggers->len; t++) {
+        struct libafl_console_trigger* trigger =
+            g_ptr_array_index(console->triggers, t);
+        trigger->matched = 0;
+    }
+
+    console->triggered = -1;
+    qatomic_set(&console->reserved, 0);
+    qatomic_store_release(&console->head, 0);
+}
+
+size_t libafl_qemu_console_read(struct libafl_console* console, uint8_t* out,
+                                size_t len)
+{
+    size_t head = qatomic_load_acquire(&console->head);
+    size_t n = MIN(len, MIN(head, console->size));
+    size_t start = head - n;
+    size_t overwritten;
+
+    for (size_t i = 0; i < n; i++) {
+        out[i] = qatomic_read(&console->buf[(start + i) & (console->size - 1)]);
+    }
+
+    // Drop the oldest bytes if the guest wrote over them meanwhile. Pairs
+    // with the smp_wmb in libafl_chr_write.
+    smp_rmb();
+    overwritten = qatomic_read(&console->reserved) - console->size - start;
+    if ((ssize_t)overwritten > 0) {
+        overwritten = MIN(overwritten, n);
+        memmove(out, out + overwritten, n - overwritten);
+        n -= overwritten;
+    }
+
+    return n;
+}
@@ -12,6 +12,7 @@
 #include "exec/gdbstub.h"
 #include "exec/target_page.h"
 #include "exec/tb-flush.h"
+#include "accel/tcg/tb-context.h"
 
 #include "libafl/cpu.h"
 #include "libafl/exit.h"
@@ -174,6 +175,61 @@ void libafl_flush_jit(void)
     CPU_FOREACH(cpu) { queue_tb_flush(cpu); }
 }
 
+void libafl_qemu_set_tb_eviction(bool enable)
+{
+    tb_evict_enabled = enable;
+}
+
+void libafl_qemu_tb_eviction_stats(uint64_t* evictions, uint64_t* evicted_tbs,
+                                   uint64_t* retranslations)
+{
+    *evictions = qatomic_read(&tb_ctx.tb_evict_count);
+    *evicted_tbs = qatomic_read(&tb_ctx.tb_evicted_count);
+    *retranslations = qatomic_read(&tb_ctx.tb_retranslate_count);
+}
+
+struct libafl_jmp_cache_geometry {
+    unsigned bits;
+    unsigned ways;
+    bool adaptive;
+};
+
+static void libafl_set_jmp_cache_work(CPUState* cpu, run_on_cpu_data data)
+{
+    struct libafl_jmp_cache_geometry* geometry = data.host_ptr;
+
+    tcg_resize_jmp_cache(cpu, geometry->bits, geometry->ways);
+    tcg_jmp_cache_set_adaptive(cpu, geometry->adaptive);
+}
+
+void libafl_qemu_set_jmp_cache(CPUState* cpu, unsigned bits, unsigned ways,
+                               bool adaptive)
+{
+    struct libafl_jmp_cache_geometry geometry = {
+        .bits = bits,
+        .ways = ways,
+        .adaptive = adaptive,
+    };
+
+    // The jump cache can only be resized by its own vCPU.
+    run_on_cpu(cpu, libafl_set_jmp_cache_work, RUN_ON_CPU_HOST_PTR(&geometry));
+}
+
+void libafl_qemu_jmp_cache_stats(CPUState* cpu, uint64_t* hits,
+                                 uint64_t* misses, uint64_t* conflicts,
+                                 unsigned* sets, unsigned* ways)
+{
+    TCGJumpCacheStats stats;
+
+    tcg_jmp_cache_stats(cpu, &stats);
+
+    *hits = stats.hits;
+    *misses = stats.misses;
+    *conflicts = stats.conflicts;
+    *sets = stats.sets;
+    *ways = stats.ways;
+}
+
 #ifdef CONFIG_USER_ONLY
 __attribute__((weak)) int libafl_qemu_main(void)
 {
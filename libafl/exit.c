@@ -117,6 +117,7 @@ void libafl_exit_request_custom_insn(CPUState* cpu, vaddr pc,
                                      enum libafl_custom_insn_kind kind)
 {
     last_exit_reason.kind = CUSTOM_INSN;
+    last_exit_reason.data.custom_insn.kind = kind;
 
     prepare_qemu_exit(cpu, pc);
 }
@@ -141,6 +142,25 @@ void libafl_exit_request_crash(CPUState* cpu)
 }
 
 #ifndef CONFIG_USER_ONLY
+void libafl_exit_request_crash_async(void)
+{
+    // NULL when the device is flushed from the main loop
+    CPUState* cpu = current_cpu ? current_cpu : first_cpu;
+
+    expected_exit = true;
+    last_exit_reason.kind = CRASH;
+    last_exit_reason.cpu = cpu;
+    last_exit_reason.next_pc = 0;
+
+#ifdef AS_LIB
+    qemu_system_return_request();
+#endif
+
+    if (cpu) {
+        cpu_exit(cpu);
+    }
+}
+
 void libafl_exit_request_timeout(void)
 {
     expected_exit = true;
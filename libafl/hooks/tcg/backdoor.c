@@ -33,6 +33,7 @@ size_t libafl_add_backdoor_hook(libafl_backdoor_exec_cb exec_cb, uint64_t data)
     memcpy(&hook->helper_info, &libafl_exec_backdoor_hook_info,
            sizeof(TCGHelperInfo));
     hook->helper_info.func = exec_cb;
+    libafl_profile_name_hook(&hook->helper_info, "backdoor", hook->num);
 
     return hook->num;
 }
@@ -37,6 +37,7 @@ size_t libafl_add_block_hook(libafl_block_pre_gen_cb pre_gen_cb,
         memcpy(&hook->helper_info, &libafl_exec_block_hook_info,
                sizeof(TCGHelperInfo));
         hook->helper_info.func = exec_cb;
+        libafl_profile_name_hook(&hook->helper_info, "block", hook->num);
     }
 
     return hook->num;
@@ -56,18 +57,26 @@ bool libafl_qemu_block_hook_set_jit(size_t num, libafl_block_jit_cb jit_cb)
     return false;
 }
 
-void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc)
+void libafl_qemu_hook_block_post_gen(vaddr pc, vaddr block_length)
 {
     struct libafl_block_hook* hook = libafl_block_hooks;
     while (hook) {
         if (hook->post_gen_cb) {
-            hook->post_gen_cb(hook->data, pc, tb->size);
+            hook->post_gen_cb(hook->data, pc, block_length);
             libafl_loop_exit_if_requested();
         }
         hook = hook->next;
     }
 }
 
+void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc)
+{
+    // The other blocks of a trace were reported during its translation.
+    vaddr start = tb->libafl_trace_tail ? tb->libafl_trace_tail : pc;
+
+    libafl_qemu_hook_block_post_gen(start, pc + tb->size - start);
+}
+
 void libafl_qemu_hook_block_pre_run(vaddr pc)
 {
     struct libafl_block_hook* hook = libafl_block_hooks;
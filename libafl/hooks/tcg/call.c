@@ -0,0 +1,209 @@
+#include "qemu/osdep.h"
+
+#include "libafl/tcg.h"
+#include "libafl/cpu.h"
+#include "libafl/hook.h"
+#include "libafl/hooks/tcg/call.h"
+
+static struct libafl_call_hook* libafl_call_hooks;
+static size_t libafl_call_hooks_num = 0;
+
+static TCGHelperInfo libafl_exec_call_hook_info = {
+    .func = NULL,
+    .name = "libafl_exec_call_hook",
+    .flags = dh_callflag(void),
+    .typemask = dh_typemask(void, 0) | dh_typemask(i64, 1) |
+                dh_typemask(i64, 2) | dh_typemask(i64, 3)};
+static TCGHelperInfo libafl_exec_ret_hook_info = {
+    .func = NULL,
+    .name = "libafl_exec_ret_hook",
+    .flags = dh_callflag(void),
+    .typemask =
+        dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(i64, 2)};
+
+#define LIBAFL_CALL_CTX_OFF                                                    \
+    (offsetof(CPUState, libafl_call_ctx) - sizeof(CPUState))
+#define LIBAFL_CALL_DEPTH_OFF                                                  \
+    (offsetof(CPUState, libafl_call_depth) - sizeof(CPUState))
+#define LIBAFL_CALL_STACK_OFF                                                  \
+    (offsetof(CPUState, libafl_call_stack) - sizeof(CPUState))
+
+GEN_REMOVE_HOOK(call)
+
+size_t libafl_add_call_hook(libafl_call_gen_cb gen_cb,
+                            libafl_call_exec_cb call_exec_cb,
+                            libafl_ret_exec_cb ret_exec_cb, uint64_t data)
+{
+    libafl_flush_jit();
+
+    struct libafl_call_hook* hook = calloc(sizeof(struct libafl_call_hook), 1);
+    hook->gen_cb = gen_cb;
+    hook->data = data;
+    hook->num = libafl_call_hooks_num++;
+    hook->next = libafl_call_hooks;
+    libafl_call_hooks = hook;
+
+    if (call_exec_cb) {
+        memcpy(&hook->helper_info_call, &libafl_exec_call_hook_info,
+               sizeof(TCGHelperInfo));
+        hook->helper_info_call.func = call_exec_cb;
+        libafl_profile_name_hook(&hook->helper_info_call, "call", hook->num);
+    }
+    if (ret_exec_cb) {
+        memcpy(&hook->helper_info_ret, &libafl_exec_ret_hook_info,
+               sizeof(TCGHelperInfo));
+        hook->helper_info_ret.func = ret_exec_cb;
+        libafl_profile_name_hook(&hook->helper_info_ret, "ret", hook->num);
+    }
+
+    return hook->num;
+}
+
+bool libafl_qemu_call_hook_set_shadow_stack(size_t num, bool enable)
+{
+    struct libafl_call_hook* hk = libafl_call_hooks;
+    while (hk) {
+        if (hk->num == num) {
+            if (hk->shadow_stack != enable) {
+                libafl_flush_jit();
+                hk->shadow_stack = enable;
+            }
+            return true;
+        }
+
+        hk = hk->next;
+    }
+    return false;
+}
+
+uint64_t libafl_qemu_call_ctx(CPUState* cpu)
+{
+    return cpu->libafl_call_ctx;
+}
+
+void libafl_qemu_call_ctx_reset(CPUState* cpu)
+{
+    cpu->libafl_call_ctx = 0;
+    cpu->libafl_call_depth = 0;
+}
+
+void libafl_call_ctx_reset_all(void)
+{
+    CPUState* cpu;
+
+    CPU_FOREACH(cpu) {
+        libafl_qemu_call_ctx_reset(cpu);
+    }
+}
+
+// Address of the shadow stack slot of depth, relative to tcg_env.
+static TCGv_ptr libafl_gen_call_stack_slot(TCGv_i32 depth)
+{
+    TCGv_i32 idx = tcg_temp_new_i32();
+    TCGv_ptr slot = tcg_temp_new_ptr();
+
+    tcg_gen_andi_i32(idx, depth, LIBAFL_CALL_STACK_SIZE - 1);
+    tcg_gen_shli_i32(idx, idx, 3);
+    tcg_gen_ext_i32_ptr(slot, idx);
+    tcg_gen_add_ptr(slot, slot, tcg_env);
+
+    return slot;
+}
+
+// stack[depth++ % SIZE] = ctx; ctx ^= id
+static void libafl_gen_shadow_call(uint64_t id)
+{
+    TCGv_i32 depth = tcg_temp_new_i32();
+    TCGv_i64 ctx = tcg_temp_new_i64();
+
+    tcg_gen_ld_i32(depth, tcg_env, LIBAFL_CALL_DEPTH_OFF);
+    tcg_gen_ld_i64(ctx, tcg_env, LIBAFL_CALL_CTX_OFF);
+
+    tcg_gen_st_i64(ctx, libafl_gen_call_stack_slot(depth),
+                   LIBAFL_CALL_STACK_OFF);
+
+    tcg_gen_addi_i32(depth, depth, 1);
+    tcg_gen_st_i32(depth, tcg_env, LIBAFL_CALL_DEPTH_OFF);
+
+    tcg_gen_xori_i64(ctx, ctx, (int64_t)id);
+    tcg_gen_st_i64(ctx, tcg_env, LIBAFL_CALL_CTX_OFF);
+}
+
+// if (depth) ctx = stack[--depth % SIZE]
+// Branchless: the translators may still use temporaries after the hook.
+static void libafl_gen_shadow_ret(void)
+{
+    TCGv_i32 depth = tcg_temp_new_i32();
+    TCGv_i32 nz = tcg_temp_new_i32();
+    TCGv_i64 nz64 = tcg_temp_new_i64();
+    TCGv_i64 ctx = tcg_temp_new_i64();
+    TCGv_i64 saved = tcg_temp_new_i64();
+
+    tcg_gen_ld_i32(depth, tcg_env, LIBAFL_CALL_DEPTH_OFF);
+    tcg_gen_setcondi_i32(TCG_COND_NE, nz, depth, 0);
+    tcg_gen_sub_i32(depth, depth, nz);
+    tcg_gen_st_i32(depth, tcg_env, LIBAFL_CALL_DEPTH_OFF);
+
+    tcg_gen_ld_i64(saved, libafl_gen_call_stack_slot(depth),
+                   LIBAFL_CALL_STACK_OFF);
+    tcg_gen_ld_i64(ctx, tcg_env, LIBAFL_CALL_CTX_OFF);
+
+    tcg_gen_extu_i32_i64(nz64, nz);
+    tcg_gen_movcond_i64(TCG_COND_NE, ctx, nz64, tcg_constant_i64(0), saved,
+                        ctx);
+    tcg_gen_st_i64(ctx, tcg_env, LIBAFL_CALL_CTX_OFF);
+}
+
+void libafl_gen_call(vaddr pc, vaddr ret_addr)
+{
+    struct libafl_call_hook* hook = libafl_call_hooks;
+    while (hook) {
+        uint64_t cur_id = 0;
+        if (hook->gen_cb) {
+            cur_id = hook->gen_cb(hook->data, pc, LIBAFL_CALL_KIND_CALL);
+            libafl_loop_exit_if_requested();
+        }
+
+        // Filtered calls are still pushed, to keep the shadow stack
+        // balanced, but do not change the context.
+        if (hook->shadow_stack) {
+            libafl_gen_shadow_call(cur_id != (uint64_t)-1 ? cur_id : 0);
+        }
+
+        if (cur_id != (uint64_t)-1 && hook->helper_info_call.func) {
+            TCGv_i64 tmp0 = tcg_constant_i64(hook->data);
+            TCGv_i64 tmp1 = tcg_constant_i64(cur_id);
+            TCGv_i64 tmp2 = tcg_constant_i64(ret_addr);
+            TCGTemp* tmp3[3] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1),
+                                tcgv_i64_temp(tmp2)};
+            tcg_gen_callN(hook->helper_info_call.func, &hook->helper_info_call,
+                          NULL, tmp3);
+        }
+        hook = hook->next;
+    }
+}
+
+void libafl_gen_ret(vaddr pc)
+{
+    struct libafl_call_hook* hook = libafl_call_hooks;
+    while (hook) {
+        uint64_t cur_id = 0;
+        if (hook->gen_cb) {
+            cur_id = hook->gen_cb(hook->data, pc, LIBAFL_CALL_KIND_RET);
+            libafl_loop_exit_if_requested();
+        }
+
+        if (hook->shadow_stack) {
+            libafl_gen_shadow_ret();
+        }
+
+        if (cur_id != (uint64_t)-1 && hook->helper_info_ret.func) {
+            TCGv_i64 tmp0 = tcg_constant_i64(hook->data);
+            TCGv_i64 tmp1 = tcg_constant_i64(cur_id);
+            TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
+            tcg_gen_callN(hook->helper_info_ret.func, &hook->helper_info_ret,
+                          NULL, tmp2);
+        }
+        hook = hook->next;
+    }
+}
@@ -55,21 +55,25 @@ size_t libafl_add_cmp_hook(libafl_cmp_gen_cb gen_cb,
         memcpy(&hook->helper_info1, &libafl_exec_cmp_hook1_info,
                sizeof(TCGHelperInfo));
         hook->helper_info1.func = exec1_cb;
+        libafl_profile_name_hook(&hook->helper_info1, "cmp", hook->num);
     }
     if (exec2_cb) {
         memcpy(&hook->helper_info2, &libafl_exec_cmp_hook2_info,
                sizeof(TCGHelperInfo));
         hook->helper_info2.func = exec2_cb;
+        libafl_profile_name_hook(&hook->helper_info2, "cmp", hook->num);
     }
     if (exec4_cb) {
         memcpy(&hook->helper_info4, &libafl_exec_cmp_hook4_info,
                sizeof(TCGHelperInfo));
         hook->helper_info4.func = exec4_cb;
+        libafl_profile_name_hook(&hook->helper_info4, "cmp", hook->num);
     }
     if (exec8_cb) {
         memcpy(&hook->helper_info8, &libafl_exec_cmp_hook8_info,
                sizeof(TCGHelperInfo));
         hook->helper_info8.func = exec8_cb;
+        libafl_profile_name_hook(&hook->helper_info8, "cmp", hook->num);
     }
 
     return hook->num;
@@ -36,6 +36,7 @@ size_t libafl_add_edge_hook(libafl_edge_gen_cb gen_cb,
         memcpy(&hook->helper_info, &libafl_exec_edge_hook_info,
                sizeof(TCGHelperInfo));
         hook->helper_info.func = exec_cb;
+        libafl_profile_name_hook(&hook->helper_info, "edge", hook->num);
     }
 
     return hook->num;
@@ -4,6 +4,7 @@
 
 #include "libafl/tcg.h"
 #include "libafl/cpu.h"
+#include "libafl/profile.h"
 #include "libafl/hooks/tcg/instruction.h"
 
 static TCGHelperInfo libafl_instruction_info = {
@@ -39,6 +40,7 @@ size_t libafl_qemu_add_instruction_hooks(vaddr pc,
     hk->helper_info.func = exec_cb;
     // TODO check for overflow
     hk->num = libafl_qemu_hooks_num++;
+    libafl_profile_name_hook(&hk->helper_info, "instruction", hk->num);
     hk->next = libafl_qemu_instruction_hooks[idx];
     libafl_qemu_instruction_hooks[idx] = hk;
     return hk->num;
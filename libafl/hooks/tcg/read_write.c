@@ -104,6 +104,7 @@ libafl_add_rw_hook(struct libafl_rw_hook** hooks, size_t* hooks_num,
 {
     libafl_flush_jit();
 
+    const char* kind = hooks == &libafl_read_hooks ? "read" : "write";
     struct libafl_rw_hook* hook = calloc(sizeof(struct libafl_rw_hook), 1);
     hook->gen_cb = gen_cb;
     hook->data = data;
@@ -114,22 +115,27 @@ libafl_add_rw_hook(struct libafl_rw_hook** hooks, size_t* hooks_num,
     if (exec1_cb) {
         memcpy(&hook->helper_info1, exec1_info, sizeof(TCGHelperInfo));
         hook->helper_info1.func = exec1_cb;
+        libafl_profile_name_hook(&hook->helper_info1, kind, hook->num);
     }
     if (exec2_cb) {
         memcpy(&hook->helper_info2, exec2_info, sizeof(TCGHelperInfo));
         hook->helper_info2.func = exec2_cb;
+        libafl_profile_name_hook(&hook->helper_info2, kind, hook->num);
     }
     if (exec4_cb) {
         memcpy(&hook->helper_info4, exec4_info, sizeof(TCGHelperInfo));
         hook->helper_info4.func = exec4_cb;
+        libafl_profile_name_hook(&hook->helper_info4, kind, hook->num);
     }
     if (exec8_cb) {
         memcpy(&hook->helper_info8, exec8_info, sizeof(TCGHelperInfo));
         hook->helper_info8.func = exec8_cb;
+        libafl_profile_name_hook(&hook->helper_info8, kind, hook->num);
     }
     if (execN_cb) {
         memcpy(&hook->helper_infoN, execN_info, sizeof(TCGHelperInfo));
         hook->helper_infoN.func = execN_cb;
+        libafl_profile_name_hook(&hook->helper_infoN, kind, hook->num);
     }
 
     return hook->num;
@@ -0,0 +1,117 @@
+#include "qemu/osdep.h"
+#include "exec/translation-block.h"
+
+#include "libafl/cpu.h"
+#include "libafl/hook.h"
+#include "libafl/tcg.h"
+#include "libafl/ibc.h"
+
+static bool libafl_ibc_enabled = true;
+
+static TCGHelperInfo libafl_ibc_lookup_info = {
+    .func = libafl_ibc_lookup_tb_ptr,
+    .name = "libafl_ibc_lookup_tb_ptr",
+    .flags = TCG_CALL_NO_WG,
+    .typemask = dh_typemask(cptr, 0) | dh_typemask(env, 1) |
+                dh_typemask(i64, 2) | dh_typemask(i64, 3) |
+                dh_typemask(i32, 4)};
+
+#define LIBAFL_IBC_EPOCH_OFF                                                   \
+    (offsetof(CPUState, libafl_ibc_epoch) - sizeof(CPUState))
+#define LIBAFL_IBC_OFF (offsetof(CPUState, libafl_ibc) - sizeof(CPUState))
+
+void libafl_qemu_set_ibc(bool enable)
+{
+    if (enable != libafl_ibc_enabled) {
+        libafl_flush_jit();
+        libafl_ibc_enabled = enable;
+    }
+}
+
+void libafl_qemu_ibc_stats(CPUState* cpu, uint64_t* misses, uint64_t* fills)
+{
+    *misses = cpu->libafl_ibc_misses;
+    *fills = cpu->libafl_ibc_fills;
+}
+
+static void libafl_ibc_clear(CPUState* cpu, run_on_cpu_data data)
+{
+    memset(cpu->libafl_ibc, 0, sizeof(cpu->libafl_ibc));
+}
+
+void libafl_ibc_invalidate(CPUState* cpu)
+{
+    // The epoch is pointer-sized, for atomic accesses on every host, and
+    // wraps on 32-bit ones: entries filled one period earlier would be valid
+    // again. Clear them, on the vCPU that owns them; no site is at 0.
+    if (unlikely(qatomic_fetch_inc(&cpu->libafl_ibc_epoch) == UINTPTR_MAX)) {
+        if (cpu == current_cpu) {
+            libafl_ibc_clear(cpu, RUN_ON_CPU_NULL);
+        } else {
+            async_run_on_cpu(cpu, libafl_ibc_clear, RUN_ON_CPU_NULL);
+        }
+    }
+}
+
+static uint32_t libafl_ibc_set(uint64_t site, vaddr pc)
+{
+    // TBs are aligned on cache lines
+    return ((site >> 6) ^ pc ^ (pc >> 12)) & (LIBAFL_IBC_SETS - 1);
+}
+
+void libafl_gen_lookup_and_goto_ptr(TCGv pc)
+{
+    TranslationBlock* tb = tcg_ctx->gen_tb;
+
+    // The fast path does not account for instructions.
+    if (!libafl_ibc_enabled ||
+        (tb_cflags(tb) & (CF_NO_GOTO_PTR | CF_USE_ICOUNT))) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    uint64_t site = (uint64_t)(uintptr_t)tb;
+    uint32_t set = libafl_ibc_set(site, libafl_gen_cur_pc);
+    tcg_target_long ways =
+        LIBAFL_IBC_OFF +
+        set * LIBAFL_IBC_WAYS * sizeof(struct libafl_ibc_entry);
+
+    TCGv_i64 key = tcg_temp_new_i64();
+    TCGv_i64 epoch = tcg_temp_new_i64();
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_ptr host = tcg_temp_new_ptr();
+
+    tcg_gen_extu_tl_i64(key, pc);
+    tcg_gen_ld_ptr(host, tcg_env, LIBAFL_IBC_EPOCH_OFF);
+    tcg_gen_extu_ptr_i64(epoch, host);
+
+    for (int way = 0; way < LIBAFL_IBC_WAYS; way++) {
+        tcg_target_long entry = ways + way * sizeof(struct libafl_ibc_entry);
+        TCGLabel* next = gen_new_label();
+
+        tcg_gen_ld_i64(val, tcg_env,
+                       entry + offsetof(struct libafl_ibc_entry, pc));
+        tcg_gen_brcond_i64(TCG_COND_NE, val, key, next);
+        tcg_gen_ld_i64(val, tcg_env,
+                       entry + offsetof(struct libafl_ibc_entry, site));
+        tcg_gen_brcondi_i64(TCG_COND_NE, val, site, next);
+        tcg_gen_ld_ptr(host, tcg_env,
+                       entry + offsetof(struct libafl_ibc_entry, epoch));
+        tcg_gen_extu_ptr_i64(val, host);
+        tcg_gen_brcond_i64(TCG_COND_NE, val, epoch, next);
+
+        tcg_gen_ld_ptr(host, tcg_env,
+                       entry + offsetof(struct libafl_ibc_entry, host));
+        tcg_gen_goto_ptr(host);
+
+        gen_set_label(next);
+    }
+
+    TCGTemp* args[4] = {tcgv_ptr_temp(tcg_env),
+                        tcgv_i64_temp(tcg_constant_i64(site)),
+                        tcgv_i64_temp(key),
+                        tcgv_i32_temp(tcg_constant_i32(set))};
+    tcg_gen_callN(libafl_ibc_lookup_info.func, &libafl_ibc_lookup_info,
+                  tcgv_ptr_temp(host), args);
+    tcg_gen_goto_ptr(host);
+}
@@ -1,6 +1,8 @@
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
 #include "tcg/tcg-op-common.h"
 #include "tcg/tcg.h"
+#include "hw/core/cpu.h"
 
 #include "libafl/jit.h"
 
@@ -46,8 +48,177 @@ size_t libafl_jit_trace_edge_single(uint64_t data, uint64_t id)
     return 2; // # instructions
 }
 
+// map_ptr + ((id ^ ctx) & (__afl_map_size - 1))
+static TCGv_ptr libafl_jit_gen_ctx_loc(TCGv_ptr map_ptr, uint64_t id)
+{
+    TCGv_i64 loc = tcg_temp_new_i64();
+    TCGv_ptr loc2 = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i64(loc, tcg_env,
+                   offsetof(CPUState, libafl_call_ctx) - sizeof(CPUState));
+    tcg_gen_xori_i64(loc, loc, (int64_t)id);
+    tcg_gen_andi_i64(loc, loc, (int64_t)(__afl_map_size - 1));
+    tcg_gen_trunc_i64_ptr(loc2, loc);
+    tcg_gen_add_ptr(loc2, map_ptr, loc2);
+
+    return loc2;
+}
+
+size_t libafl_jit_trace_edge_hitcount_ctx(uint64_t data, uint64_t id)
+{
+    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
+    TCGv_i32 counter = tcg_temp_new_i32();
+
+    // Compute location => 5 insn
+    TCGv_ptr loc = libafl_jit_gen_ctx_loc(map_ptr, id);
+
+    // Update map => 3 insn
+    tcg_gen_ld8u_i32(counter, loc, 0);
+    tcg_gen_addi_i32(counter, counter, 1);
+    tcg_gen_st8_i32(counter, loc, 0);
+    return 8; // # instructions
+}
+
+size_t libafl_jit_trace_edge_single_ctx(uint64_t data, uint64_t id)
+{
+    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
+    TCGv_i32 counter = tcg_temp_new_i32();
+
+    // Compute location => 5 insn
+    TCGv_ptr loc = libafl_jit_gen_ctx_loc(map_ptr, id);
+
+    // Update map => 2 insn
+    tcg_gen_movi_i32(counter, 1);
+    tcg_gen_st8_i32(counter, loc, 0);
+    return 7; // # instructions
+}
+
 uint64_t __prev_loc = 0;
 
+// Sized after __afl_map_size once it is set, shared by all the vCPUs.
+struct libafl_jit_touched_list {
+    uint64_t cap;
+    uint32_t idx[];
+};
+
+static struct libafl_jit_touched_list* libafl_jit_touched = NULL;
+// May go past cap, when the map grew or when vCPUs raced on the same slot.
+static uint64_t libafl_jit_touched_len = 0;
+
+static TCGHelperInfo libafl_jit_touched_add_info = {
+    .func = NULL,
+    .name = "libafl_jit_touched_add",
+    .flags = dh_callflag(void),
+    .typemask = dh_typemask(void, 0) | dh_typemask(i32, 1)};
+
+static struct libafl_jit_touched_list* libafl_jit_touched_list(void)
+{
+    struct libafl_jit_touched_list* list = qatomic_read(&libafl_jit_touched);
+    struct libafl_jit_touched_list* old;
+    uint64_t cap = qatomic_read(&__afl_map_size);
+
+    if (likely(list) || cap == 0) {
+        return list;
+    }
+
+    list = g_malloc(sizeof(*list) + cap * sizeof(list->idx[0]));
+    list->cap = cap;
+
+    old = qatomic_cmpxchg(&libafl_jit_touched, NULL, list);
+    if (old) {
+        g_free(list);
+        return old;
+    }
+    return list;
+}
+
+// Called from the generated code on the first hit of a slot since the reset.
+static void libafl_jit_touched_add(uint32_t idx)
+{
+    struct libafl_jit_touched_list* list = libafl_jit_touched_list();
+    uint64_t i = qatomic_fetch_inc(&libafl_jit_touched_len);
+
+    if (list && i < list->cap) {
+        qatomic_set(&list->idx[i], idx);
+    }
+}
+
+static bool libafl_jit_touched_overflow(void)
+{
+    return libafl_jit_touched_len &&
+           (!libafl_jit_touched ||
+            libafl_jit_touched_len > libafl_jit_touched->cap);
+}
+
+const uint32_t* libafl_jit_touched_indexes(size_t* len)
+{
+    if (libafl_jit_touched_overflow()) {
+        *len = 0;
+        return NULL;
+    }
+
+    *len = libafl_jit_touched_len;
+    return libafl_jit_touched ? libafl_jit_touched->idx : NULL;
+}
+
+void libafl_jit_touched_reset(void)
+{
+    if (libafl_jit_touched_overflow()) {
+        memset(__afl_area_ptr_local, 0, __afl_map_size);
+    } else {
+        for (uint64_t i = 0; i < libafl_jit_touched_len; i++) {
+            __afl_area_ptr_local[libafl_jit_touched->idx[i]] = 0;
+        }
+    }
+
+    // The vCPUs are stopped: the list can follow the size of the map.
+    if (libafl_jit_touched && libafl_jit_touched->cap < __afl_map_size) {
+        g_free(libafl_jit_touched);
+        libafl_jit_touched = NULL;
+    }
+
+    libafl_jit_touched_len = 0;
+}
+
+// Increments the counter at loc, and records idx if it was 0.
+static void libafl_jit_gen_touched_hit(TCGv_ptr loc, TCGv_i32 idx)
+{
+    TCGv_i32 counter = tcg_temp_new_i32();
+    TCGv_i32 first = tcg_temp_new_i32();
+    TCGv_i32 carry = tcg_temp_new_i32();
+    TCGLabel* skip = gen_new_label();
+
+    // Update map, NeverZero => 6 insn
+    tcg_gen_ld8u_i32(counter, loc, 0);
+    tcg_gen_mov_i32(first, counter);
+    tcg_gen_addi_i32(counter, counter, 1);
+    tcg_gen_shri_i32(carry, counter, 8);
+    tcg_gen_add_i32(counter, counter, carry);
+    tcg_gen_st8_i32(counter, loc, 0);
+
+    // Record the first hit => 2 insn. Rare enough for a helper, which keeps
+    // the list consistent between vCPUs.
+    tcg_gen_brcondi_i32(TCG_COND_NE, first, 0, skip);
+
+    if (!libafl_jit_touched_add_info.func) {
+        libafl_jit_touched_add_info.func = libafl_jit_touched_add;
+    }
+
+    TCGTemp* args[1] = {tcgv_i32_temp(idx)};
+    tcg_gen_callN(libafl_jit_touched_add_info.func,
+                  &libafl_jit_touched_add_info, NULL, args);
+
+    gen_set_label(skip);
+}
+
+size_t libafl_jit_trace_edge_hitcount_tracked(uint64_t data, uint64_t id)
+{
+    TCGv_ptr loc = tcg_constant_ptr(__afl_area_ptr_local + id);
+
+    libafl_jit_gen_touched_hit(loc, tcg_constant_i32((int32_t)id));
+    return 8; // # instructions
+}
+
 size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id)
 {
     TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
@@ -104,3 +275,31 @@ size_t libafl_jit_trace_block_single(uint64_t data, uint64_t id)
     tcg_gen_st_i64(id_r, prev_loc_ptr, 0);
     return 10; // # instructions
 }
+
+size_t libafl_jit_trace_block_hitcount_tracked(uint64_t data, uint64_t id)
+{
+    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
+    TCGv_ptr prev_loc_ptr = tcg_constant_ptr(&__prev_loc);
+
+    TCGv_i32 idx = tcg_temp_new_i32();
+    TCGv_i64 id_r = tcg_temp_new_i64();
+    TCGv_i64 prev_loc = tcg_temp_new_i64();
+    TCGv_ptr prev_loc2 = tcg_temp_new_ptr();
+
+    // Compute location => 6 insn
+    tcg_gen_ld_i64(prev_loc, prev_loc_ptr, 0);
+    tcg_gen_xori_i64(prev_loc, prev_loc, (int64_t)id);
+    tcg_gen_andi_i64(prev_loc, prev_loc, (int64_t)(__afl_map_size - 1));
+    tcg_gen_extrl_i64_i32(idx, prev_loc);
+    tcg_gen_trunc_i64_ptr(prev_loc2, prev_loc);
+    tcg_gen_add_ptr(prev_loc2, map_ptr, prev_loc2);
+
+    // Update map and touched list => 8 insn
+    libafl_jit_gen_touched_hit(prev_loc2, idx);
+
+    // Update prev_loc => 3 insn
+    tcg_gen_movi_i64(id_r, (int64_t)id);
+    tcg_gen_shri_i64(id_r, id_r, 1);
+    tcg_gen_st_i64(id_r, prev_loc_ptr, 0);
+    return 17; // # instructions
+}
@@ -0,0 +1,356 @@
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/lockable.h"
+#include "cpu.h"
+#include "system/memory.h"
+#include "system/hw_accel.h"
+#include "system/cpus.h"
+#include "system/tcg.h"
+#include "exec/target_page.h"
+#include "exec/tb-flush.h"
+#include "accel/tcg/cpu-mmu-index.h"
+#include "qemu/target-info.h"
+#include "tcg/tcg.h"
+
+#include "libafl/cpu.h"
+#include "libafl/memory.h"
+#include "libafl/syx-snapshot/syx-snapshot.h"
+
+static void libafl_mem_cache_reset(struct libafl_mem_cache* cache)
+{
+    for (size_t i = 0; i < LIBAFL_MEM_CACHE_SIZE; i++) {
+        cache->entries[i].page = (vaddr)-1;
+    }
+}
+
+static struct libafl_mem_cache* libafl_mem_cache_get(CPUState* cpu)
+{
+    struct libafl_mem_cache* cache =
+        qatomic_load_acquire(&cpu->libafl_mem_cache);
+
+    if (unlikely(!cache)) {
+        struct libafl_mem_cache* new_cache = g_new0(struct libafl_mem_cache, 1);
+
+        libafl_mem_cache_reset(new_cache);
+        cache = qatomic_cmpxchg(&cpu->libafl_mem_cache, NULL, new_cache);
+        if (cache) {
+            g_free(new_cache);
+        } else {
+            cache = new_cache;
+        }
+    }
+
+    return cache;
+}
+
+static size_t libafl_mem_tlb_flush_gen(CPUState* cpu)
+{
+#ifdef CONFIG_TCG
+    // A flush queued to the vCPU, e.g. by a change of the memory topology
+    // while it is stopped, has not bumped the generation yet.
+    if (tcg_enabled() && cpu_work_list_empty(cpu)) {
+        return qatomic_read(&cpu->neg.tlb.c.libafl_flush_gen);
+    }
+#endif
+    // No way to know if the guest mappings changed, never trust the cache
+    // across calls.
+    return SIZE_MAX;
+}
+
+void libafl_qemu_mem_cache_flush(CPUState* cpu)
+{
+    libafl_mem_cache_reset(libafl_mem_cache_get(cpu));
+}
+
+void libafl_qemu_mem_cache_stats(CPUState* cpu, uint64_t* hits,
+                                 uint64_t* misses)
+{
+    struct libafl_mem_cache* cache = libafl_mem_cache_get(cpu);
+
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
+
+static struct libafl_mem_cache* libafl_mem_cache_validate(CPUState* cpu)
+{
+    struct libafl_mem_cache* cache = libafl_mem_cache_get(cpu);
+    size_t gen = libafl_mem_tlb_flush_gen(cpu);
+
+    if (gen == SIZE_MAX || gen != cache->tlb_flush_gen) {
+        libafl_mem_cache_reset(cache);
+        cache->tlb_flush_gen = gen;
+    }
+
+    return cache;
+}
+
+// Must be called with the RCU read lock held.
+static struct libafl_mem_cache_entry*
+libafl_mem_cache_lookup(CPUState* cpu, struct libafl_mem_cache* cache,
+                        hwaddr paging_id, vaddr page)
+{
+    struct libafl_mem_cache_entry* entry =
+        &cache->entries[(page >> TARGET_PAGE_BITS) &
+                        (LIBAFL_MEM_CACHE_SIZE - 1)];
+
+    if (likely(entry->page == page && entry->paging_id == paging_id)) {
+        cache->hits++;
+        return entry;
+    }
+
+    cache->misses++;
+
+    MemTxAttrs attrs;
+    hwaddr phys_page = cpu_get_phys_page_attrs_debug(cpu, page, &attrs);
+    if (phys_page == -1) {
+        return NULL;
+    }
+
+    entry->paging_id = paging_id;
+    entry->page = page;
+    entry->phys_page = phys_page;
+    entry->attrs = attrs;
+    entry->asidx = cpu_asidx_from_attrs(cpu, attrs);
+
+    hwaddr xlat;
+    hwaddr plen = TARGET_PAGE_SIZE;
+    MemoryRegion* mr =
+        address_space_translate(cpu->cpu_ases[entry->asidx].as, phys_page,
+                                &xlat, &plen, false, attrs);
+
+    entry->mr = mr;
+    entry->mr_offset = xlat;
+    entry->host_page = NULL;
+    entry->direct_read = false;
+    entry->direct_write = false;
+
+    // Only cache host pointers of pages entirely backed by the same region.
+    if (plen == TARGET_PAGE_SIZE &&
+        memory_access_is_direct(mr, false, attrs)) {
+        entry->host_page = qemu_map_ram_ptr(mr->ram_block, xlat);
+        entry->direct_read = true;
+        entry->direct_write = memory_access_is_direct(mr, true, attrs);
+    }
+
+    return entry;
+}
+
+static size_t libafl_qemu_rw_vectored(CPUState* cpu, struct libafl_mem_op* ops,
+                                      size_t nb_ops, bool is_write)
+{
+    size_t done = 0;
+
+    cpu_synchronize_state(cpu);
+
+    struct libafl_mem_cache* cache = libafl_mem_cache_validate(cpu);
+    hwaddr paging_id = libafl_qemu_current_paging_id(cpu);
+
+    RCU_READ_LOCK_GUARD();
+
+    for (; done < nb_ops; done++) {
+        vaddr addr = ops[done].addr;
+        uint8_t* buf = ops[done].buf;
+        size_t len = ops[done].len;
+
+        while (len > 0) {
+            vaddr page = addr & TARGET_PAGE_MASK;
+            vaddr in_page = addr & ~TARGET_PAGE_MASK;
+            size_t l = MIN(len, TARGET_PAGE_SIZE - in_page);
+
+            struct libafl_mem_cache_entry* entry =
+                libafl_mem_cache_lookup(cpu, cache, paging_id, page);
+            if (!entry) {
+                return done;
+            }
+
+            if (is_write && entry->direct_write) {
+                memcpy(entry->host_page + in_page, buf, l);
+                syx_snapshot_dirty_list_add_ramblock_range(
+                    entry->mr->ram_block, entry->mr_offset + in_page, l);
+                libafl_invalidate_and_set_dirty(entry->mr,
+                                                entry->mr_offset + in_page, l);
+            } else if (!is_write && entry->direct_read) {
+                memcpy(buf, entry->host_page + in_page, l);
+            } else {
+                // MMIO, ROM or page spanning several regions: slow path.
+                MemTxResult res = address_space_rw(
+                    cpu->cpu_ases[entry->asidx].as, entry->phys_page + in_page,
+                    entry->attrs, buf, l, is_write);
+                if (res != MEMTX_OK) {
+                    return done;
+                }
+            }
+
+            len -= l;
+            buf += l;
+            addr += l;
+        }
+    }
+
+    return done;
+}
+
+size_t libafl_qemu_read_vectored(CPUState* cpu, struct libafl_mem_op* ops,
+                                 size_t nb_ops)
+{
+    return libafl_qemu_rw_vectored(cpu, ops, nb_ops, false);
+}
+
+size_t libafl_qemu_write_vectored(CPUState* cpu, struct libafl_mem_op* ops,
+                                  size_t nb_ops)
+{
+    return libafl_qemu_rw_vectored(cpu, ops, nb_ops, true);
+}
+
+// Serializes the updates of libafl_direct_map. The generated code and the
+// backend only read it.
+static QemuMutex libafl_direct_map_lock;
+// Address space of the entries, watched by libafl_direct_map_listener. Set
+// with the BQL held, like the listener is (un)registered.
+static AddressSpace* libafl_direct_map_as;
+
+static void __attribute__((constructor)) libafl_direct_map_init(void)
+{
+    qemu_mutex_init(&libafl_direct_map_lock);
+}
+
+// Host address of [base, base + size), or NULL if it is not backed by a single
+// directly accessible region. With the RCU read lock held.
+static uint8_t* libafl_direct_map_host(AddressSpace* as, hwaddr base,
+                                       uint64_t size)
+{
+    hwaddr xlat;
+    hwaddr plen = size;
+    MemoryRegion* mr = address_space_translate(as, base, &xlat, &plen, false,
+                                               MEMTXATTRS_UNSPECIFIED);
+
+    if (plen != size ||
+        !memory_access_is_direct(mr, false, MEMTXATTRS_UNSPECIFIED)) {
+        return NULL;
+    }
+
+    return qemu_map_ram_ptr(mr->ram_block, xlat);
+}
+
+static bool libafl_direct_map_valid(const LibaflDirectMap* m)
+{
+    uint8_t* host = libafl_direct_map_host(libafl_direct_map_as, m->guest_base,
+                                           m->size);
+
+    return host && (uintptr_t)host - m->guest_base == m->addend;
+}
+
+// Drops the entries whose range moved or is not RAM anymore. The translations
+// read the entries without a lock, so they are only rewritten while no vCPU
+// runs, and the TBs embedding the old ones are flushed at the same time.
+static void libafl_direct_map_prune(CPUState* cpu, run_on_cpu_data data)
+{
+    QEMU_LOCK_GUARD(&libafl_direct_map_lock);
+    RCU_READ_LOCK_GUARD();
+
+    int nb = libafl_direct_map_nb;
+    int kept = 0;
+
+    for (int i = 0; i < nb; i++) {
+        if (libafl_direct_map_valid(&libafl_direct_map[i])) {
+            libafl_direct_map[kept++] = libafl_direct_map[i];
+        }
+    }
+
+    if (kept != nb) {
+        qatomic_set(&libafl_direct_map_nb, kept);
+        tb_flush__exclusive_or_serial();
+    }
+}
+
+// Called with the BQL held, once the new memory topology is in place. The
+// stale TBs may still run until the vCPUs leave their RCU read-side critical
+// section, like with the softmmu TLB, so the old RAM is still there.
+static void libafl_direct_map_commit(MemoryListener* listener)
+{
+    QEMU_LOCK_GUARD(&libafl_direct_map_lock);
+    RCU_READ_LOCK_GUARD();
+
+    for (int i = 0; i < libafl_direct_map_nb; i++) {
+        if (!libafl_direct_map_valid(&libafl_direct_map[i])) {
+            async_safe_run_on_cpu(first_cpu, libafl_direct_map_prune,
+                                  RUN_ON_CPU_NULL);
+            return;
+        }
+    }
+}
+
+static MemoryListener libafl_direct_map_listener = {
+    .name = "libafl-direct-map",
+    .commit = libafl_direct_map_commit,
+};
+
+bool libafl_qemu_add_direct_map(CPUState* cpu, hwaddr base, uint64_t size)
+{
+    AddressSpace* as = cpu->cpu_ases[0].as;
+    int mmu_idx = cpu_mmu_index(cpu, false);
+    uint8_t* host;
+
+    if (size < 16 || base + size < base) {
+        return false;
+    }
+
+    // The generated code computes offsets in the guest address width.
+    if (target_long_bits() == 32 && base + size > (1ULL << 32)) {
+        return false;
+    }
+
+    if (libafl_direct_map_as && libafl_direct_map_as != as) {
+        return false;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        host = libafl_direct_map_host(as, base, size);
+    }
+
+    if (!host) {
+        return false;
+    }
+
+    // Not under libafl_direct_map_lock, the listener is called back with it.
+    if (!libafl_direct_map_as) {
+        libafl_direct_map_as = as;
+        memory_listener_register(&libafl_direct_map_listener, as);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&libafl_direct_map_lock) {
+        int nb = libafl_direct_map_nb;
+
+        if (nb == LIBAFL_DIRECT_MAP_MAX ||
+            (nb && mmu_idx != libafl_direct_map_mmu_idx)) {
+            return false;
+        }
+
+        // Published with the entry, by the release store below.
+        qatomic_set(&libafl_direct_map_mmu_idx, mmu_idx);
+
+        libafl_direct_map[nb].guest_base = base;
+        libafl_direct_map[nb].size = size;
+        libafl_direct_map[nb].addend = (uintptr_t)host - base;
+        qatomic_store_release(&libafl_direct_map_nb, nb + 1);
+    }
+
+    libafl_flush_jit();
+    return true;
+}
+
+void libafl_qemu_clear_direct_map(void)
+{
+    if (libafl_direct_map_as) {
+        memory_listener_unregister(&libafl_direct_map_listener);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&libafl_direct_map_lock) {
+        libafl_direct_map_as = NULL;
+
+        if (libafl_direct_map_nb) {
+            qatomic_set(&libafl_direct_map_nb, 0);
+            libafl_flush_jit();
+        }
+    }
+}
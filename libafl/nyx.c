@@ -0,0 +1,340 @@
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/memfd.h"
+#include "qemu/qemu-print.h"
+#include "qemu/rcu.h"
+#include "qapi/error.h"
+#include "cpu.h"
+#include "system/memory.h"
+#include "exec/target_page.h"
+
+#include "libafl/exit.h"
+#include "libafl/nyx.h"
+
+#if !defined(CONFIG_USER_ONLY) && defined(TARGET_I386)
+
+// Longest string printed by the agent.
+#define LIBAFL_NYX_STRING_MAX 0x1000
+
+static struct libafl_nyx libafl_nyx;
+
+static bool libafl_nyx_enabled = false;
+static struct libafl_nyx_host_config libafl_nyx_host_config;
+
+static int libafl_nyx_payload_fd = -1;
+static uint8_t* libafl_nyx_payload;
+static uint32_t libafl_nyx_payload_size;
+// Host pages of guest RAM currently backed by the payload memfd.
+static void** libafl_nyx_payload_pages;
+static size_t libafl_nyx_payload_nb_pages;
+
+uint8_t* libafl_qemu_nyx_init(uint32_t payload_size, uint32_t bitmap_size,
+                              uint32_t ijon_bitmap_size, uint32_t worker_id)
+{
+    Error* err = NULL;
+
+    if (libafl_nyx_enabled) {
+        return libafl_nyx_payload;
+    }
+
+    if (qemu_real_host_page_size() != TARGET_PAGE_SIZE) {
+        return NULL;
+    }
+
+    payload_size = ROUND_UP(payload_size, TARGET_PAGE_SIZE);
+
+    libafl_nyx_payload_fd = qemu_memfd_create("libafl-nyx-payload",
+                                              payload_size, false, 0, 0, &err);
+    if (libafl_nyx_payload_fd < 0) {
+        error_report_err(err);
+        return NULL;
+    }
+
+    libafl_nyx_payload = mmap(NULL, payload_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, libafl_nyx_payload_fd, 0);
+    if (libafl_nyx_payload == MAP_FAILED) {
+        close(libafl_nyx_payload_fd);
+        libafl_nyx_payload_fd = -1;
+        libafl_nyx_payload = NULL;
+        return NULL;
+    }
+
+    libafl_nyx_payload_size = payload_size;
+    libafl_nyx_payload_pages =
+        g_new0(void*, payload_size / TARGET_PAGE_SIZE);
+
+    libafl_nyx_host_config.host_magic = cpu_to_le32(LIBAFL_NYX_HOST_MAGIC);
+    libafl_nyx_host_config.host_version = cpu_to_le32(LIBAFL_NYX_HOST_VERSION);
+    libafl_nyx_host_config.bitmap_size = cpu_to_le32(bitmap_size);
+    libafl_nyx_host_config.ijon_bitmap_size = cpu_to_le32(ijon_bitmap_size);
+    libafl_nyx_host_config.payload_buffer_size = cpu_to_le32(payload_size);
+    libafl_nyx_host_config.worker_id = cpu_to_le32(worker_id);
+
+    libafl_nyx_enabled = true;
+    return libafl_nyx_payload;
+}
+
+struct libafl_nyx* libafl_qemu_nyx(void) { return &libafl_nyx; }
+
+// Gives the previous payload pages back to the guest, zeroed.
+static void libafl_nyx_unmap_payload(void)
+{
+    for (size_t i = 0; i < libafl_nyx_payload_nb_pages; i++) {
+        if (mmap(libafl_nyx_payload_pages[i], TARGET_PAGE_SIZE,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+                 0) == MAP_FAILED) {
+            error_report("nyx: could not unmap the payload from guest RAM");
+            abort();
+        }
+    }
+    libafl_nyx_payload_nb_pages = 0;
+}
+
+// Backs the guest pages of the buffer at vaddr with the payload memfd.
+static bool libafl_nyx_map_payload(CPUState* cpu, vaddr addr)
+{
+    size_t nb_pages = libafl_nyx_payload_size / TARGET_PAGE_SIZE;
+
+    if (addr & ~TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    libafl_nyx_unmap_payload();
+
+    RCU_READ_LOCK_GUARD();
+
+    for (size_t i = 0; i < nb_pages; i++) {
+        hwaddr paddr =
+            cpu_get_phys_page_debug(cpu, addr + i * TARGET_PAGE_SIZE);
+        hwaddr xlat;
+        hwaddr plen = TARGET_PAGE_SIZE;
+        MemoryRegion* mr;
+        void* host;
+
+        if (paddr == -1) {
+            return false;
+        }
+
+        mr = address_space_translate(cpu->cpu_ases[0].as, paddr, &xlat, &plen,
+                                     true, MEMTXATTRS_UNSPECIFIED);
+        if (plen != TARGET_PAGE_SIZE ||
+            !memory_access_is_direct(mr, true, MEMTXATTRS_UNSPECIFIED) ||
+            qemu_ram_get_fd(mr->ram_block) >= 0 ||
+            qemu_ram_is_shared(mr->ram_block)) {
+            return false;
+        }
+
+        host = qemu_map_ram_ptr(mr->ram_block, xlat);
+        if (mmap(host, TARGET_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, libafl_nyx_payload_fd,
+                 i * TARGET_PAGE_SIZE) == MAP_FAILED) {
+            return false;
+        }
+
+        libafl_nyx_payload_pages[i] = host;
+        libafl_nyx_payload_nb_pages = i + 1;
+    }
+
+    libafl_nyx.payload_vaddr = addr;
+    return true;
+}
+
+// Reads a NUL-terminated string, stopping at the first unmapped page.
+static void libafl_nyx_read_string(CPUState* cpu, vaddr addr, char* buf,
+                                   size_t size)
+{
+    size_t len = 0;
+
+    while (len < size - 1) {
+        size_t chunk =
+            MIN(TARGET_PAGE_SIZE - ((addr + len) & ~TARGET_PAGE_MASK),
+                size - 1 - len);
+
+        if (cpu_memory_rw_debug(cpu, addr + len, buf + len, chunk, false)) {
+            break;
+        }
+        if (memchr(buf + len, 0, chunk)) {
+            return;
+        }
+        len += chunk;
+    }
+
+    buf[len] = 0;
+}
+
+static void libafl_nyx_print(CPUState* cpu, vaddr addr)
+{
+    g_autofree char* buf = g_malloc(LIBAFL_NYX_STRING_MAX);
+
+    libafl_nyx_read_string(cpu, addr, buf, LIBAFL_NYX_STRING_MAX);
+    qemu_printf("%s", buf);
+}
+
+// Replaces the panic handler of the agent by a PANIC (or KASAN) hypercall,
+// as Nyx does.
+static bool libafl_nyx_patch_handler(CPUState* cpu, vaddr addr, bool code64,
+                                     uint8_t hypercall)
+{
+    // cli; mov rax, 0x1f; mov rbx, hypercall; vmcall; hlt
+    uint8_t code64_buf[] = {0xfa, 0x48, 0xc7, 0xc0, 0x1f, 0x00, 0x00,
+                            0x00, 0x48, 0xc7, 0xc3, hypercall, 0x00, 0x00,
+                            0x00, 0x0f, 0x01, 0xc1, 0xf4};
+    // cli; mov eax, 0x1f; mov ebx, hypercall; vmcall; hlt
+    uint8_t code32_buf[] = {0xfa, 0xb8, 0x1f, 0x00, 0x00, 0x00, 0xbb, hypercall,
+                            0x00, 0x00, 0x00, 0x0f, 0x01, 0xc1, 0xf4};
+
+    if (code64) {
+        return !cpu_memory_rw_debug(cpu, addr, code64_buf, sizeof(code64_buf),
+                                    true);
+    }
+    return !cpu_memory_rw_debug(cpu, addr, code32_buf, sizeof(code32_buf),
+                                true);
+}
+
+static bool libafl_nyx_submit_range(CPUState* cpu, vaddr addr)
+{
+    uint64_t range[3];
+
+    if (cpu_memory_rw_debug(cpu, addr, range, sizeof(range), false)) {
+        return false;
+    }
+
+    uint64_t index = le64_to_cpu(range[2]);
+    if (index >= LIBAFL_NYX_MAX_RANGES) {
+        return false;
+    }
+
+    libafl_nyx.ranges[index].start = le64_to_cpu(range[0]);
+    libafl_nyx.ranges[index].end = le64_to_cpu(range[1]);
+    return true;
+}
+
+static bool libafl_nyx_advise_ranges(CPUState* cpu, vaddr addr)
+{
+    uint64_t ranges[LIBAFL_NYX_MAX_RANGES * 2];
+
+    for (int i = 0; i < LIBAFL_NYX_MAX_RANGES; i++) {
+        ranges[2 * i] = cpu_to_le64(libafl_nyx.ranges[i].start);
+        ranges[2 * i + 1] = cpu_to_le64(libafl_nyx.ranges[i].end);
+    }
+
+    return !cpu_memory_rw_debug(cpu, addr, ranges, sizeof(ranges), true);
+}
+
+static bool libafl_nyx_set_agent_config(CPUState* cpu, vaddr addr)
+{
+    struct libafl_nyx_agent_config* config = &libafl_nyx.agent_config;
+
+    if (cpu_memory_rw_debug(cpu, addr, config, sizeof(*config), false)) {
+        return false;
+    }
+
+    config->agent_magic = le32_to_cpu(config->agent_magic);
+    config->agent_version = le32_to_cpu(config->agent_version);
+    config->trace_buffer_vaddr = le64_to_cpu(config->trace_buffer_vaddr);
+    config->ijon_trace_buffer_vaddr =
+        le64_to_cpu(config->ijon_trace_buffer_vaddr);
+    config->coverage_bitmap_size = le32_to_cpu(config->coverage_bitmap_size);
+    config->input_buffer_size = le32_to_cpu(config->input_buffer_size);
+
+    libafl_nyx.has_agent_config =
+        config->agent_magic == LIBAFL_NYX_AGENT_MAGIC &&
+        config->agent_version == LIBAFL_NYX_AGENT_VERSION;
+    return libafl_nyx.has_agent_config;
+}
+
+// Returns true if the hypercall has been handled without the fuzzer.
+static bool libafl_nyx_handle_native(CPUState* cpu, uint64_t hypercall,
+                                     vaddr arg, bool code64)
+{
+    CPUX86State* env = cpu_env(cpu);
+
+    switch (hypercall) {
+    case LIBAFL_NYX_GET_PAYLOAD:
+        return libafl_nyx_map_payload(cpu, arg);
+    case LIBAFL_NYX_SUBMIT_CR3:
+        libafl_nyx.cr3 = env->cr[3];
+        return true;
+    case LIBAFL_NYX_SUBMIT_PANIC:
+        libafl_nyx.panic_handler = arg;
+        return libafl_nyx_patch_handler(cpu, arg, code64, LIBAFL_NYX_PANIC);
+    case LIBAFL_NYX_SUBMIT_KASAN:
+        libafl_nyx.kasan_handler = arg;
+        return libafl_nyx_patch_handler(cpu, arg, code64, LIBAFL_NYX_KASAN);
+    case LIBAFL_NYX_RANGE_SUBMIT:
+        return libafl_nyx_submit_range(cpu, arg);
+    case LIBAFL_NYX_USER_RANGE_ADVISE:
+        return libafl_nyx_advise_ranges(cpu, arg);
+    case LIBAFL_NYX_USER_SUBMIT_MODE:
+        libafl_nyx.mode = arg;
+        return true;
+    case LIBAFL_NYX_GET_HOST_CONFIG:
+        return !cpu_memory_rw_debug(cpu, arg, &libafl_nyx_host_config,
+                                    sizeof(libafl_nyx_host_config), true);
+    case LIBAFL_NYX_SET_AGENT_CONFIG:
+        return libafl_nyx_set_agent_config(cpu, arg);
+    case LIBAFL_NYX_PRINTF:
+    case LIBAFL_NYX_INFO:
+        libafl_nyx_print(cpu, arg);
+        return true;
+    case LIBAFL_NYX_PRINTK:
+    case LIBAFL_NYX_PRINTK_ADDR:
+        // Deprecated.
+        return true;
+    default:
+        return false;
+    }
+}
+
+void libafl_nyx_handle_hypercall(CPUState* cpu, vaddr pc)
+{
+    CPUX86State* env = cpu_env(cpu);
+    bool code64 = env->hflags & HF_CS64_MASK;
+    uint64_t mask = code64 ? UINT64_MAX : UINT32_MAX;
+    uint64_t hypercall = env->regs[R_EBX] & mask;
+    vaddr arg = env->regs[R_ECX] & mask;
+
+    if (libafl_nyx_enabled &&
+        (env->regs[R_EAX] & mask) == LIBAFL_NYX_HYPERCALL_RAX_ID) {
+        if (libafl_nyx_handle_native(cpu, hypercall, arg, code64)) {
+            return;
+        }
+
+        libafl_nyx.hypercall = hypercall;
+        libafl_nyx.arg = arg;
+
+        switch (hypercall) {
+        case LIBAFL_NYX_PANIC:
+        case LIBAFL_NYX_KASAN:
+        case LIBAFL_NYX_PANIC_EXTENDED:
+            if (hypercall == LIBAFL_NYX_PANIC_EXTENDED) {
+                libafl_nyx_print(cpu, arg);
+            }
+            libafl_exit_request_crash(cpu);
+            return;
+        default:
+            break;
+        }
+    }
+
+    libafl_exit_request_custom_insn(cpu, pc, LIBAFL_CUSTOM_INSN_NYX);
+}
+
+#else
+
+uint8_t* libafl_qemu_nyx_init(uint32_t payload_size, uint32_t bitmap_size,
+                              uint32_t ijon_bitmap_size, uint32_t worker_id)
+{
+    return NULL;
+}
+
+struct libafl_nyx* libafl_qemu_nyx(void) { return NULL; }
+
+void libafl_nyx_handle_hypercall(CPUState* cpu, vaddr pc)
+{
+    libafl_exit_request_custom_insn(cpu, pc, LIBAFL_CUSTOM_INSN_NYX);
+}
+
+#endif
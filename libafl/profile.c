@@ -0,0 +1,288 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/xxhash.h"
+#include "hw/core/cpu.h"
+#include "exec/tb-flush.h"
+#include "accel/tcg/tb-context.h"
+#include "tcg/tcg-op-common.h"
+
+#include "libafl/cpu.h"
+#include "libafl/profile.h"
+
+bool libafl_profile_helper_calls = false;
+
+static uint32_t libafl_profile_flags = 0;
+static uint32_t libafl_profile_sample_period = 0;
+
+static struct libafl_profile libafl_profile;
+
+static QemuMutex libafl_profile_lock;
+// pc -> index in libafl_profile.tbs + 1
+static GHashTable* libafl_profile_tb_index;
+// TCGHelperInfo -> index in libafl_profile.helpers + 1
+static GHashTable* libafl_profile_helper_index;
+// TCGHelperInfo of a hook -> struct libafl_profile_hook_name
+static GHashTable* libafl_profile_hook_names;
+
+struct libafl_profile_hook_name {
+    const char* hook;
+    uint64_t hook_id;
+};
+
+// Called by the API functions, from any thread.
+static void libafl_profile_init(void)
+{
+    static gsize initialized;
+
+    if (g_once_init_enter(&initialized)) {
+        qemu_mutex_init(&libafl_profile_lock);
+        libafl_profile_tb_index =
+            g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+        libafl_profile_helper_index =
+            g_hash_table_new(g_direct_hash, g_direct_equal);
+        libafl_profile_hook_names =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        libafl_profile.helpers =
+            g_new0(struct libafl_profile_helper, LIBAFL_PROFILE_MAX_HELPERS);
+        libafl_profile.tbs =
+            g_new0(struct libafl_profile_tb, LIBAFL_PROFILE_MAX_TBS);
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+void libafl_qemu_set_profiling(uint32_t flags, uint32_t tb_sample_period)
+{
+    uint32_t gen_flags = LIBAFL_PROFILE_TB_EXECS | LIBAFL_PROFILE_HELPER_CALLS;
+
+    libafl_profile_init();
+
+    if (!(flags & LIBAFL_PROFILE_TB_EXECS)) {
+        tb_sample_period = 0;
+    } else if (tb_sample_period == 0) {
+        tb_sample_period = 1;
+    }
+
+    if ((flags & gen_flags) != (libafl_profile_flags & gen_flags) ||
+        tb_sample_period != libafl_profile_sample_period) {
+        libafl_flush_jit();
+    }
+
+    qatomic_set(&libafl_profile_sample_period, tb_sample_period);
+    qatomic_set(&libafl_profile_helper_calls,
+                !!(flags & LIBAFL_PROFILE_HELPER_CALLS));
+    qatomic_set(&libafl_profile_flags, flags);
+}
+
+const struct libafl_profile* libafl_qemu_profile(void)
+{
+    CPUState* cpu;
+
+    libafl_profile_init();
+
+    libafl_profile.code_capacity = tcg_code_capacity();
+    libafl_profile.code_size = tcg_code_size();
+    libafl_profile.nb_tbs = tcg_nb_tbs();
+    libafl_profile.nb_flushes = qatomic_read(&tb_ctx.tb_flush_count);
+    libafl_profile.nb_evictions = qatomic_read(&tb_ctx.tb_evict_count);
+
+    libafl_profile.jmp_cache_hits = 0;
+    libafl_profile.jmp_cache_misses = 0;
+    libafl_profile.qht_misses = 0;
+    CPU_FOREACH(cpu)
+    {
+        TCGJumpCacheStats stats;
+
+        tcg_jmp_cache_stats(cpu, &stats);
+        libafl_profile.jmp_cache_hits += stats.hits;
+        libafl_profile.jmp_cache_misses += stats.misses;
+        libafl_profile.qht_misses += stats.qht_misses;
+    }
+
+    return &libafl_profile;
+}
+
+void libafl_qemu_profile_reset(void)
+{
+    libafl_profile_init();
+
+    qemu_mutex_lock(&libafl_profile_lock);
+
+    for (size_t i = 0; i < libafl_profile.nb_tbs_records; i++) {
+        struct libafl_profile_tb* rec = &libafl_profile.tbs[i];
+
+        rec->execs = 0;
+        rec->gen_time_ns = 0;
+        rec->translations = 0;
+    }
+    for (size_t i = 0; i < libafl_profile.nb_helpers_records; i++) {
+        libafl_profile.helpers[i].calls = 0;
+    }
+
+    libafl_profile.nb_translations = 0;
+    libafl_profile.gen_time_ns = 0;
+    libafl_profile.nb_dropped = 0;
+
+    qemu_mutex_unlock(&libafl_profile_lock);
+}
+
+void libafl_profile_name_hook(const TCGHelperInfo* info, const char* hook,
+                              uint64_t hook_id)
+{
+    struct libafl_profile_hook_name* name =
+        g_new(struct libafl_profile_hook_name, 1);
+
+    libafl_profile_init();
+
+    name->hook = hook;
+    name->hook_id = hook_id;
+
+    // The info of a removed hook may be reused by a new one: its calls go
+    // to a new record.
+    qemu_mutex_lock(&libafl_profile_lock);
+    g_hash_table_insert(libafl_profile_hook_names, (gpointer)info, name);
+    g_hash_table_remove(libafl_profile_helper_index, info);
+    qemu_mutex_unlock(&libafl_profile_lock);
+}
+
+// Must be called with libafl_profile_lock held. NULL if the table is full.
+static struct libafl_profile_tb* libafl_profile_tb_record(vaddr pc)
+{
+    // Boxed: a vaddr may not fit in a pointer.
+    gint64 key = pc;
+    size_t idx = GPOINTER_TO_SIZE(
+        g_hash_table_lookup(libafl_profile_tb_index, &key));
+    size_t nb = libafl_profile.nb_tbs_records;
+
+    if (idx) {
+        return &libafl_profile.tbs[idx - 1];
+    }
+
+    if (nb == LIBAFL_PROFILE_MAX_TBS) {
+        libafl_profile.nb_dropped++;
+        return NULL;
+    }
+
+    libafl_profile.tbs[nb].pc = pc;
+    g_hash_table_insert(libafl_profile_tb_index, g_memdup2(&key, sizeof(key)),
+                        GSIZE_TO_POINTER(nb + 1));
+    qatomic_store_release(&libafl_profile.nb_tbs_records, nb + 1);
+
+    return &libafl_profile.tbs[nb];
+}
+
+// Must be called with libafl_profile_lock held. NULL if the table is full.
+static struct libafl_profile_helper*
+libafl_profile_helper_record(const TCGHelperInfo* info)
+{
+    size_t idx = GPOINTER_TO_SIZE(
+        g_hash_table_lookup(libafl_profile_helper_index, info));
+    size_t nb = libafl_profile.nb_helpers_records;
+    struct libafl_profile_hook_name* name;
+
+    if (idx) {
+        return &libafl_profile.helpers[idx - 1];
+    }
+
+    if (nb == LIBAFL_PROFILE_MAX_HELPERS) {
+        libafl_profile.nb_dropped++;
+        return NULL;
+    }
+
+    name = g_hash_table_lookup(libafl_profile_hook_names, info);
+
+    libafl_profile.helpers[nb].name = info->name;
+    if (name) {
+        libafl_profile.helpers[nb].hook = name->hook;
+        libafl_profile.helpers[nb].hook_id = name->hook_id;
+    }
+    g_hash_table_insert(libafl_profile_helper_index, (gpointer)info,
+                        GSIZE_TO_POINTER(nb + 1));
+    qatomic_store_release(&libafl_profile.nb_helpers_records, nb + 1);
+
+    return &libafl_profile.helpers[nb];
+}
+
+// *counter += 1
+static void libafl_profile_gen_count(uint64_t* counter)
+{
+    TCGv_ptr counter_ptr = tcg_constant_ptr(counter);
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(count, counter_ptr, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, counter_ptr, 0);
+}
+
+int64_t libafl_profile_gen_clock(void)
+{
+    if (!(qatomic_read(&libafl_profile_flags) & LIBAFL_PROFILE_TRANSLATION)) {
+        return 0;
+    }
+    return get_clock();
+}
+
+void libafl_profile_gen_start(TranslationBlock* tb, vaddr pc)
+{
+    uint32_t period = qatomic_read(&libafl_profile_sample_period);
+    struct libafl_profile_tb* rec;
+
+    // Sampled by pc, so that the retranslations of a block keep counting.
+    if (period == 0 || qemu_xxhash2(pc) % period != 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&libafl_profile_lock);
+    rec = libafl_profile_tb_record(pc);
+    if (rec) {
+        rec->sampled = true;
+    }
+    qemu_mutex_unlock(&libafl_profile_lock);
+
+    if (rec) {
+        libafl_profile_gen_count(&rec->execs);
+    }
+}
+
+void libafl_profile_gen_end(TranslationBlock* tb, vaddr pc, int64_t start)
+{
+    int64_t elapsed;
+    struct libafl_profile_tb* rec;
+
+    if (!start) {
+        return;
+    }
+
+    elapsed = get_clock() - start;
+
+    qemu_mutex_lock(&libafl_profile_lock);
+
+    libafl_profile.nb_translations++;
+    libafl_profile.gen_time_ns += elapsed;
+
+    // The pc of an edge TB is made up from its source block and exit.
+    rec = (tb->cflags & CF_IS_EDGE) ? NULL : libafl_profile_tb_record(pc);
+    if (rec) {
+        rec->translations++;
+        rec->gen_time_ns += elapsed;
+        rec->guest_size = tb->size;
+        rec->host_size = tb->tc.size;
+        rec->icount = tb->icount;
+    }
+
+    qemu_mutex_unlock(&libafl_profile_lock);
+}
+
+void libafl_profile_gen_call(const TCGHelperInfo* info)
+{
+    struct libafl_profile_helper* rec;
+
+    qemu_mutex_lock(&libafl_profile_lock);
+    rec = libafl_profile_helper_record(info);
+    qemu_mutex_unlock(&libafl_profile_lock);
+
+    if (rec) {
+        libafl_profile_gen_count(&rec->calls);
+    }
+}
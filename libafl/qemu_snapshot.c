@@ -1,8 +1,10 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 
-#include <stdlib.h>
-#include <string.h>
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 #include "migration/snapshot.h"
 #include "qemu/error-report.h"
@@ -10,81 +12,331 @@
 #include "hw/core/cpu.h"
 #include "system/runstate.h"
 #include "libafl/qemu_snapshot.h"
+#include "libafl/hooks/tcg/call.h"
 
-static void save_snapshot_cb(void* opaque)
+// Snapshots stop and restart the VM. A VM fast paused by the last run is
+// first stopped for real, in RUN_STATE_RET: it stays stopped across the
+// snapshot, and the next run restarts it with vm_start().
+static void leave_fast_pause(void)
+{
+#ifdef AS_LIB
+    libafl_vm_leave_fast_pause();
+#endif
+}
+
+struct libafl_memory_snapshot {
+    uint8_t* data;
+    size_t size;
+    // Size of the migration stream, once uncompressed.
+    size_t stream_size;
+    enum libafl_qemu_snapshot_compression compression;
+};
+
+static enum libafl_qemu_snapshot_backend snapshot_backend =
+    LIBAFL_QEMU_SNAPSHOT_QCOW2;
+static enum libafl_qemu_snapshot_compression snapshot_compression =
+    LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE;
+
+// name -> struct libafl_memory_snapshot
+static GHashTable* memory_snapshots;
+
+// Decompressed stream, kept between loads.
+static uint8_t* stream_buf;
+static size_t stream_buf_size;
+
+static void memory_snapshot_free(gpointer data)
+{
+    struct libafl_memory_snapshot* snapshot = data;
+
+    g_free(snapshot->data);
+    g_free(snapshot);
+}
+
+static bool memory_snapshot_compress(struct libafl_memory_snapshot* snapshot,
+                                     uint8_t* stream, size_t size)
+{
+    uint8_t* out = NULL;
+    size_t out_size = 0;
+
+    switch (snapshot->compression) {
+    case LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZLIB: {
+        uLongf len = compressBound(size);
+
+        out = g_malloc(len);
+        if (compress2(out, &len, stream, size, Z_BEST_SPEED) != Z_OK) {
+            g_free(out);
+            return false;
+        }
+        out_size = len;
+        break;
+    }
+#ifdef CONFIG_ZSTD
+    case LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZSTD:
+        out = g_malloc(ZSTD_compressBound(size));
+        out_size = ZSTD_compress(out, ZSTD_compressBound(size), stream, size, 1);
+        if (ZSTD_isError(out_size)) {
+            g_free(out);
+            return false;
+        }
+        break;
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    snapshot->data = g_realloc(out, out_size);
+    snapshot->size = out_size;
+    return true;
+}
+
+// Returns the migration stream of the snapshot, NULL on error.
+static const uint8_t*
+memory_snapshot_stream(struct libafl_memory_snapshot* snapshot)
+{
+    if (snapshot->compression == LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE) {
+        return snapshot->data;
+    }
+
+    if (stream_buf_size < snapshot->stream_size) {
+        g_free(stream_buf);
+        stream_buf = g_malloc(snapshot->stream_size);
+        stream_buf_size = snapshot->stream_size;
+    }
+
+    switch (snapshot->compression) {
+    case LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZLIB: {
+        uLongf len = snapshot->stream_size;
+
+        if (uncompress(stream_buf, &len, snapshot->data, snapshot->size) !=
+                Z_OK ||
+            len != snapshot->stream_size) {
+            return NULL;
+        }
+        break;
+    }
+#ifdef CONFIG_ZSTD
+    case LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZSTD:
+        if (ZSTD_decompress(stream_buf, snapshot->stream_size, snapshot->data,
+                            snapshot->size) != snapshot->stream_size) {
+            return NULL;
+        }
+        break;
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    return stream_buf;
+}
+
+static bool save_memory_snapshot(const char* name, Error** errp)
+{
+    struct libafl_memory_snapshot* snapshot;
+    size_t size;
+    uint8_t* stream = libafl_save_snapshot_buffer(&size, errp);
+
+    if (!stream) {
+        return false;
+    }
+
+    snapshot = g_new0(struct libafl_memory_snapshot, 1);
+    snapshot->stream_size = size;
+    snapshot->compression = snapshot_compression;
+
+    if (snapshot->compression == LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE) {
+        // Keep the stream, without the capacity reserved for RAM
+        snapshot->data = g_realloc(stream, size);
+        snapshot->size = size;
+    } else {
+        bool compressed = memory_snapshot_compress(snapshot, stream, size);
+
+        g_free(stream);
+        if (!compressed) {
+            error_setg(errp, "Could not compress the snapshot");
+            g_free(snapshot);
+            return false;
+        }
+    }
+
+    if (!memory_snapshots) {
+        memory_snapshots = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 g_free, memory_snapshot_free);
+    }
+    g_hash_table_insert(memory_snapshots, g_strdup(name), snapshot);
+
+    return true;
+}
+
+static bool load_memory_snapshot(const char* name, Error** errp)
+{
+    struct libafl_memory_snapshot* snapshot =
+        memory_snapshots ? g_hash_table_lookup(memory_snapshots, name) : NULL;
+    const uint8_t* stream;
+
+    if (!snapshot) {
+        error_setg(errp, "Snapshot '%s' does not exist in memory", name);
+        return false;
+    }
+
+    stream = memory_snapshot_stream(snapshot);
+    if (!stream) {
+        error_setg(errp, "Could not decompress snapshot '%s'", name);
+        return false;
+    }
+
+    return libafl_load_snapshot_buffer(stream, snapshot->stream_size, errp);
+}
+
+static void do_save_snapshot(const char* name)
 {
-    char* name = (char*)opaque;
     Error* err = NULL;
-    if (!save_snapshot(name, true, NULL, false, NULL, &err)) {
+    bool saved;
+
+    leave_fast_pause();
+
+    if (snapshot_backend == LIBAFL_QEMU_SNAPSHOT_MEMORY) {
+        saved = save_memory_snapshot(name, &err);
+    } else {
+        saved = save_snapshot(name, true, NULL, false, NULL, &err);
+    }
+
+    if (!saved) {
         error_report_err(err);
         error_report("Could not save snapshot");
     }
-    free(opaque);
 }
 
-static void load_snapshot_cb(void* opaque)
+static void do_load_snapshot(const char* name)
 {
-    char* name = (char*)opaque;
     Error* err = NULL;
+    bool loaded;
+
+    leave_fast_pause();
 
     int saved_vm_running = runstate_is_running();
     vm_stop(RUN_STATE_RESTORE_VM);
 
-    bool loaded = load_snapshot(name, NULL, false, NULL, &err);
+    if (snapshot_backend == LIBAFL_QEMU_SNAPSHOT_MEMORY) {
+        loaded = load_memory_snapshot(name, &err);
+    } else {
+        loaded = load_snapshot(name, NULL, false, NULL, &err);
+    }
 
     if (!loaded) {
         error_report_err(err);
         error_report("Could not load snapshot");
+    } else {
+        libafl_call_ctx_reset_all();
     }
     if (loaded && saved_vm_running) {
         vm_start();
     }
-    free(opaque);
+}
+
+static void save_snapshot_cb(void* opaque)
+{
+    do_save_snapshot(opaque);
+    g_free(opaque);
+}
+
+static void load_snapshot_cb(void* opaque)
+{
+    do_load_snapshot(opaque);
+    g_free(opaque);
+}
+
+bool libafl_set_qemu_snapshot_backend(
+    enum libafl_qemu_snapshot_backend backend,
+    enum libafl_qemu_snapshot_compression compression)
+{
+#ifndef CONFIG_ZSTD
+    if (compression == LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZSTD) {
+        error_report("QEMU was built without zstd support");
+        return false;
+    }
+#endif
+
+    snapshot_backend = backend;
+    snapshot_compression = compression;
+    return true;
+}
+
+void libafl_delete_qemu_snapshot(char* name)
+{
+    if (memory_snapshots) {
+        g_hash_table_remove(memory_snapshots, name);
+    }
 }
 
 void libafl_save_qemu_snapshot(char* name, bool sync)
 {
     // use snapshots synchronously, use if main loop is not running
     if (sync) {
-        // TODO: eliminate this code duplication
-        // by passing a heap-allocated buffer from rust to c,
-        // which c needs to free
-        Error* err = NULL;
-        if (!save_snapshot(name, true, NULL, false, NULL, &err)) {
-            error_report_err(err);
-            error_report("Could not save snapshot");
-        }
+        do_save_snapshot(name);
         return;
     }
-    char* name_buffer = malloc(strlen(name) + 1);
-    strcpy(name_buffer, name);
     aio_bh_schedule_oneshot_full(qemu_get_aio_context(), save_snapshot_cb,
-                                 (void*)name_buffer, "save_snapshot");
+                                 g_strdup(name), "save_snapshot");
 }
 
 void libafl_load_qemu_snapshot(char* name, bool sync)
 {
     // use snapshots synchronously, use if main loop is not running
     if (sync) {
-        // TODO: see libafl_save_qemu_snapshot
-        Error* err = NULL;
+        do_load_snapshot(name);
+        return;
+    }
+    aio_bh_schedule_oneshot_full(qemu_get_aio_context(), load_snapshot_cb,
+                                 g_strdup(name), "load_snapshot");
+}
 
-        int saved_vm_running = runstate_is_running();
-        vm_stop(RUN_STATE_RESTORE_VM);
+struct libafl_snapshot_file {
+    char* path;
+    bool lazy;
+};
 
-        bool loaded = load_snapshot(name, NULL, false, NULL, &err);
+static bool load_snapshot_file(const char* path, bool lazy)
+{
+    Error* err = NULL;
 
-        if (!loaded) {
-            error_report_err(err);
-            error_report("Could not load snapshot");
-        }
-        if (loaded && saved_vm_running) {
-            vm_start();
-        }
+    leave_fast_pause();
+
+    int saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    bool loaded = libafl_load_snapshot_file(path, lazy, &err);
+
+    if (!loaded) {
+        error_report_err(err);
+        error_report("Could not load snapshot file %s", path);
+    } else {
+        libafl_call_ctx_reset_all();
+    }
+    if (loaded && saved_vm_running) {
+        vm_start();
+    }
+    return loaded;
+}
+
+static void load_snapshot_file_cb(void* opaque)
+{
+    struct libafl_snapshot_file* file = opaque;
+
+    load_snapshot_file(file->path, file->lazy);
+    g_free(file->path);
+    g_free(file);
+}
+
+void libafl_load_qemu_snapshot_file(char* path, bool lazy, bool sync)
+{
+    if (sync) {
+        load_snapshot_file(path, lazy);
         return;
     }
-    char* name_buffer = malloc(strlen(name) + 1);
-    strcpy(name_buffer, name);
-    aio_bh_schedule_oneshot_full(qemu_get_aio_context(), load_snapshot_cb,
-                                 (void*)name_buffer, "load_snapshot");
+
+    struct libafl_snapshot_file* file = g_new(struct libafl_snapshot_file, 1);
+    file->path = g_strdup(path);
+    file->lazy = lazy;
+    aio_bh_schedule_oneshot_full(qemu_get_aio_context(), load_snapshot_file_cb,
+                                 file, "load_snapshot_file");
 }
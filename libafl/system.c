@@ -4,6 +4,7 @@
 #include "exec/target_page.h"
 #include "system/system.h"
 #include "system/cpus.h"
+#include "system/cpu-timers.h"
 #include "system/replay.h"
 #include "system/runstate.h"
 #include "accel/accel-cpu-ops.h"
@@ -18,18 +19,53 @@ void libafl_qemu_init(int argc, char** argv)
     qemu_init(argc, argv);
 }
 
-int libafl_qemu_run(void)
+static void libafl_qemu_resume(void)
 {
+#ifdef AS_LIB
+    if (libafl_vm_resume_fast()) {
+        // the last run returned through libafl_qemu_run_fast
+        return;
+    }
+#endif
+
     if (runstate_check(RUN_STATE_PRELAUNCH) || runstate_check(RUN_STATE_RET)) {
         // we are starting the VM for the first time or resuming from a return to libafl
         // transition to RUN_STATE_RUNNING
         vm_start();
     }
+}
+
+int libafl_qemu_run(void)
+{
+    libafl_qemu_resume();
+
+    int status = qemu_main_loop();
+
+    return status;
+}
 
+#ifdef AS_LIB
+int libafl_qemu_run_fast(void)
+{
+    libafl_qemu_resume();
+
+    libafl_set_fast_return(true);
     int status = qemu_main_loop();
+    libafl_set_fast_return(false);
 
     return status;
 }
+#endif
+
+void libafl_qemu_set_idle_skip(bool enable)
+{
+    libafl_set_idle_skip(enable);
+}
+
+void libafl_qemu_idle_skip_stats(uint64_t* nb_skips, uint64_t* skipped_ns)
+{
+    libafl_idle_skip_stats(nb_skips, skipped_ns);
+}
 
 int libafl_qemu_set_hw_breakpoint(vaddr addr)
 {
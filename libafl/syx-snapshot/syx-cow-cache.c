@@ -1,15 +1,20 @@
 #include "qemu/osdep.h"
 
 #include "libafl/syx-snapshot/syx-cow-cache.h"
-#include "system/block-backend-io.h"
+#include "block/block_int-io.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "system/block-backend.h"
 
 #define IS_POWER_OF_TWO(x) ((x != 0) && ((x & (x - 1)) == 0))
 
 SyxCowCache* syx_cow_cache_new(void)
 {
-    SyxCowCache* cache = g_new0(SyxCowCache, 2);
+    SyxCowCache* cache = g_new0(SyxCowCache, 1);
 
     QTAILQ_INIT(&cache->layers);
+    qemu_mutex_init(&cache->lock);
 
     return cache;
 }
@@ -24,6 +29,7 @@ void syx_cow_cache_push_layer(SyxCowCache* scc, uint64_t chunk_size,
                               uint64_t max_size)
 {
     SyxCowCacheLayer* new_layer = g_new0(SyxCowCacheLayer, 1);
+    SyxCowCacheLayer* highest_layer = QTAILQ_FIRST(&scc->layers);
 
     new_layer->cow_cache_devices =
         g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
@@ -32,7 +38,9 @@ void syx_cow_cache_push_layer(SyxCowCache* scc, uint64_t chunk_size,
 
     assert(IS_POWER_OF_TWO(chunk_size));
     assert(!(max_size % chunk_size));
+    assert(!highest_layer || highest_layer->chunk_size == chunk_size);
 
+    QEMU_LOCK_GUARD(&scc->lock);
     QTAILQ_INSERT_HEAD(&scc->layers, new_layer, next);
 }
 
@@ -41,7 +49,7 @@ void syx_cow_cache_pop_layer(SyxCowCache* scc)
     // TODO
 }
 
-static void flush_device_layer(gpointer _blk_name_hash, gpointer cache_device,
+static void flush_device_layer(gpointer _blk, gpointer cache_device,
                                gpointer _user_data)
 {
     SyxCowCacheDevice* sccd = (SyxCowCacheDevice*)cache_device;
@@ -54,207 +62,442 @@ void syx_cow_cache_flush_highest_layer(SyxCowCache* scc)
 {
     SyxCowCacheLayer* highest_layer = QTAILQ_FIRST(&scc->layers);
 
-    // highest_layer->cow_cache_devices
+    // Only the touched chunks are dropped, the storage is kept for the next
+    // run.
+    QEMU_LOCK_GUARD(&scc->lock);
     g_hash_table_foreach(highest_layer->cow_cache_devices, flush_device_layer,
                          NULL);
 }
 
 void syx_cow_cache_move(SyxCowCache* lhs, SyxCowCache** rhs)
 {
-    lhs->layers = (*rhs)->layers;
+    SyxCowCacheLayer* layer;
+
+    // The list head cannot be copied, the first layer points back to it.
+    while ((layer = QTAILQ_FIRST(&(*rhs)->layers))) {
+        QTAILQ_REMOVE(&(*rhs)->layers, layer, next);
+        QTAILQ_INSERT_TAIL(&lhs->layers, layer, next);
+    }
+
+    qemu_mutex_destroy(&(*rhs)->lock);
     g_free(*rhs);
     *rhs = NULL;
 }
 
-static bool read_chunk_from_cache_layer_device(SyxCowCacheDevice* sccd,
-                                               QEMUIOVector* qiov,
-                                               size_t qiov_offset,
-                                               uint64_t blk_offset)
+static uint8_t* layer_device_chunk(SyxCowCacheDevice* sccd,
+                                   uint64_t blk_offset)
 {
     gpointer data_position = NULL;
-    bool found = g_hash_table_lookup_extended(
-        sccd->positions, GUINT_TO_POINTER(blk_offset), NULL, &data_position);
-
-    // cache hit
-    if (found) {
-        void* data_position_ptr =
-            g_array_element_ptr(sccd->data, GPOINTER_TO_UINT(data_position));
-        assert(qemu_iovec_from_buf(qiov, qiov_offset, data_position_ptr,
-                                   g_array_get_element_size(sccd->data)) ==
-               g_array_get_element_size(sccd->data));
+
+    if (!g_hash_table_lookup_extended(sccd->positions,
+                                      GUINT_TO_POINTER(blk_offset), NULL,
+                                      &data_position)) {
+        return NULL;
     }
 
-    return found;
+    return (uint8_t*)g_array_element_ptr(sccd->data,
+                                         GPOINTER_TO_UINT(data_position));
 }
 
-// len must be smaller than nb bytes to next aligned to chunk of blk_offset.
-// static void write_to_cache_layer_device_unaligned(SyxCowCacheDevice* sccd,
-// QEMUIOVector* qiov, size_t qiov_offset, uint64_t blk_offset, uint64_t len)
-// {
-//     const uint64_t chunk_size = g_array_get_element_size(sccd->data);
-//
-//     assert(ROUND_UP(blk_offset, chunk_size) - blk_offset <= len);
-//     assert(IS_POWER_OF_TWO(chunk_size));
-//
-//     uint64_t blk_offset_aligned = ROUND_DOWN(blk_offset, chunk_size);
-//
-//     gpointer data_position = NULL;
-//     bool found = g_hash_table_lookup_extended(sccd->positions,
-//     GUINT_TO_POINTER(blk_offset_aligned), NULL, &data_position);
-//
-//     if (!found) {
-//         data_position = GUINT_TO_POINTER(sccd->data->len);
-//         sccd->data = g_array_set_size(sccd->data, sccd->data->len + 1);
-//         g_hash_table_insert(sccd->positions, GUINT_TO_POINTER(blk_offset),
-//         data_position);
-//     }
-//
-//     void* data_position_ptr = g_array_element_ptr(sccd->data,
-//     GPOINTER_TO_UINT(data_position));
-//
-//     assert(qemu_iovec_to_buf(qiov, qiov_offset, data_position_ptr,
-//     g_array_get_element_size(sccd->data)) ==
-//            g_array_get_element_size(sccd->data));
-// }
-
-// cache layer is allocated and all the basic checks are already done.
-static void write_chunk_to_cache_layer_device(SyxCowCacheDevice* sccd,
-                                              QEMUIOVector* qiov,
-                                              size_t qiov_offset,
-                                              uint64_t blk_offset)
+// Returns the chunk from the highest layer having it, NULL if it is only in
+// the image.
+static uint8_t* cache_chunk(SyxCowCache* scc, BlockBackend* blk,
+                           uint64_t blk_offset)
 {
-    const uint64_t chunk_size = g_array_get_element_size(sccd->data);
+    SyxCowCacheLayer* layer;
 
-    gpointer data_position = NULL;
-    bool found = g_hash_table_lookup_extended(
-        sccd->positions, GUINT_TO_POINTER(blk_offset), NULL, &data_position);
-
-    if (!found) {
-        data_position = GUINT_TO_POINTER(sccd->data->len);
-        sccd->data = g_array_set_size(sccd->data, sccd->data->len + 1);
-        g_hash_table_insert(sccd->positions, GUINT_TO_POINTER(blk_offset),
-                            data_position);
-    }
+    QTAILQ_FOREACH(layer, &scc->layers, next)
+    {
+        SyxCowCacheDevice* sccd =
+            g_hash_table_lookup(layer->cow_cache_devices, blk);
 
-    void* data_position_ptr =
-        g_array_element_ptr(sccd->data, GPOINTER_TO_UINT(data_position));
+        if (sccd) {
+            uint8_t* chunk = layer_device_chunk(sccd, blk_offset);
 
-    assert(qemu_iovec_to_buf(qiov, qiov_offset, data_position_ptr,
-                             chunk_size) == chunk_size);
+            if (chunk) {
+                return chunk;
+            }
+        }
+    }
+
+    return NULL;
 }
 
-static bool read_chunk_from_cache_layer(SyxCowCacheLayer* sccl,
-                                        BlockBackend* blk, QEMUIOVector* qiov,
-                                        size_t qiov_offset, uint64_t blk_offset)
+static bool cache_has_device(SyxCowCache* scc, BlockBackend* blk)
 {
-    assert(!(qiov->size % sccl->chunk_size));
+    SyxCowCacheLayer* layer;
 
-    SyxCowCacheDevice* cache_entry = g_hash_table_lookup(
-        sccl->cow_cache_devices, GINT_TO_POINTER(blk_name_hash(blk)));
+    QTAILQ_FOREACH(layer, &scc->layers, next)
+    {
+        SyxCowCacheDevice* sccd =
+            g_hash_table_lookup(layer->cow_cache_devices, blk);
 
-    // return early if nothing is registered
-    if (!cache_entry) {
-        return false;
+        if (sccd && sccd->data->len) {
+            return true;
+        }
     }
 
-    assert(cache_entry && cache_entry->data);
-
-    // try to read cached pages in current layer if something is registered.
-    return read_chunk_from_cache_layer_device(cache_entry, qiov, qiov_offset,
-                                              blk_offset);
+    return false;
 }
 
-// Returns false if could not write to current layer.
-static bool write_to_cache_layer(SyxCowCacheLayer* sccl, BlockBackend* blk,
-                                 int64_t offset, int64_t bytes,
-                                 QEMUIOVector* qiov)
+static SyxCowCacheDevice* layer_device(SyxCowCacheLayer* sccl,
+                                       BlockBackend* blk)
 {
-    if (qiov->size % sccl->chunk_size) {
-        // todo: determine if it is worth developing an unaligned access
-        // version.
-        printf("error: 0x%zx %% 0x%lx == 0x%lx\n", qiov->size, sccl->chunk_size,
-               qiov->size % sccl->chunk_size);
-        exit(1);
-    }
-
-    SyxCowCacheDevice* cache_entry = g_hash_table_lookup(
-        sccl->cow_cache_devices, GINT_TO_POINTER(blk_name_hash(blk)));
+    SyxCowCacheDevice* sccd = g_hash_table_lookup(sccl->cow_cache_devices, blk);
 
-    if (unlikely(!cache_entry)) {
-        cache_entry = g_new0(SyxCowCacheDevice, 1);
-        cache_entry->data = g_array_sized_new(false, false, sccl->chunk_size,
-                                              INITIAL_NB_CHUNKS_PER_DEVICE);
-        cache_entry->positions =
+    if (unlikely(!sccd)) {
+        sccd = g_new0(SyxCowCacheDevice, 1);
+        sccd->data = g_array_sized_new(false, false, sccl->chunk_size,
+                                       INITIAL_NB_CHUNKS_PER_DEVICE);
+        sccd->positions =
             g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
-        g_hash_table_insert(sccl->cow_cache_devices,
-                            GINT_TO_POINTER(blk_name_hash(blk)), cache_entry);
+        g_hash_table_insert(sccl->cow_cache_devices, blk, sccd);
     }
 
-    assert(cache_entry && cache_entry->data);
+    return sccd;
+}
 
-    if (cache_entry->data->len + (qiov->size / sccl->chunk_size) >
-        sccl->max_nb_chunks) {
-        return false;
-    }
+// The returned pointer is valid until the next chunk is added to sccd.
+static uint8_t* layer_device_new_chunk(SyxCowCacheDevice* sccd,
+                                       uint64_t blk_offset)
+{
+    guint data_position = sccd->data->len;
 
-    // write cached page
-    uint64_t blk_offset = offset;
-    size_t qiov_offset = 0;
-    for (; qiov_offset < qiov->size;
-         blk_offset += sccl->chunk_size, qiov_offset += sccl->chunk_size) {
-        write_chunk_to_cache_layer_device(cache_entry, qiov, qiov_offset,
-                                          blk_offset);
-    }
+    sccd->data = g_array_set_size(sccd->data, data_position + 1);
+    g_hash_table_insert(sccd->positions, GUINT_TO_POINTER(blk_offset),
+                        GUINT_TO_POINTER(data_position));
 
-    return true;
+    return (uint8_t*)g_array_element_ptr(sccd->data, data_position);
 }
 
 void syx_cow_cache_read_entry(SyxCowCache* scc, BlockBackend* blk,
                               int64_t offset, int64_t bytes, QEMUIOVector* qiov,
-                              size_t _qiov_offset, BdrvRequestFlags flags)
+                              size_t qiov_offset)
 {
-    SyxCowCacheLayer* layer;
-    uint64_t blk_offset = offset;
-    size_t qiov_offset = 0;
-    uint64_t chunk_size = 0;
-
-    // printf("[%s] Read 0x%zx bytes @addr %lx\n", blk_name(blk), qiov->size,
-    // offset);
-
-    // First read the backing block device normally.
-    assert(blk_co_preadv(blk, offset, bytes, qiov, flags) >= 0);
-
-    // Then fix the chunks that have been read from before.
-    if (!QTAILQ_EMPTY(&scc->layers)) {
-        for (; qiov_offset < qiov->size;
-             blk_offset += chunk_size, qiov_offset += chunk_size) {
-            QTAILQ_FOREACH(layer, &scc->layers, next)
-            {
-                chunk_size = layer->chunk_size;
-                if (read_chunk_from_cache_layer(layer, blk, qiov, qiov_offset,
-                                                blk_offset)) {
-                    break;
+    SyxCowCacheLayer* layer = QTAILQ_FIRST(&scc->layers);
+    uint64_t end = offset + bytes;
+    uint64_t chunk_size;
+
+    if (!layer) {
+        return;
+    }
+
+    chunk_size = layer->chunk_size;
+
+    QEMU_LOCK_GUARD(&scc->lock);
+
+    if (!cache_has_device(scc, blk)) {
+        return;
+    }
+
+    for (uint64_t blk_offset = ROUND_DOWN(offset, chunk_size); blk_offset < end;
+         blk_offset += chunk_size) {
+        uint8_t* chunk = cache_chunk(scc, blk, blk_offset);
+
+        if (chunk) {
+            uint64_t start = MAX(blk_offset, offset);
+            uint64_t len = MIN(blk_offset + chunk_size, end) - start;
+
+            qemu_iovec_from_buf(qiov, qiov_offset + (start - offset),
+                                chunk + (start - blk_offset), len);
+        }
+    }
+}
+
+int coroutine_fn GRAPH_RDLOCK
+syx_cow_cache_write_entry(SyxCowCache* scc, BlockBackend* blk,
+                          BdrvChild* backing, int64_t offset, int64_t bytes,
+                          QEMUIOVector* qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    SyxCowCacheLayer* layer = QTAILQ_FIRST(&scc->layers);
+    SyxCowCacheDevice* sccd;
+    g_autofree uint8_t* head_chunk = NULL;
+    g_autofree uint8_t* tail_chunk = NULL;
+    uint64_t end = offset + bytes;
+    uint64_t chunk_size, first, last;
+    int ret;
+
+    assert(layer);
+
+    if (!bytes) {
+        return 0;
+    }
+
+    chunk_size = layer->chunk_size;
+    first = ROUND_DOWN(offset, chunk_size);
+    last = ROUND_DOWN(end - 1, chunk_size);
+
+    // Partial chunks not cached yet are completed from the image. It is read
+    // before taking the lock since it may yield: the image is never written
+    // while the cache is in use, it cannot change in the meantime.
+    if (offset != first) {
+        head_chunk = g_malloc(chunk_size);
+        ret = bdrv_co_pread(backing, first, chunk_size, head_chunk, 0);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (end != last + chunk_size && (last != first || !head_chunk)) {
+        tail_chunk = g_malloc(chunk_size);
+        ret = bdrv_co_pread(backing, last, chunk_size, tail_chunk, 0);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    QEMU_LOCK_GUARD(&scc->lock);
+
+    sccd = layer_device(layer, blk);
+
+    if (sccd->data->len + (last - first) / chunk_size + 1 >
+        layer->max_nb_chunks) {
+        return -ENOSPC;
+    }
+
+    for (uint64_t blk_offset = first; blk_offset <= last;
+         blk_offset += chunk_size) {
+        uint64_t start = MAX(blk_offset, offset);
+        uint64_t len = MIN(blk_offset + chunk_size, end) - start;
+        uint8_t* chunk = layer_device_chunk(sccd, blk_offset);
+
+        if (!chunk) {
+            // Lower layers are not modified, their chunks stay in place.
+            uint8_t* base = len == chunk_size
+                                ? NULL
+                                : cache_chunk(scc, blk, blk_offset);
+
+            chunk = layer_device_new_chunk(sccd, blk_offset);
+
+            if (len != chunk_size) {
+                if (!base) {
+                    base = blk_offset == first && head_chunk ? head_chunk
+                                                             : tail_chunk;
                 }
+                memcpy(chunk, base, chunk_size);
             }
         }
+
+        if (flags & BDRV_REQ_ZERO_WRITE) {
+            memset(chunk + (start - blk_offset), 0, len);
+        } else {
+            qemu_iovec_to_buf(qiov, qiov_offset + (start - offset),
+                              chunk + (start - blk_offset), len);
+        }
     }
+
+    return 0;
+}
+
+static void put_bytes(GByteArray* out, const void* data, size_t len)
+{
+    g_byte_array_append(out, data, len);
+}
+
+static void put_u64(GByteArray* out, uint64_t v)
+{
+    put_bytes(out, &v, sizeof(v));
 }
 
-bool syx_cow_cache_write_entry(SyxCowCache* scc, BlockBackend* blk,
-                               int64_t offset, int64_t bytes,
-                               QEMUIOVector* qiov, size_t qiov_offset,
-                               BdrvRequestFlags flags)
+struct save_device_args {
+    GByteArray* out;
+    uint64_t chunk_size;
+    uint32_t nb_devices;
+};
+
+static void save_device(gpointer blk_ptr, gpointer cache_device,
+                        gpointer args_ptr)
+{
+    struct save_device_args* args = args_ptr;
+    SyxCowCacheDevice* sccd = cache_device;
+    const char* name = blk_name(blk_ptr);
+    GHashTableIter iter;
+    gpointer blk_offset, data_position;
+
+    if (!*name) {
+        warn_report("SYX COW cache: chunks of an anonymous block device are "
+                    "not saved");
+        return;
+    }
+
+    put_u64(args->out, strlen(name));
+    put_bytes(args->out, name, strlen(name));
+    put_u64(args->out, g_hash_table_size(sccd->positions));
+
+    g_hash_table_iter_init(&iter, sccd->positions);
+    while (g_hash_table_iter_next(&iter, &blk_offset, &data_position)) {
+        put_u64(args->out, GPOINTER_TO_UINT(blk_offset));
+        put_bytes(args->out,
+                  g_array_element_ptr(sccd->data,
+                                      GPOINTER_TO_UINT(data_position)),
+                  args->chunk_size);
+    }
+
+    args->nb_devices++;
+}
+
+void syx_cow_cache_save_lower_layers(SyxCowCache* scc, GByteArray* out)
 {
     SyxCowCacheLayer* layer;
+    uint64_t nb_layers = 0;
+    guint nb_layers_pos = out->len;
 
-    // printf("[%s] Write 0x%zx bytes @addr %lx\n", blk_name(blk), qiov->size,
-    // offset);
+    QEMU_LOCK_GUARD(&scc->lock);
 
     layer = QTAILQ_FIRST(&scc->layers);
-    if (layer) {
-        assert(write_to_cache_layer(layer, blk, offset, bytes, qiov));
-        return true;
-    } else {
+    put_u64(out, 0);
+
+    while (layer && (layer = QTAILQ_NEXT(layer, next))) {
+        struct save_device_args args = {
+            .out = out, .chunk_size = layer->chunk_size, .nb_devices = 0};
+        guint nb_devices_pos;
+
+        put_u64(out, layer->chunk_size);
+        put_u64(out, layer->max_nb_chunks);
+        nb_devices_pos = out->len;
+        put_u64(out, 0);
+
+        g_hash_table_foreach(layer->cow_cache_devices, save_device, &args);
+
+        stq_he_p(out->data + nb_devices_pos, args.nb_devices);
+        nb_layers++;
+    }
+
+    stq_he_p(out->data + nb_layers_pos, nb_layers);
+}
+
+struct cursor {
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+static const uint8_t* get_bytes(struct cursor* c, uint64_t len)
+{
+    const uint8_t* p = c->p;
+
+    if (len > (uint64_t)(c->end - c->p)) {
+        return NULL;
+    }
+
+    c->p += len;
+    return p;
+}
+
+static bool get_u64(struct cursor* c, uint64_t* v)
+{
+    const uint8_t* p = get_bytes(c, sizeof(*v));
+
+    if (!p) {
+        return false;
+    }
+
+    *v = ldq_he_p(p);
+    return true;
+}
+
+static void free_device_layer(gpointer _blk, gpointer cache_device,
+                              gpointer _user_data)
+{
+    SyxCowCacheDevice* sccd = cache_device;
+
+    g_hash_table_destroy(sccd->positions);
+    g_array_free(sccd->data, true);
+    g_free(sccd);
+}
+
+static bool load_device(SyxCowCacheLayer* layer, struct cursor* c)
+{
+    uint64_t name_len, nb_chunks;
+    const uint8_t* name;
+    g_autofree char* name_str = NULL;
+    SyxCowCacheDevice* sccd;
+    BlockBackend* blk;
+
+    if (!get_u64(c, &name_len) || !(name = get_bytes(c, name_len)) ||
+        !get_u64(c, &nb_chunks)) {
         return false;
     }
+
+    name_str = g_strndup((const char*)name, name_len);
+    blk = blk_by_name(name_str);
+    if (!blk) {
+        warn_report("SYX COW cache: block device %s not found, its chunks "
+                    "are dropped",
+                    name_str);
+    }
+
+    sccd = blk ? layer_device(layer, blk) : NULL;
+
+    for (uint64_t i = 0; i < nb_chunks; i++) {
+        uint64_t blk_offset;
+        const uint8_t* data;
+
+        if (!get_u64(c, &blk_offset) ||
+            !(data = get_bytes(c, layer->chunk_size))) {
+            return false;
+        }
+
+        if (sccd) {
+            uint8_t* chunk = layer_device_chunk(sccd, blk_offset);
+
+            if (!chunk) {
+                chunk = layer_device_new_chunk(sccd, blk_offset);
+            }
+            memcpy(chunk, data, layer->chunk_size);
+        }
+    }
+
+    return true;
+}
+
+bool syx_cow_cache_load_lower_layers(SyxCowCache* scc, const uint8_t* buf,
+                                     size_t size)
+{
+    struct cursor c = {.p = buf, .end = buf + size};
+    SyxCowCacheLayer* highest_layer = QTAILQ_FIRST(&scc->layers);
+    uint64_t nb_layers;
+
+    if (!get_u64(&c, &nb_layers)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < nb_layers; i++) {
+        SyxCowCacheLayer* layer;
+        uint64_t chunk_size, max_nb_chunks, nb_devices;
+
+        if (!get_u64(&c, &chunk_size) || !get_u64(&c, &max_nb_chunks) ||
+            !get_u64(&c, &nb_devices)) {
+            return false;
+        }
+
+        if (!IS_POWER_OF_TWO(chunk_size) ||
+            (highest_layer && highest_layer->chunk_size != chunk_size)) {
+            return false;
+        }
+
+        layer = g_new0(SyxCowCacheLayer, 1);
+        layer->cow_cache_devices =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
+        layer->chunk_size = chunk_size;
+        layer->max_nb_chunks = max_nb_chunks;
+
+        // Not visible to the requests until inserted.
+        for (uint64_t j = 0; j < nb_devices; j++) {
+            if (!load_device(layer, &c)) {
+                g_hash_table_foreach(layer->cow_cache_devices,
+                                     free_device_layer, NULL);
+                g_hash_table_destroy(layer->cow_cache_devices);
+                g_free(layer);
+                return false;
+            }
+        }
+
+        WITH_QEMU_LOCK_GUARD(&scc->lock)
+        {
+            QTAILQ_INSERT_TAIL(&scc->layers, layer, next);
+        }
+    }
+
+    return c.p == c.end;
 }
@@ -0,0 +1,185 @@
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/xxhash.h"
+
+#include "libafl/syx-snapshot/syx-page-store.h"
+
+struct SyxPage {
+    uint64_t hash;
+    uint64_t refcount;
+    // Right after the page for stored pages.
+    const uint8_t* data;
+};
+
+typedef struct SyxPageStore {
+    uint64_t page_size;
+    GHashTable* pages; // set of SyxPage, keyed by content
+    SyxPageStoreStats stats;
+} SyxPageStore;
+
+static SyxPageStore syx_page_store;
+
+// XXH64 without the tail, pages are a multiple of 32 bytes.
+static uint64_t syx_page_hash(const void* data)
+{
+    const uint64_t* p = data;
+    const uint64_t* end = p + syx_page_store.page_size / sizeof(uint64_t);
+    uint64_t v1 = QEMU_XXHASH_SEED + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = QEMU_XXHASH_SEED + XXH_PRIME64_2;
+    uint64_t v3 = QEMU_XXHASH_SEED + 0;
+    uint64_t v4 = QEMU_XXHASH_SEED - XXH_PRIME64_1;
+
+    for (; p < end; p += 4) {
+        v1 = XXH64_round(v1, p[0]);
+        v2 = XXH64_round(v2, p[1]);
+        v3 = XXH64_round(v3, p[2]);
+        v4 = XXH64_round(v4, p[3]);
+    }
+
+    return XXH64_avalanche(XXH64_mergerounds(v1, v2, v3, v4) +
+                           syx_page_store.page_size);
+}
+
+static guint syx_page_hash_func(gconstpointer page)
+{
+    return (guint)((const SyxPage*)page)->hash;
+}
+
+static gboolean syx_page_equal_func(gconstpointer a, gconstpointer b)
+{
+    const SyxPage* pa = a;
+    const SyxPage* pb = b;
+
+    return pa->hash == pb->hash &&
+           memcmp(pa->data, pb->data, syx_page_store.page_size) == 0;
+}
+
+void syx_page_store_init(uint64_t page_size)
+{
+    assert(page_size % (4 * sizeof(uint64_t)) == 0);
+
+    syx_page_store.page_size = page_size;
+    syx_page_store.pages =
+        g_hash_table_new(syx_page_hash_func, syx_page_equal_func);
+}
+
+static SyxPage* syx_page_new(const void* data, uint64_t hash)
+{
+    SyxPage* page = g_malloc(sizeof(SyxPage) + syx_page_store.page_size);
+
+    page->hash = hash;
+    page->refcount = 0;
+    page->data = (const uint8_t*)(page + 1);
+    memcpy(page + 1, data, syx_page_store.page_size);
+
+    return page;
+}
+
+SyxPage* syx_page_store_get(const void* data)
+{
+    SyxPage probe;
+    SyxPage* page;
+
+    if (buffer_is_zero(data, syx_page_store.page_size)) {
+        syx_page_store.stats.nb_zero_refs++;
+        return NULL;
+    }
+
+    probe.hash = syx_page_hash(data);
+    probe.data = data;
+
+    page = g_hash_table_lookup(syx_page_store.pages, &probe);
+    if (!page) {
+        page = syx_page_new(data, probe.hash);
+        g_hash_table_add(syx_page_store.pages, page);
+        syx_page_store.stats.nb_pages++;
+    }
+
+    return syx_page_store_ref(page);
+}
+
+SyxPage* syx_page_store_prepare(const void* data)
+{
+    if (buffer_is_zero(data, syx_page_store.page_size)) {
+        return NULL;
+    }
+
+    return syx_page_new(data, syx_page_hash(data));
+}
+
+SyxPage* syx_page_store_add(SyxPage* prepared)
+{
+    SyxPage* page;
+
+    if (!prepared) {
+        return syx_page_store_ref(NULL);
+    }
+
+    page = g_hash_table_lookup(syx_page_store.pages, prepared);
+    if (page) {
+        g_free(prepared);
+    } else {
+        page = prepared;
+        g_hash_table_add(syx_page_store.pages, page);
+        syx_page_store.stats.nb_pages++;
+    }
+
+    return syx_page_store_ref(page);
+}
+
+SyxPage* syx_page_store_ref(SyxPage* page)
+{
+    if (page) {
+        page->refcount++;
+        syx_page_store.stats.nb_refs++;
+    } else {
+        syx_page_store.stats.nb_zero_refs++;
+    }
+
+    return page;
+}
+
+void syx_page_store_put(SyxPage* page)
+{
+    if (!page) {
+        syx_page_store.stats.nb_zero_refs--;
+        return;
+    }
+
+    assert(page->refcount > 0);
+    syx_page_store.stats.nb_refs--;
+
+    if (--page->refcount == 0) {
+        g_hash_table_remove(syx_page_store.pages, page);
+        syx_page_store.stats.nb_pages--;
+        g_free(page);
+    }
+}
+
+void syx_page_store_restore(void* dst, SyxPage* page)
+{
+    if (page) {
+        memcpy(dst, page->data, syx_page_store.page_size);
+    } else {
+        memset(dst, 0, syx_page_store.page_size);
+    }
+}
+
+const void* syx_page_store_data(SyxPage* page)
+{
+    return page ? page->data : NULL;
+}
+
+int syx_page_store_cmp(SyxPage* page, const void* data)
+{
+    if (!page) {
+        return !buffer_is_zero(data, syx_page_store.page_size);
+    }
+
+    return memcmp(page->data, data, syx_page_store.page_size);
+}
+
+SyxPageStoreStats syx_page_store_stats(void)
+{
+    return syx_page_store.stats;
+}
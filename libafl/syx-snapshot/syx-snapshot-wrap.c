@@ -1,16 +1,14 @@
 #include "qemu/osdep.h"
 #include "libafl/syx-snapshot/syx-snapshot.h"
 
-bool syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
+bool syx_snapshot_cow_cache_enabled(void) { return false; }
+
+void syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
                                        int64_t bytes, QEMUIOVector* qiov,
-                                       size_t qiov_offset,
-                                       BdrvRequestFlags flags) {
-    return false;
-}
+                                       size_t qiov_offset) {}
 
-bool syx_snapshot_cow_cache_write_entry(BlockBackend* blk, int64_t offset,
-                                        int64_t bytes, QEMUIOVector* qiov,
-                                        size_t qiov_offset,
-                                        BdrvRequestFlags flags) {
-    return false;
-}
\ No newline at end of file
+int coroutine_fn syx_snapshot_cow_cache_write_entry(
+    BlockBackend* blk, BdrvChild* backing, int64_t offset, int64_t bytes,
+    QEMUIOVector* qiov, size_t qiov_offset, BdrvRequestFlags flags) {
+    return -ENOTSUP;
+}
@@ -1,5 +1,7 @@
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
 
 #include "cpu.h"
 
@@ -9,18 +11,21 @@
 
 #include "libafl/syx-snapshot/syx-snapshot.h"
 #include "libafl/syx-snapshot/device-save.h"
+#include "libafl/syx-snapshot/channel-buffer-writeback.h"
 #include "libafl/syx-misc.h"
+#include "libafl/hooks/tcg/call.h"
 
 #define SYX_SNAPSHOT_LIST_INIT_SIZE 4096
 #define SYX_SNAPSHOT_LIST_GROW_FACTOR 2
-#define TARGET_NEXT_PAGE_ADDR(p)                                               \
-    ((typeof(p))(((uintptr_t)p + TARGET_PAGE_SIZE) & TARGET_PAGE_MASK))
+
+// RAM handled by one task of the thread pool.
+#define SYX_SNAPSHOT_WORK_SIZE (16 * MiB)
 
 /**
  * Saved ramblock
  */
 typedef struct SyxSnapshotRAMBlock {
-    uint8_t* ram;         // RAM block
+    SyxPage** pages;      // Pages of the RAM block, in the page store
     uint64_t used_length; // Length of the ram block
 } SyxSnapshotRAMBlock;
 
@@ -37,7 +42,7 @@ typedef struct SyxSnapshotRoot {
  */
 typedef struct SyxSnapshotDirtyPage {
     ram_addr_t offset_within_rb;
-    uint8_t* data;
+    SyxPage* page; // in the page store
 } SyxSnapshotDirtyPage;
 
 typedef struct SyxSnapshotDirtyPageList {
@@ -90,9 +95,6 @@ static void root_restore_rb(gpointer rb_idstr_hash,
                             gpointer rb_dirty_pages_hash_table_ptr,
                             gpointer snapshot_ptr);
 
-static void root_restore_check_memory_rb(gpointer rb_idstr_hash,
-                                         gpointer rb_dirty_pages_hash_table_ptr,
-                                         gpointer snapshot_ptr);
 
 static SyxSnapshotIncrement*
 syx_snapshot_increment_free(SyxSnapshotIncrement* increment);
@@ -138,9 +140,27 @@ struct rb_page_increment_restore_args {
     SyxSnapshotIncrement* increment;
 };
 
-struct rb_check_memory_args {
-    SyxSnapshot* snapshot;          // IN
-    uint64_t nb_inconsistent_pages; // OUT
+typedef struct SyxSnapshotDoneQueue SyxSnapshotDoneQueue;
+
+// A range of pages of a RAMBlock, handled by one task of the thread pool.
+typedef struct SyxSnapshotWork {
+    RAMBlock* rb;
+    SyxSnapshotRAMBlock* snapshot_rb;
+    ram_addr_t offset;
+    uint64_t len;
+
+    // Check only, SyxSnapshotInconsistentRange.
+    GArray* inconsistent_ranges;
+
+    // See syx_snapshot_run_works_bounded.
+    SyxSnapshotDoneQueue* done;
+} SyxSnapshotWork;
+
+// Works done by the thread pool, not finished by the main thread yet.
+struct SyxSnapshotDoneQueue {
+    QemuMutex lock;
+    QemuCond cond;
+    GQueue works;
 };
 
 void syx_snapshot_init(bool cached_bdrvs)
@@ -152,6 +172,13 @@ void syx_snapshot_init(bool cached_bdrvs)
 
     syx_snapshot_state.tracked_snapshots = syx_snapshot_tracker_init();
 
+    syx_page_store_init(page_size);
+
+    syx_snapshot_state.nb_workers = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    syx_snapshot_state.workers = thread_pool_new();
+    thread_pool_set_max_threads(syx_snapshot_state.workers,
+                                syx_snapshot_state.nb_workers);
+
     if (cached_bdrvs) {
         syx_snapshot_state.before_fuzz_cache = syx_cow_cache_new();
         syx_cow_cache_push_layer(syx_snapshot_state.before_fuzz_cache,
@@ -175,13 +202,21 @@ SyxSnapshot* syx_snapshot_new(bool track, bool is_active_bdrv_cache,
     snapshot->bdrvs_cow_cache = syx_cow_cache_new();
 
     if (is_active_bdrv_cache) {
+        // Iothreads may be accessing the cache being replaced.
+        bdrv_drain_all_begin();
         syx_cow_cache_move(snapshot->bdrvs_cow_cache,
                            &syx_snapshot_state.before_fuzz_cache);
         syx_snapshot_state.active_bdrv_cache_snapshot = snapshot;
-    } else {
-        syx_cow_cache_push_layer(snapshot->bdrvs_cow_cache,
-                                 SYX_SNAPSHOT_COW_CACHE_DEFAULT_CHUNK_SIZE,
-                                 SYX_SNAPSHOT_COW_CACHE_DEFAULT_MAX_BLOCKS);
+    }
+
+    // The writes done before the snapshot stay in the lower layer: restoring
+    // the snapshot only flushes this one.
+    syx_cow_cache_push_layer(snapshot->bdrvs_cow_cache,
+                             SYX_SNAPSHOT_COW_CACHE_DEFAULT_CHUNK_SIZE,
+                             SYX_SNAPSHOT_COW_CACHE_DEFAULT_MAX_BLOCKS);
+
+    if (is_active_bdrv_cache) {
+        bdrv_drain_all_end();
     }
 
     if (track) {
@@ -211,11 +246,125 @@ void syx_snapshot_free(SyxSnapshot* snapshot)
 static void destroy_ramblock_snapshot(gpointer root_snapshot)
 {
     SyxSnapshotRAMBlock* snapshot_rb = root_snapshot;
+    uint64_t nb_pages = snapshot_rb->used_length / syx_snapshot_state.page_size;
 
-    g_free(snapshot_rb->ram);
+    for (uint64_t i = 0; i < nb_pages; i++) {
+        syx_page_store_put(snapshot_rb->pages[i]);
+    }
+    g_free(snapshot_rb->pages);
     g_free(snapshot_rb);
 }
 
+static void syx_snapshot_add_works(GArray* works, RAMBlock* rb,
+                                   SyxSnapshotRAMBlock* snapshot_rb)
+{
+    for (ram_addr_t offset = 0; offset < snapshot_rb->used_length;
+         offset += SYX_SNAPSHOT_WORK_SIZE) {
+        SyxSnapshotWork work = {
+            .rb = rb,
+            .snapshot_rb = snapshot_rb,
+            .offset = offset,
+            .len = MIN((uint64_t)SYX_SNAPSHOT_WORK_SIZE,
+                       snapshot_rb->used_length - offset),
+        };
+
+        g_array_append_val(works, work);
+    }
+}
+
+static void syx_snapshot_run_works(GArray* works, ThreadPoolFunc* func)
+{
+    for (guint i = 0; i < works->len; i++) {
+        thread_pool_submit(syx_snapshot_state.workers, func,
+                           &g_array_index(works, SyxSnapshotWork, i), NULL);
+    }
+
+    thread_pool_wait(syx_snapshot_state.workers);
+}
+
+// Called by the work functions of syx_snapshot_run_works_bounded when they
+// are done with work.
+static void syx_snapshot_work_done(SyxSnapshotWork* work)
+{
+    SyxSnapshotDoneQueue* done = work->done;
+
+    qemu_mutex_lock(&done->lock);
+    g_queue_push_tail(&done->works, work);
+    qemu_cond_signal(&done->cond);
+    qemu_mutex_unlock(&done->lock);
+}
+
+// Like syx_snapshot_run_works, and calls finish from this thread on each work
+// once func is done with it. No more works than worker threads are submitted
+// and not finished at any time, to bound what they allocate for finish.
+static void syx_snapshot_run_works_bounded(GArray* works, ThreadPoolFunc* func,
+                                           void (*finish)(SyxSnapshotWork*))
+{
+    SyxSnapshotDoneQueue done;
+    guint submitted = 0;
+    guint finished = 0;
+
+    qemu_mutex_init(&done.lock);
+    qemu_cond_init(&done.cond);
+    g_queue_init(&done.works);
+
+    while (finished < works->len) {
+        SyxSnapshotWork* work;
+
+        while (submitted < works->len &&
+               submitted - finished < syx_snapshot_state.nb_workers) {
+            work = &g_array_index(works, SyxSnapshotWork, submitted++);
+            work->done = &done;
+            thread_pool_submit(syx_snapshot_state.workers, func, work, NULL);
+        }
+
+        qemu_mutex_lock(&done.lock);
+        while (g_queue_is_empty(&done.works)) {
+            qemu_cond_wait(&done.cond, &done.lock);
+        }
+        work = g_queue_pop_head(&done.works);
+        qemu_mutex_unlock(&done.lock);
+
+        finish(work);
+        finished++;
+    }
+
+    // The workers may still be returning from syx_snapshot_work_done.
+    thread_pool_wait(syx_snapshot_state.workers);
+
+    qemu_cond_destroy(&done.cond);
+    qemu_mutex_destroy(&done.lock);
+}
+
+// Runs in the thread pool, root_new_finish adds the pages to the store.
+static int root_new_work(void* opaque)
+{
+    SyxSnapshotWork* work = opaque;
+
+    for (ram_addr_t offset = work->offset; offset < work->offset + work->len;
+         offset += syx_snapshot_state.page_size) {
+        work->snapshot_rb->pages[offset / syx_snapshot_state.page_size] =
+            syx_page_store_prepare(work->rb->host + offset);
+    }
+
+    syx_snapshot_work_done(work);
+    return 0;
+}
+
+// Frees the copies of the pages already in the store as soon as possible, so
+// that they do not pile up for the whole RAM.
+static void root_new_finish(SyxSnapshotWork* work)
+{
+    SyxPage** pages = work->snapshot_rb->pages;
+
+    for (ram_addr_t offset = work->offset; offset < work->offset + work->len;
+         offset += syx_snapshot_state.page_size) {
+        uint64_t i = offset / syx_snapshot_state.page_size;
+
+        pages[i] = syx_page_store_add(pages[i]);
+    }
+}
+
 static SyxSnapshotRoot* syx_snapshot_root_new(DeviceSnapshotKind kind,
                                               char** devices)
 {
@@ -224,6 +373,7 @@ static SyxSnapshotRoot* syx_snapshot_root_new(DeviceSnapshotKind kind,
     RAMBlock* block;
     RAMBlock* inner_block;
     DeviceSaveState* dss = device_save_kind(kind, devices);
+    g_autoptr(GArray) works = g_array_new(false, false, sizeof(SyxSnapshotWork));
 
     root->rbs_snapshot = g_hash_table_new_full(g_direct_hash, g_direct_equal,
                                                NULL, destroy_ramblock_snapshot);
@@ -242,15 +392,19 @@ static SyxSnapshotRoot* syx_snapshot_root_new(DeviceSnapshotKind kind,
             }
         }
 
+        uint64_t nb_pages = block->used_length / syx_snapshot_state.page_size;
         SyxSnapshotRAMBlock* snapshot_rb = g_new(SyxSnapshotRAMBlock, 1);
         snapshot_rb->used_length = block->used_length;
-        snapshot_rb->ram = g_new(uint8_t, block->used_length);
-        memcpy(snapshot_rb->ram, block->host, block->used_length);
+        snapshot_rb->pages = g_new(SyxPage*, nb_pages);
+        syx_snapshot_add_works(works, block, snapshot_rb);
 
         g_hash_table_insert(root->rbs_snapshot,
                             GINT_TO_POINTER(block->idstr_hash), snapshot_rb);
     }
 
+    // Pages are hashed and copied in parallel, and added to the store here.
+    syx_snapshot_run_works_bounded(works, root_new_work, root_new_finish);
+
     return root;
 }
 
@@ -311,9 +465,8 @@ static void rb_save_dirty_addr_to_table(gpointer offset_within_rb,
     SyxSnapshotDirtyPage* dirty_page =
         &args->dirty_page_list->dirty_pages[*args->table_idx];
     dirty_page->offset_within_rb = (ram_addr_t)offset_within_rb;
-
-    memcpy((gpointer)dirty_page->data, rb->host + (ram_addr_t)offset_within_rb,
-           syx_snapshot_state.page_size);
+    dirty_page->page =
+        syx_page_store_get(rb->host + (ram_addr_t)offset_within_rb);
 
     *args->table_idx += 1;
 }
@@ -339,10 +492,12 @@ static void rb_dirty_list_to_dirty_pages(gpointer rb_idstr_hash,
         struct rb_dirty_list_to_page_args dirty_list_to_page_args = {
             .rb = rb, .table_idx = ctr, .dirty_page_list = dirty_page_list};
 
-        g_hash_table_foreach(rbs_dirty_pages, rb_save_dirty_addr_to_table,
+        g_hash_table_foreach(rb_dirty_list, rb_save_dirty_addr_to_table,
                              &dirty_list_to_page_args);
 
         g_free(dirty_list_to_page_args.table_idx);
+
+        g_hash_table_insert(rbs_dirty_pages, rb_idstr_hash, dirty_page_list);
     } else {
         SYX_ERROR("Impossible to find RAMBlock with pages marked as dirty.");
     }
@@ -355,7 +510,7 @@ destroy_snapshot_dirty_page_list(gpointer snapshot_dirty_page_list_ptr)
         snapshot_dirty_page_list_ptr;
 
     for (uint64_t i = 0; i < snapshot_dirty_page_list->length; ++i) {
-        g_free(snapshot_dirty_page_list->dirty_pages[i].data);
+        syx_page_store_put(snapshot_dirty_page_list->dirty_pages[i].page);
     }
 
     g_free(snapshot_dirty_page_list->dirty_pages);
@@ -414,14 +569,16 @@ static void restore_dirty_page_to_increment(gpointer offset_within_rb,
         get_dirty_page_from_addr_rec(increment, rb, offset);
 
     if (dp) {
-        memcpy(rb->host + offset, dp->data, syx_snapshot_state.page_size);
+        syx_page_store_restore(rb->host + offset, dp->page);
     } else {
         SyxSnapshotRAMBlock* rrb =
             g_hash_table_lookup(snapshot->root_snapshot->rbs_snapshot,
                                 GINT_TO_POINTER(rb->idstr_hash));
         assert(rrb);
 
-        memcpy(rb->host + offset, rrb->ram, syx_snapshot_state.page_size);
+        syx_page_store_restore(
+            rb->host + offset,
+            rrb->pages[offset / syx_snapshot_state.page_size]);
     }
 }
 
@@ -570,29 +727,34 @@ void syx_snapshot_dirty_list_add_hostaddr(void* host_addr)
 void syx_snapshot_dirty_list_add_hostaddr_range(void* host_addr, uint64_t len)
 {
     // early check to know whether we should log the page access or not
-    if (!syx_snapshot_is_enabled()) {
+    if (!syx_snapshot_is_enabled() || len == 0) {
         return;
     }
 
-    assert(len < INT64_MAX);
-    int64_t len_signed = (int64_t)len;
+    ram_addr_t offset;
+    RAMBlock* rb = qemu_ram_block_from_host(host_addr, false, &offset);
+
+    if (!rb) {
+        return;
+    }
 
-    syx_snapshot_dirty_list_add_hostaddr(
-        QEMU_ALIGN_PTR_DOWN(host_addr, syx_snapshot_state.page_size));
-    void* next_page_addr = TARGET_NEXT_PAGE_ADDR(host_addr);
-    assert(next_page_addr > host_addr);
-    assert(QEMU_PTR_IS_ALIGNED(next_page_addr, TARGET_PAGE_SIZE));
+    syx_snapshot_dirty_list_add_ramblock_range(rb, offset, len);
+}
 
-    int64_t len_to_next_page = next_page_addr - host_addr;
+void syx_snapshot_dirty_list_add_ramblock_range(RAMBlock* rb,
+                                                ram_addr_t offset, uint64_t len)
+{
+    if (!syx_snapshot_is_enabled() || len == 0) {
+        return;
+    }
 
-    host_addr += len_to_next_page;
-    len_signed -= len_to_next_page;
+    assert(offset + len <= rb->used_length);
 
-    while (len_signed > 0) {
-        assert(QEMU_PTR_IS_ALIGNED(host_addr, TARGET_PAGE_SIZE));
+    ram_addr_t page = offset & syx_snapshot_state.page_mask;
+    ram_addr_t end = offset + len;
 
-        syx_snapshot_dirty_list_add_hostaddr(host_addr);
-        len_signed -= TARGET_PAGE_SIZE;
+    for (; page < end; page += syx_snapshot_state.page_size) {
+        syx_snapshot_dirty_list_add_internal(rb, page);
     }
 }
 
@@ -613,16 +775,16 @@ static void root_restore_rb_page(gpointer offset_within_rb, gpointer _unused,
 
     // safe cast because ram_addr_t is also an alias to void*
     void* host_rb_restore = rb->host + (ram_addr_t)offset_within_rb;
-    void* host_snapshot_rb_restore =
-        (gpointer)snapshot_rb->ram + (ram_addr_t)offset_within_rb;
+    SyxPage* snapshot_page =
+        snapshot_rb->pages[(ram_addr_t)offset_within_rb /
+                           syx_snapshot_state.page_size];
 
 #ifdef SYX_SNAPSHOT_DEBUG
     SYX_PRINTF("\t[%s] Restore at offset 0x%lx of size %lu...\n", rb->idstr,
                (uint64_t)offset_within_rb, syx_snapshot_state.page_size);
 #endif
 
-    memcpy(host_rb_restore, host_snapshot_rb_restore,
-           syx_snapshot_state.page_size);
+    syx_page_store_restore(host_rb_restore, snapshot_page);
     // TODO: manage special case of TSEG.
 }
 
@@ -649,66 +811,113 @@ static void root_restore_rb(gpointer rb_idstr_hash,
     }
 }
 
-static void root_restore_check_memory_rb(gpointer rb_idstr_hash,
-                                         gpointer rb_dirty_pages_hash_table_ptr,
-                                         gpointer check_memory_args_ptr)
+// Runs in the thread pool.
+static int check_memory_work(void* opaque)
 {
-    struct rb_check_memory_args* args = check_memory_args_ptr;
-    SyxSnapshot* snapshot = args->snapshot;
-    RAMBlock* rb = ramblock_lookup(rb_idstr_hash);
+    SyxSnapshotWork* work = opaque;
+    SyxSnapshotInconsistentRange* last = NULL;
 
-    if (rb) {
-        SYX_PRINTF("Checking memory consistency of %s... ", rb->idstr);
-        SyxSnapshotRAMBlock* rb_snapshot = g_hash_table_lookup(
-            snapshot->root_snapshot->rbs_snapshot, rb_idstr_hash);
-        assert(rb_snapshot);
-
-        assert(rb->used_length == rb_snapshot->used_length);
-
-        for (uint64_t i = 0; i < rb->used_length;
-             i += syx_snapshot_state.page_size) {
-            if (memcmp(rb->host + i, rb_snapshot->ram + i,
-                       syx_snapshot_state.page_size) != 0) {
-                SYX_ERROR("\nFound incorrect page at offset 0x%lx\n", i);
-                for (uint64_t j = 0; j < syx_snapshot_state.page_size; j++) {
-                    if (*(rb->host + i + j) != *(rb_snapshot->ram + i + j)) {
-                        SYX_ERROR("\t- byte at address 0x%lx differs\n", i + j);
-                    }
-                }
-                args->nb_inconsistent_pages++;
-            }
+    work->inconsistent_ranges =
+        g_array_new(false, false, sizeof(SyxSnapshotInconsistentRange));
+
+    for (ram_addr_t offset = work->offset; offset < work->offset + work->len;
+         offset += syx_snapshot_state.page_size) {
+        SyxPage* page =
+            work->snapshot_rb->pages[offset / syx_snapshot_state.page_size];
+
+        if (!syx_page_store_cmp(page, work->rb->host + offset)) {
+            continue;
         }
 
-        if (args->nb_inconsistent_pages > 0) {
-            SYX_ERROR("[%s] Found %lu page %s.\n", rb->idstr,
-                      args->nb_inconsistent_pages,
-                      args->nb_inconsistent_pages > 1 ? "inconsistencies"
-                                                      : "inconsistency");
+        if (last && last->offset + last->len == offset) {
+            last->len += syx_snapshot_state.page_size;
         } else {
-            SYX_PRINTF("OK.\n");
+            SyxSnapshotInconsistentRange range = {
+                .rb = work->rb,
+                .offset = offset,
+                .len = syx_snapshot_state.page_size,
+            };
+
+            g_array_append_val(work->inconsistent_ranges, range);
+            last = &g_array_index(work->inconsistent_ranges,
+                                  SyxSnapshotInconsistentRange,
+                                  work->inconsistent_ranges->len - 1);
         }
-    } else {
-        SYX_ERROR("RB not found...\n");
-        exit(1);
     }
+
+    return 0;
 }
 
 SyxSnapshotCheckResult syx_snapshot_check(SyxSnapshot* ref_snapshot)
 {
-    struct rb_check_memory_args args = {
-        .snapshot = ref_snapshot,
-        .nb_inconsistent_pages = 0,
-    };
+    g_autoptr(GArray) works = g_array_new(false, false, sizeof(SyxSnapshotWork));
+    GArray* ranges =
+        g_array_new(false, false, sizeof(SyxSnapshotInconsistentRange));
+    SyxSnapshotInconsistentRange* last = NULL;
+    SyxSnapshotCheckResult res = {0};
+    GHashTableIter iter;
+    gpointer rb_idstr_hash, value;
+
+    g_hash_table_iter_init(&iter, ref_snapshot->root_snapshot->rbs_snapshot);
+    while (g_hash_table_iter_next(&iter, &rb_idstr_hash, &value)) {
+        SyxSnapshotRAMBlock* snapshot_rb = value;
+        RAMBlock* rb = ramblock_lookup(rb_idstr_hash);
+
+        if (!rb) {
+            SYX_ERROR("Saved RAMBlock not found.");
+            exit(1);
+        }
+
+        assert(rb->used_length == snapshot_rb->used_length);
+        syx_snapshot_add_works(works, rb, snapshot_rb);
+    }
+
+    syx_snapshot_run_works(works, check_memory_work);
+
+    // Works of a RAMBlock are contiguous and in order, ranges spanning
+    // several works are merged back.
+    for (guint i = 0; i < works->len; i++) {
+        SyxSnapshotWork* work = &g_array_index(works, SyxSnapshotWork, i);
+
+        for (guint j = 0; j < work->inconsistent_ranges->len; j++) {
+            SyxSnapshotInconsistentRange* range =
+                &g_array_index(work->inconsistent_ranges,
+                               SyxSnapshotInconsistentRange, j);
 
-    g_hash_table_foreach(ref_snapshot->rbs_dirty_list,
-                         root_restore_check_memory_rb, &args);
+            res.nb_inconsistencies += range->len / syx_snapshot_state.page_size;
 
-    struct SyxSnapshotCheckResult res = {.nb_inconsistencies =
-                                             args.nb_inconsistent_pages};
+            if (last && last->rb == range->rb &&
+                last->offset + last->len == range->offset) {
+                last->len += range->len;
+            } else {
+                g_array_append_val(ranges, *range);
+                last = &g_array_index(ranges, SyxSnapshotInconsistentRange,
+                                      ranges->len - 1);
+            }
+        }
+
+        g_array_free(work->inconsistent_ranges, true);
+    }
+
+    if (res.nb_inconsistencies > 0) {
+        SYX_ERROR("Found %" PRIu64 " inconsistent pages in %u ranges.",
+                  res.nb_inconsistencies, ranges->len);
+    }
+
+    res.nb_inconsistent_ranges = ranges->len;
+    res.inconsistent_ranges = (SyxSnapshotInconsistentRange*)g_array_free(
+        ranges, ranges->len == 0);
 
     return res;
 }
 
+void syx_snapshot_check_result_free(SyxSnapshotCheckResult* res)
+{
+    g_free(res->inconsistent_ranges);
+    res->inconsistent_ranges = NULL;
+    res->nb_inconsistent_ranges = 0;
+}
+
 void syx_snapshot_root_restore(SyxSnapshot* snapshot)
 {
     // health check.
@@ -737,50 +946,641 @@ void syx_snapshot_root_restore(SyxSnapshot* snapshot)
 
     syx_snapshot_dirty_list_flush(snapshot);
 
+    libafl_call_ctx_reset_all();
+
     if (must_unlock_bql) {
         bql_unlock();
     }
 }
 
-bool syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
+// Before the first snapshot, writes go to the cache of the initial state.
+static SyxCowCache* syx_snapshot_cow_cache(void)
+{
+    if (syx_snapshot_state.active_bdrv_cache_snapshot) {
+        return syx_snapshot_state.active_bdrv_cache_snapshot->bdrvs_cow_cache;
+    }
+
+    return syx_snapshot_state.before_fuzz_cache;
+}
+
+bool syx_snapshot_cow_cache_enabled(void)
+{
+    return syx_snapshot_cow_cache() != NULL;
+}
+
+void syx_snapshot_cow_cache_read_entry(BlockBackend* blk, int64_t offset,
                                        int64_t bytes, QEMUIOVector* qiov,
-                                       size_t qiov_offset,
-                                       BdrvRequestFlags flags)
+                                       size_t qiov_offset)
+{
+    SyxCowCache* scc = syx_snapshot_cow_cache();
+
+    if (scc) {
+        syx_cow_cache_read_entry(scc, blk, offset, bytes, qiov, qiov_offset);
+    }
+}
+
+int coroutine_fn syx_snapshot_cow_cache_write_entry(
+    BlockBackend* blk, BdrvChild* backing, int64_t offset, int64_t bytes,
+    QEMUIOVector* qiov, size_t qiov_offset, BdrvRequestFlags flags)
 {
-    if (!syx_snapshot_state.active_bdrv_cache_snapshot) {
-        if (syx_snapshot_state.before_fuzz_cache) {
-            syx_cow_cache_read_entry(syx_snapshot_state.before_fuzz_cache, blk,
+    return syx_cow_cache_write_entry(syx_snapshot_cow_cache(), blk, backing,
                                      offset, bytes, qiov, qiov_offset, flags);
-            return true;
+}
+
+//
+// Export / import
+//
+// File layout, in host byte order:
+//   magic, version, page size
+//   root: device state, RAM blocks (idstr, used length, pages)
+//   increments, oldest first: device state, RAM blocks (idstr, dirty pages)
+//   block devices: lower layers of the COW cache
+//
+// A page is written as an id: 0 for the zero page, a new id followed by the
+// content the first time a page is written, the same id afterwards. Pages
+// shared by the root and the increments, or within the RAM, are written once.
+//
+
+#define SYX_SNAPSHOT_FILE_MAGIC 0x31504e5358595300ULL // "\0SYXSNP1"
+#define SYX_SNAPSHOT_FILE_VERSION 1
+
+typedef struct SyxSnapshotExportItem {
+    // Bytes of metadata to write before the page.
+    uint64_t meta_len;
+    SyxPage* page;
+    bool has_page;
+} SyxSnapshotExportItem;
+
+struct SyxSnapshotExport {
+    QemuThread thread;
+    char* path;
+
+    // Built when the export starts, with a reference to each page written.
+    GByteArray* meta;
+    GArray* items; // SyxSnapshotExportItem
+    uint64_t meta_len_in_items;
+
+    bool done;
+    bool ok;
+};
+
+static void export_put_bytes(SyxSnapshotExport* ex, const void* data,
+                             size_t len)
+{
+    g_byte_array_append(ex->meta, data, len);
+}
+
+static void export_put_u64(SyxSnapshotExport* ex, uint64_t v)
+{
+    export_put_bytes(ex, &v, sizeof(v));
+}
+
+static void export_put_str(SyxSnapshotExport* ex, const char* str)
+{
+    export_put_u64(ex, strlen(str));
+    export_put_bytes(ex, str, strlen(str));
+}
+
+static void export_put_item(SyxSnapshotExport* ex, SyxPage* page,
+                            bool has_page)
+{
+    SyxSnapshotExportItem item = {
+        .meta_len = ex->meta->len - ex->meta_len_in_items,
+        .page = has_page ? syx_page_store_ref(page) : NULL,
+        .has_page = has_page,
+    };
+
+    ex->meta_len_in_items = ex->meta->len;
+    g_array_append_val(ex->items, item);
+}
+
+static void export_put_page(SyxSnapshotExport* ex, SyxPage* page)
+{
+    export_put_item(ex, page, true);
+}
+
+static void export_put_dss(SyxSnapshotExport* ex, DeviceSaveState* dss)
+{
+    export_put_u64(ex, dss->kind);
+    export_put_u64(ex, dss->save_buffer_size);
+    export_put_bytes(ex, dss->save_buffer, dss->save_buffer_size);
+}
+
+static void export_put_rb_idstr(SyxSnapshotExport* ex, gpointer rb_idstr_hash)
+{
+    RAMBlock* rb = ramblock_lookup(rb_idstr_hash);
+
+    assert(rb);
+    export_put_str(ex, rb->idstr);
+}
+
+static void export_root(SyxSnapshotExport* ex, SyxSnapshotRoot* root)
+{
+    GHashTableIter iter;
+    gpointer rb_idstr_hash, value;
+
+    export_put_dss(ex, root->dss);
+    export_put_u64(ex, g_hash_table_size(root->rbs_snapshot));
+
+    g_hash_table_iter_init(&iter, root->rbs_snapshot);
+    while (g_hash_table_iter_next(&iter, &rb_idstr_hash, &value)) {
+        SyxSnapshotRAMBlock* snapshot_rb = value;
+        uint64_t nb_pages =
+            snapshot_rb->used_length / syx_snapshot_state.page_size;
+
+        export_put_rb_idstr(ex, rb_idstr_hash);
+        export_put_u64(ex, snapshot_rb->used_length);
+        for (uint64_t i = 0; i < nb_pages; i++) {
+            export_put_page(ex, snapshot_rb->pages[i]);
+        }
+    }
+}
+
+static void export_increment(SyxSnapshotExport* ex,
+                             SyxSnapshotIncrement* increment)
+{
+    GHashTableIter iter;
+    gpointer rb_idstr_hash, value;
+
+    export_put_dss(ex, increment->dss);
+    export_put_u64(ex, g_hash_table_size(increment->rbs_dirty_pages));
+
+    g_hash_table_iter_init(&iter, increment->rbs_dirty_pages);
+    while (g_hash_table_iter_next(&iter, &rb_idstr_hash, &value)) {
+        SyxSnapshotDirtyPageList* dpl = value;
+
+        export_put_rb_idstr(ex, rb_idstr_hash);
+        export_put_u64(ex, dpl->length);
+        for (uint64_t i = 0; i < dpl->length; i++) {
+            export_put_u64(ex, dpl->dirty_pages[i].offset_within_rb);
+            export_put_page(ex, dpl->dirty_pages[i].page);
+        }
+    }
+}
+
+static void* syx_snapshot_export_thread(void* opaque)
+{
+    SyxSnapshotExport* ex = opaque;
+    g_autoptr(GHashTable) ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    const uint8_t* meta = ex->meta->data;
+    uint64_t next_id = 1;
+    bool ok = true;
+    FILE* f;
+
+    f = fopen(ex->path, "wb");
+    if (!f) {
+        SYX_ERROR("Could not open %s: %s", ex->path, strerror(errno));
+        qatomic_store_release(&ex->done, true);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    for (guint i = 0; ok && i < ex->items->len; i++) {
+        SyxSnapshotExportItem* item =
+            &g_array_index(ex->items, SyxSnapshotExportItem, i);
+        const void* data = syx_page_store_data(item->page);
+        uint64_t id = 0;
+        bool new_page = false;
+
+        ok = fwrite(meta, 1, item->meta_len, f) == item->meta_len;
+        meta += item->meta_len;
+
+        if (!ok || !item->has_page) {
+            continue;
+        }
+
+        if (data) {
+            id = GPOINTER_TO_SIZE(g_hash_table_lookup(ids, item->page));
+            if (!id) {
+                id = next_id++;
+                new_page = true;
+                g_hash_table_insert(ids, item->page, GSIZE_TO_POINTER(id));
+            }
+        }
+
+        ok = fwrite(&id, sizeof(id), 1, f) == 1;
+        if (ok && new_page) {
+            ok = fwrite(data, syx_snapshot_state.page_size, 1, f) == 1;
+        }
+    }
+
+    if (!ok) {
+        SYX_ERROR("Could not write %s: %s", ex->path, strerror(errno));
+    }
+
+    ok = fclose(f) == 0 && ok;
+
+    ex->ok = ok;
+    qatomic_store_release(&ex->done, true);
+    return NULL;
+}
+
+SyxSnapshotExport* syx_snapshot_export(SyxSnapshot* snapshot,
+                                       const char* path)
+{
+    SyxSnapshotExport* ex = g_new0(SyxSnapshotExport, 1);
+    g_autoptr(GPtrArray) increments = g_ptr_array_new();
+    g_autoptr(GByteArray) cow_cache = g_byte_array_new();
+
+    ex->path = g_strdup(path);
+    ex->meta = g_byte_array_new();
+    ex->items = g_array_new(false, false, sizeof(SyxSnapshotExportItem));
+
+    export_put_u64(ex, SYX_SNAPSHOT_FILE_MAGIC);
+    export_put_u64(ex, SYX_SNAPSHOT_FILE_VERSION);
+    export_put_u64(ex, syx_snapshot_state.page_size);
+
+    export_root(ex, snapshot->root_snapshot);
+
+    for (SyxSnapshotIncrement* increment = snapshot->last_incremental_snapshot;
+         increment; increment = increment->parent) {
+        g_ptr_array_add(increments, increment);
+    }
+    export_put_u64(ex, increments->len);
+    for (guint i = increments->len; i > 0; i--) {
+        export_increment(ex, g_ptr_array_index(increments, i - 1));
+    }
+
+    syx_cow_cache_save_lower_layers(snapshot->bdrvs_cow_cache, cow_cache);
+    export_put_u64(ex, cow_cache->len);
+    export_put_bytes(ex, cow_cache->data, cow_cache->len);
+
+    export_put_item(ex, NULL, false);
+
+    qemu_thread_create(&ex->thread, "syx-export", syx_snapshot_export_thread,
+                       ex, QEMU_THREAD_JOINABLE);
+
+    return ex;
+}
+
+bool syx_snapshot_export_done(SyxSnapshotExport* ex)
+{
+    return qatomic_load_acquire(&ex->done);
+}
+
+bool syx_snapshot_export_finish(SyxSnapshotExport* ex)
+{
+    bool ok;
+
+    qemu_thread_join(&ex->thread);
+
+    for (guint i = 0; i < ex->items->len; i++) {
+        SyxSnapshotExportItem* item =
+            &g_array_index(ex->items, SyxSnapshotExportItem, i);
+
+        if (item->has_page) {
+            syx_page_store_put(item->page);
         }
+    }
+
+    ok = ex->ok;
+    g_array_free(ex->items, true);
+    g_byte_array_free(ex->meta, true);
+    g_free(ex->path);
+    g_free(ex);
+
+    return ok;
+}
+
+typedef struct SyxSnapshotImport {
+    FILE* f;
+    // Page of each id, minus one. Holds a reference.
+    GPtrArray* pages;
+    uint8_t* page_buf;
+} SyxSnapshotImport;
 
+static bool import_bytes(SyxSnapshotImport* imp, void* buf, size_t len)
+{
+    return fread(buf, 1, len, imp->f) == len;
+}
+
+static bool import_u64(SyxSnapshotImport* imp, uint64_t* v)
+{
+    return import_bytes(imp, v, sizeof(*v));
+}
+
+// The page is borrowed from the import.
+static bool import_page(SyxSnapshotImport* imp, SyxPage** page)
+{
+    uint64_t id;
+
+    if (!import_u64(imp, &id)) {
         return false;
+    }
+
+    if (id == 0) {
+        *page = NULL;
+    } else if (id == imp->pages->len + 1) {
+        if (!import_bytes(imp, imp->page_buf, syx_snapshot_state.page_size)) {
+            return false;
+        }
+        *page = syx_page_store_get(imp->page_buf);
+        g_ptr_array_add(imp->pages, *page);
+    } else if (id <= imp->pages->len) {
+        *page = g_ptr_array_index(imp->pages, id - 1);
     } else {
-        syx_cow_cache_read_entry(
-            syx_snapshot_state.active_bdrv_cache_snapshot->bdrvs_cow_cache, blk,
-            offset, bytes, qiov, qiov_offset, flags);
-        return true;
+        return false;
+    }
+
+    return true;
+}
+
+static RAMBlock* import_rb(SyxSnapshotImport* imp)
+{
+    uint64_t len;
+    char idstr[sizeof(((RAMBlock*)NULL)->idstr)] = {0};
+    RAMBlock* rb;
+
+    if (!import_u64(imp, &len) || len >= sizeof(idstr) ||
+        !import_bytes(imp, idstr, len)) {
+        return NULL;
+    }
+
+    rb = qemu_ram_block_by_name(idstr);
+    if (!rb) {
+        SYX_ERROR("RAMBlock %s of the snapshot not found", idstr);
+    }
+
+    return rb;
+}
+
+static DeviceSaveState* import_dss(SyxSnapshotImport* imp)
+{
+    DeviceSaveState* dss;
+    uint64_t kind, size;
+
+    if (!import_u64(imp, &kind) || !import_u64(imp, &size) ||
+        size > QEMU_FILE_RAM_LIMIT) {
+        return NULL;
+    }
+
+    dss = g_new0(DeviceSaveState, 1);
+    dss->kind = kind;
+    dss->save_buffer = g_new(uint8_t, QEMU_FILE_RAM_LIMIT);
+    dss->save_buffer_size = size;
+
+    if (!import_bytes(imp, dss->save_buffer, size)) {
+        device_free_all(dss);
+        g_free(dss);
+        return NULL;
+    }
+
+    return dss;
+}
+
+static bool import_root(SyxSnapshotImport* imp, SyxSnapshotRoot* root)
+{
+    uint64_t nb_rbs, nb_vm_rbs = 0;
+    RAMBlock* block;
+
+    root->dss = import_dss(imp);
+    if (!root->dss || !import_u64(imp, &nb_rbs)) {
+        return false;
+    }
+
+    RAMBLOCK_FOREACH(block) { nb_vm_rbs++; }
+    if (nb_rbs != nb_vm_rbs) {
+        SYX_ERROR("The snapshot has %" PRIu64 " RAMBlocks, the VM %" PRIu64,
+                  nb_rbs, nb_vm_rbs);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < nb_rbs; i++) {
+        RAMBlock* rb = import_rb(imp);
+        SyxSnapshotRAMBlock* snapshot_rb;
+        uint64_t used_length, nb_pages;
+
+        if (!rb || !import_u64(imp, &used_length)) {
+            return false;
+        }
+
+        if (used_length != rb->used_length) {
+            SYX_ERROR("RAMBlock %s has a different size in the snapshot",
+                      rb->idstr);
+            return false;
+        }
+
+        nb_pages = used_length / syx_snapshot_state.page_size;
+        snapshot_rb = g_new(SyxSnapshotRAMBlock, 1);
+        snapshot_rb->used_length = used_length;
+        snapshot_rb->pages = g_new(SyxPage*, nb_pages);
+
+        for (uint64_t j = 0; j < nb_pages; j++) {
+            SyxPage* page;
+
+            if (!import_page(imp, &page)) {
+                while (j--) {
+                    syx_page_store_put(snapshot_rb->pages[j]);
+                }
+                g_free(snapshot_rb->pages);
+                g_free(snapshot_rb);
+                return false;
+            }
+            snapshot_rb->pages[j] = syx_page_store_ref(page);
+        }
+
+        g_hash_table_insert(root->rbs_snapshot,
+                            GINT_TO_POINTER(rb->idstr_hash), snapshot_rb);
     }
+
+    return true;
 }
 
-bool syx_snapshot_cow_cache_write_entry(BlockBackend* blk, int64_t offset,
-                                        int64_t bytes, QEMUIOVector* qiov,
-                                        size_t qiov_offset,
-                                        BdrvRequestFlags flags)
+static bool import_increment(SyxSnapshotImport* imp,
+                             SyxSnapshotIncrement* increment)
 {
-    if (!syx_snapshot_state.active_bdrv_cache_snapshot) {
-        if (syx_snapshot_state.before_fuzz_cache) {
-            assert(syx_cow_cache_write_entry(
-                syx_snapshot_state.before_fuzz_cache, blk, offset, bytes, qiov,
-                qiov_offset, flags));
-            return true;
+    uint64_t nb_rbs;
+
+    increment->dss = import_dss(imp);
+    if (!increment->dss || !import_u64(imp, &nb_rbs)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < nb_rbs; i++) {
+        RAMBlock* rb = import_rb(imp);
+        SyxSnapshotDirtyPageList* dpl;
+        uint64_t length;
+
+        // A page is dirty at most once per increment.
+        if (!rb || !import_u64(imp, &length) ||
+            length > rb->used_length / syx_snapshot_state.page_size) {
+            return false;
         }
 
+        dpl = g_new0(SyxSnapshotDirtyPageList, 1);
+        dpl->dirty_pages = g_new(SyxSnapshotDirtyPage, length);
+        g_hash_table_insert(increment->rbs_dirty_pages,
+                            GINT_TO_POINTER(rb->idstr_hash), dpl);
+
+        for (uint64_t j = 0; j < length; j++) {
+            SyxSnapshotDirtyPage* dp = &dpl->dirty_pages[j];
+            uint64_t offset;
+            SyxPage* page;
+
+            if (!import_u64(imp, &offset) || !import_page(imp, &page) ||
+                offset >= rb->used_length ||
+                (offset & ~syx_snapshot_state.page_mask)) {
+                return false;
+            }
+
+            dp->offset_within_rb = offset;
+            dp->page = syx_page_store_ref(page);
+            dpl->length++;
+        }
+    }
+
+    return true;
+}
+
+static bool import_cow_cache(SyxSnapshotImport* imp, SyxCowCache* scc)
+{
+    g_autofree uint8_t* buf = NULL;
+    uint64_t size;
+    struct stat st;
+
+    // The size is checked against the file before allocating.
+    if (!import_u64(imp, &size) || fstat(fileno(imp->f), &st) ||
+        size > (uint64_t)st.st_size) {
         return false;
-    } else {
-        assert(syx_cow_cache_write_entry(
-            syx_snapshot_state.active_bdrv_cache_snapshot->bdrvs_cow_cache, blk,
-            offset, bytes, qiov, qiov_offset, flags));
-        return true;
     }
+
+    buf = g_malloc(size);
+    return import_bytes(imp, buf, size) &&
+           syx_cow_cache_load_lower_layers(scc, buf, size);
+}
+
+// Brings guest RAM to the root of the imported snapshot.
+static void import_restore_root(SyxSnapshot* snapshot)
+{
+    GHashTableIter iter;
+    gpointer rb_idstr_hash, value;
+
+    device_restore_all(snapshot->root_snapshot->dss);
+
+    g_hash_table_iter_init(&iter, snapshot->root_snapshot->rbs_snapshot);
+    while (g_hash_table_iter_next(&iter, &rb_idstr_hash, &value)) {
+        SyxSnapshotRAMBlock* snapshot_rb = value;
+        RAMBlock* rb = ramblock_lookup(rb_idstr_hash);
+
+        for (ram_addr_t offset = 0; offset < rb->used_length;
+             offset += syx_snapshot_state.page_size) {
+            SyxPage* page =
+                snapshot_rb->pages[offset / syx_snapshot_state.page_size];
+
+            if (syx_page_store_cmp(page, rb->host + offset)) {
+                // For the other snapshots to restore it
+                syx_snapshot_dirty_list_add_internal(rb, offset);
+                syx_page_store_restore(rb->host + offset, page);
+            }
+        }
+    }
+}
+
+SyxSnapshot* syx_snapshot_import(const char* path, bool track,
+                                 bool is_active_bdrv_cache)
+{
+    SyxSnapshotImport imp = {0};
+    SyxSnapshot* snapshot = NULL;
+    uint64_t magic, version, page_size, nb_increments;
+    bool must_unlock_bql = false;
+    bool ok = false;
+
+    imp.f = fopen(path, "rb");
+    if (!imp.f) {
+        SYX_ERROR("Could not open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    setvbuf(imp.f, NULL, _IOFBF, 1 << 20);
+
+    if (!import_u64(&imp, &magic) || !import_u64(&imp, &version) ||
+        !import_u64(&imp, &page_size) || magic != SYX_SNAPSHOT_FILE_MAGIC ||
+        version != SYX_SNAPSHOT_FILE_VERSION ||
+        page_size != syx_snapshot_state.page_size) {
+        SYX_ERROR("%s is not a SYX snapshot of this VM", path);
+        fclose(imp.f);
+        return NULL;
+    }
+
+    if (!bql_locked()) {
+        bql_lock();
+        must_unlock_bql = true;
+    }
+
+    imp.pages = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)syx_page_store_put);
+    imp.page_buf = g_malloc(syx_snapshot_state.page_size);
+
+    snapshot = g_new0(SyxSnapshot, 1);
+    snapshot->root_snapshot = g_new0(SyxSnapshotRoot, 1);
+    snapshot->root_snapshot->rbs_snapshot = g_hash_table_new_full(
+        g_direct_hash, g_direct_equal, NULL, destroy_ramblock_snapshot);
+    snapshot->rbs_dirty_list =
+        g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                              (GDestroyNotify)g_hash_table_remove_all);
+    snapshot->bdrvs_cow_cache = syx_cow_cache_new();
+    syx_cow_cache_push_layer(snapshot->bdrvs_cow_cache,
+                             SYX_SNAPSHOT_COW_CACHE_DEFAULT_CHUNK_SIZE,
+                             SYX_SNAPSHOT_COW_CACHE_DEFAULT_MAX_BLOCKS);
+
+    if (!import_root(&imp, snapshot->root_snapshot) ||
+        !import_u64(&imp, &nb_increments)) {
+        goto out;
+    }
+
+    for (uint64_t i = 0; i < nb_increments; i++) {
+        SyxSnapshotIncrement* increment = g_new0(SyxSnapshotIncrement, 1);
+
+        increment->parent = snapshot->last_incremental_snapshot;
+        increment->rbs_dirty_pages =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                  destroy_snapshot_dirty_page_list);
+
+        if (!import_increment(&imp, increment)) {
+            g_hash_table_destroy(increment->rbs_dirty_pages);
+            if (increment->dss) {
+                device_free_all(increment->dss);
+            }
+            g_free(increment);
+            goto out;
+        }
+
+        snapshot->last_incremental_snapshot = increment;
+    }
+
+    if (!import_cow_cache(&imp, snapshot->bdrvs_cow_cache) ||
+        fgetc(imp.f) != EOF) {
+        goto out;
+    }
+
+    import_restore_root(snapshot);
+
+    if (is_active_bdrv_cache) {
+        bdrv_drain_all_begin();
+        syx_snapshot_state.active_bdrv_cache_snapshot = snapshot;
+        bdrv_drain_all_end();
+    }
+
+    if (track) {
+        syx_snapshot_track(&syx_snapshot_state.tracked_snapshots, snapshot);
+    }
+
+    syx_snapshot_state.is_enabled = true;
+    ok = true;
+
+out:
+    if (!ok) {
+        SYX_ERROR("%s is truncated or corrupted", path);
+        syx_snapshot_free(snapshot);
+        snapshot = NULL;
+    }
+
+    g_ptr_array_free(imp.pages, true);
+    g_free(imp.page_buf);
+    fclose(imp.f);
+
+    if (must_unlock_bql) {
+        bql_unlock();
+    }
+
+    return snapshot;
 }
@@ -0,0 +1,221 @@
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/target-info.h"
+#include "cpu.h"
+#include "exec/mmap-lock.h"
+#include "exec/target_page.h"
+#include "exec/tlb-flags.h"
+#include "exec/translation-block.h"
+#include "accel/tcg/cpu-ops.h"
+#include "accel/tcg/cpu-mmu-index.h"
+#include "accel/tcg/probe.h"
+#include "accel/tcg/internal-common.h"
+#include "tcg/tcg.h"
+
+#include "libafl/tb_cache.h"
+
+static bool libafl_tb_cache_hash(CPUState* cpu, vaddr pc, uint32_t size,
+                                 uint32_t* hash)
+{
+    g_autofree uint8_t* code = g_malloc(size);
+
+    if (cpu_memory_rw_debug(cpu, pc, code, size, false) != 0) {
+        return false;
+    }
+
+    *hash = crc32c(0xffffffff, code, size);
+    return true;
+}
+
+static gboolean libafl_tb_cache_collect(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    const TranslationBlock* tb = value;
+    GArray* records = data;
+    uint32_t cflags = tb->cflags;
+
+    // Edges are generated on demand when chaining, one-shot and single-step
+    // blocks are not worth keeping.
+    if ((cflags & (CF_INVALID | CF_IS_EDGE | CF_COUNT_MASK | CF_SINGLE_STEP)) ||
+        tb_page_addr0(tb) == -1) {
+        return false;
+    }
+
+    struct libafl_tb_cache_record rec = {
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = cflags,
+        .size = tb->size,
+    };
+    g_array_append_val(records, rec);
+
+    return false;
+}
+
+int64_t libafl_tb_cache_export(CPUState* cpu, const char* path)
+{
+    g_autoptr(GArray) records =
+        g_array_new(false, false, sizeof(struct libafl_tb_cache_record));
+    g_autoptr(GByteArray) out = g_byte_array_new();
+    g_autoptr(GError) err = NULL;
+    struct libafl_tb_cache_header header = {
+        .magic = LIBAFL_TB_CACHE_MAGIC,
+        .version = LIBAFL_TB_CACHE_VERSION,
+        .target_long_bits = target_long_bits(),
+    };
+    uint64_t nb_records = 0;
+
+    pstrcpy(header.target_name, sizeof(header.target_name), target_name());
+
+    tcg_tb_foreach(libafl_tb_cache_collect, records);
+
+    g_byte_array_append(out, (uint8_t*)&header, sizeof(header));
+
+    for (guint i = 0; i < records->len; i++) {
+        struct libafl_tb_cache_record* rec =
+            &g_array_index(records, struct libafl_tb_cache_record, i);
+
+        // the guest code is not mapped anymore, nothing to validate against
+        if (!libafl_tb_cache_hash(cpu, rec->pc, rec->size, &rec->hash)) {
+            continue;
+        }
+
+        g_byte_array_append(out, (uint8_t*)rec, sizeof(*rec));
+        nb_records++;
+    }
+
+    ((struct libafl_tb_cache_header*)out->data)->nb_records = nb_records;
+
+    if (!g_file_set_contents(path, (gchar*)out->data, out->len, &err)) {
+        error_report("Could not write TB cache to %s: %s", path, err->message);
+        return -1;
+    }
+
+    return nb_records;
+}
+
+// Translation must not fault: check that the whole block can be fetched.
+static bool libafl_tb_cache_can_fetch(CPUState* cpu, vaddr pc, uint32_t size)
+{
+    CPUArchState* env = cpu_env(cpu);
+    int mmu_idx = cpu_mmu_index(cpu, true);
+    vaddr last_page = (pc + size - 1) & TARGET_PAGE_MASK;
+    void* host;
+
+    for (vaddr page = pc & TARGET_PAGE_MASK; page <= last_page;
+         page += TARGET_PAGE_SIZE) {
+        int flags = probe_access_flags(env, page, 0, MMU_INST_FETCH, mmu_idx,
+                                       true, &host, 0);
+        if (flags & TLB_INVALID_MASK) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct libafl_tb_cache_import_args {
+    const struct libafl_tb_cache_record* records;
+    uint64_t nb_records;
+    struct libafl_tb_cache_import_stats stats; // OUT
+};
+
+static void libafl_tb_cache_import_work(CPUState* cpu, run_on_cpu_data data)
+{
+    struct libafl_tb_cache_import_args* args = data.host_ptr;
+    TCGTBCPUState cur = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
+    uint32_t cflags = curr_cflags(cpu);
+
+    for (uint64_t i = 0; i < args->nb_records; i++) {
+        const struct libafl_tb_cache_record* rec = &args->records[i];
+        uint32_t hash;
+
+        if (tcg_code_size() * 100 >
+            tcg_code_capacity() * LIBAFL_TB_CACHE_MAX_FILL) {
+            args->stats.nb_no_room = args->nb_records - i;
+            break;
+        }
+
+        // The translators may read CPU state that is not part of the TB
+        // flags, only retranslate blocks that match the current state.
+        if (rec->flags != cur.flags || rec->cs_base != cur.cs_base ||
+            rec->cflags != cflags) {
+            args->stats.nb_other_state++;
+            continue;
+        }
+
+        if (!libafl_tb_cache_can_fetch(cpu, rec->pc, rec->size) ||
+            !libafl_tb_cache_hash(cpu, rec->pc, rec->size, &hash) ||
+            hash != rec->hash) {
+            args->stats.nb_changed++;
+            continue;
+        }
+
+        TCGTBCPUState s = {
+            .pc = rec->pc,
+            .flags = rec->flags,
+            .cflags = rec->cflags,
+            .cs_base = rec->cs_base,
+        };
+
+        mmap_lock();
+        tb_gen_code(cpu, s);
+        mmap_unlock();
+
+        args->stats.nb_translated++;
+    }
+}
+
+int64_t libafl_tb_cache_import(CPUState* cpu, const char* path,
+                               struct libafl_tb_cache_import_stats* stats)
+{
+    g_autofree gchar* contents = NULL;
+    g_autoptr(GError) err = NULL;
+    gsize len;
+
+    if (!g_file_get_contents(path, &contents, &len, &err)) {
+        error_report("Could not read TB cache from %s: %s", path, err->message);
+        return -1;
+    }
+
+    struct libafl_tb_cache_header* header =
+        (struct libafl_tb_cache_header*)contents;
+
+    if (len < sizeof(*header) ||
+        memcmp(header->magic, LIBAFL_TB_CACHE_MAGIC,
+               sizeof(LIBAFL_TB_CACHE_MAGIC)) ||
+        header->version != LIBAFL_TB_CACHE_VERSION) {
+        error_report("%s is not a valid TB cache", path);
+        return -1;
+    }
+
+    if (header->target_long_bits != target_long_bits() ||
+        strncmp(header->target_name, target_name(),
+                sizeof(header->target_name))) {
+        error_report("TB cache %s was generated for another target", path);
+        return -1;
+    }
+
+    if (header->nb_records >
+        (len - sizeof(*header)) / sizeof(struct libafl_tb_cache_record)) {
+        error_report("TB cache %s is truncated", path);
+        return -1;
+    }
+
+    struct libafl_tb_cache_import_args args = {
+        .records = (struct libafl_tb_cache_record*)(contents + sizeof(*header)),
+        .nb_records = header->nb_records,
+    };
+
+    // Translate in the context (and TCGContext) of the vCPU thread.
+    run_on_cpu(cpu, libafl_tb_cache_import_work, RUN_ON_CPU_HOST_PTR(&args));
+
+    if (stats) {
+        *stats = args.stats;
+    }
+
+    return args.stats.nb_translated;
+}
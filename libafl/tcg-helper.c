@@ -3,6 +3,7 @@
 #include "exec/helper-proto-common.h"
 
 #include "libafl/exit.h"
+#include "libafl/nyx.h"
 
 #define HELPER_H "libafl/tcg-helper.h"
 #include "exec/helper-info.c.inc"
@@ -21,3 +22,9 @@ void HELPER(libafl_qemu_handle_custom_insn)(CPUArchState* env, uint64_t pc,
     libafl_exit_request_custom_insn(cpu, (vaddr)pc,
                                     (enum libafl_custom_insn_kind)kind);
 }
+
+void HELPER(libafl_qemu_handle_nyx_hypercall)(CPUArchState* env, uint64_t pc)
+{
+    CPUState* cpu = env_cpu(env);
+    libafl_nyx_handle_hypercall(cpu, (vaddr)pc);
+}
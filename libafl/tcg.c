@@ -14,6 +14,7 @@
 #include "tcg/tcg-op-common.h"
 #include "tcg/tcg-op.h"
 
+#include "libafl/profile.h"
 #include "libafl/tcg.h"
 #include "libafl/hooks/tcg/edge.h"
 
@@ -160,12 +161,18 @@ buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        if (cpu_in_serial_context(cpu)) {
+        if (!tb_evict_enabled && cpu_in_serial_context(cpu)) {
             trace_tb_gen_code_buffer_overflow("libafl_edge_tcg_tb_alloc");
             tb_flush__exclusive_or_serial();
             goto buffer_overflow;
         }
-        queue_tb_flush(cpu);
+        // An eviction may free the TBs being chained by the caller, always
+        // go back to the execution loop.
+        if (tb_evict_enabled) {
+            queue_tb_evict(cpu);
+        } else {
+            queue_tb_flush(cpu);
+        }
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -182,6 +189,7 @@ buffer_overflow:
     tb->cs_base = s.cs_base;
     tb->flags = s.flags;
     tb->cflags = s.cflags | CF_IS_EDGE;
+    tb->libafl_trace_tail = 0;
 #ifdef CONFIG_USER_ONLY
     tb_set_page_addr0(tb, phys_pc);
 #else
@@ -196,6 +204,8 @@ buffer_overflow:
     tcg_ctx->addr_type = TARGET_LONG_BITS == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
     tcg_ctx->guest_mo = cpu->cc->tcg_ops->guest_default_memory_order;
 
+    int64_t gen_start = libafl_profile_gen_clock();
+
 restart_translate:
     trace_translate_block(tb, pc, tb->tc.ptr);
 
@@ -276,6 +286,8 @@ restart_translate:
     }
     tb->tc.size = gen_code_size;
 
+    libafl_profile_gen_end(tb, pc, gen_start);
+
     /*
      * For CF_PCREL, attribute all executions of the generated code
      * to its first mapping.
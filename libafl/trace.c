@@ -0,0 +1,220 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "exec/mmap-lock.h"
+#include "accel/tcg/internal-common.h"
+#include "tcg/tcg-op-common.h"
+
+#include "libafl/cpu.h"
+#include "libafl/tcg.h"
+#include "libafl/trace.h"
+
+// The targets merging their direct jumps into traces, see
+// translator_trace_can_continue: RISC-V jal and AArch64 b. Elsewhere a hot pc
+// would be translated to the same TB again: the trace threshold is ignored.
+#if defined(TARGET_RISCV) || defined(TARGET_AARCH64)
+#define LIBAFL_TRACE_SUPPORTED true
+#else
+#define LIBAFL_TRACE_SUPPORTED false
+#endif
+
+static uint32_t libafl_trace_threshold = 0;
+static uint32_t libafl_tier_threshold = 0;
+static uint32_t libafl_trace_counters[LIBAFL_TRACE_COUNTERS_SIZE];
+
+static QemuMutex libafl_trace_lock;
+static GHashTable* libafl_trace_hot_pcs;
+
+static uint64_t libafl_trace_nb_hot;
+static uint64_t libafl_trace_nb_traces;
+static uint64_t libafl_trace_nb_merged;
+static uint64_t libafl_tier_nb_tier0;
+static uint64_t libafl_tier_nb_tier1;
+
+static TCGHelperInfo libafl_trace_hot_info = {
+    .func = NULL,
+    .name = "libafl_trace_hot",
+    .flags = dh_callflag(void),
+    .typemask =
+        dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(i64, 2)};
+
+static size_t libafl_trace_slot(vaddr pc)
+{
+    return ((pc >> 1) ^ (pc >> 17)) & (LIBAFL_TRACE_COUNTERS_SIZE - 1);
+}
+
+static void libafl_trace_init(void)
+{
+    if (!libafl_trace_hot_pcs) {
+        qemu_mutex_init(&libafl_trace_lock);
+        libafl_trace_hot_pcs = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+}
+
+void libafl_qemu_set_trace_threshold(uint32_t threshold)
+{
+    libafl_trace_init();
+
+    if (threshold != libafl_trace_threshold) {
+        libafl_flush_jit();
+        memset(libafl_trace_counters, 0, sizeof(libafl_trace_counters));
+        qatomic_set(&libafl_trace_threshold, threshold);
+    }
+}
+
+void libafl_qemu_set_tier_threshold(uint32_t threshold)
+{
+    libafl_trace_init();
+
+    if (threshold != libafl_tier_threshold) {
+        libafl_flush_jit();
+        memset(libafl_trace_counters, 0, sizeof(libafl_trace_counters));
+        qatomic_set(&libafl_tier_threshold, threshold);
+    }
+}
+
+void libafl_qemu_tier_stats(uint64_t* nb_tier0, uint64_t* nb_tier1)
+{
+    *nb_tier0 = qatomic_read(&libafl_tier_nb_tier0);
+    *nb_tier1 = qatomic_read(&libafl_tier_nb_tier1);
+}
+
+void libafl_qemu_trace_reset(void)
+{
+    libafl_trace_init();
+    libafl_flush_jit();
+
+    qemu_mutex_lock(&libafl_trace_lock);
+    g_hash_table_remove_all(libafl_trace_hot_pcs);
+    qemu_mutex_unlock(&libafl_trace_lock);
+
+    memset(libafl_trace_counters, 0, sizeof(libafl_trace_counters));
+}
+
+void libafl_qemu_trace_stats(uint64_t* nb_hot, uint64_t* nb_traces,
+                             uint64_t* nb_merged_blocks)
+{
+    *nb_hot = qatomic_read(&libafl_trace_nb_hot);
+    *nb_traces = qatomic_read(&libafl_trace_nb_traces);
+    *nb_merged_blocks = qatomic_read(&libafl_trace_nb_merged);
+}
+
+static bool libafl_trace_is_hot(vaddr pc)
+{
+    bool hot;
+
+    qemu_mutex_lock(&libafl_trace_lock);
+    hot = g_hash_table_contains(libafl_trace_hot_pcs,
+                                (gpointer)(uintptr_t)pc);
+    qemu_mutex_unlock(&libafl_trace_lock);
+
+    return hot;
+}
+
+// The lowest enabled threshold promotes a pc, for both the traces and the
+// tiers.
+static uint32_t libafl_trace_hot_threshold(void)
+{
+    uint32_t trace =
+        LIBAFL_TRACE_SUPPORTED ? qatomic_read(&libafl_trace_threshold) : 0;
+    uint32_t tier = qatomic_read(&libafl_tier_threshold);
+
+    if (trace == 0 || (tier != 0 && tier < trace)) {
+        return tier;
+    }
+    return trace;
+}
+
+// Called from the generated code of tb once its counter reached the
+// threshold. The TB keeps running to its end: the invalidation only unlinks
+// it, so that the next lookup retranslates pc as a trace and/or at tier-1.
+static void libafl_trace_hot(uint64_t pc, uint64_t tb_ptr)
+{
+    TranslationBlock* tb = (TranslationBlock*)(uintptr_t)tb_ptr;
+    uint32_t* counter = &libafl_trace_counters[libafl_trace_slot(pc)];
+    bool added;
+
+    // The counters are updated without atomics and several vCPUs may get
+    // here for the same count: the one swapping it out claims the promotion.
+    if (qatomic_xchg(counter, 0) < libafl_trace_hot_threshold()) {
+        return;
+    }
+
+    qemu_mutex_lock(&libafl_trace_lock);
+    added = g_hash_table_add(libafl_trace_hot_pcs, (gpointer)(uintptr_t)pc);
+    qemu_mutex_unlock(&libafl_trace_lock);
+
+    if (added) {
+        qatomic_inc(&libafl_trace_nb_hot);
+    }
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        mmap_lock();
+        tb_phys_invalidate(tb, -1);
+        mmap_unlock();
+    }
+}
+
+// if (++counters[slot] >= threshold) libafl_trace_hot(pc, tb)
+// Racing increments may skip over the exact threshold, hence >=.
+static void libafl_trace_gen_profile(TranslationBlock* tb, vaddr pc,
+                                     uint32_t threshold)
+{
+    uint32_t* counter = &libafl_trace_counters[libafl_trace_slot(pc)];
+    TCGv_ptr counter_ptr = tcg_constant_ptr(counter);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel* skip = gen_new_label();
+
+    tcg_gen_ld_i32(count, counter_ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, counter_ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_LTU, count, threshold, skip);
+
+    if (!libafl_trace_hot_info.func) {
+        libafl_trace_hot_info.func = libafl_trace_hot;
+    }
+
+    TCGv_i64 tmp0 = tcg_constant_i64(pc);
+    TCGv_i64 tmp1 = tcg_constant_i64((uint64_t)(uintptr_t)tb);
+    TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
+    tcg_gen_callN(libafl_trace_hot_info.func, &libafl_trace_hot_info, NULL,
+                  tmp2);
+
+    gen_set_label(skip);
+}
+
+bool libafl_trace_gen_start(TranslationBlock* tb, vaddr pc)
+{
+    uint32_t threshold = libafl_trace_hot_threshold();
+    bool tiered = qatomic_read(&libafl_tier_threshold) != 0;
+
+    // One-shot and single-step TBs are never worth a trace, and are
+    // translated at tier-1 since they never get promoted.
+    if (threshold == 0 || (tb_cflags(tb) & CF_COUNT_MASK) == 1) {
+        return false;
+    }
+
+    if (libafl_trace_is_hot(pc)) {
+        if (tiered) {
+            qatomic_inc(&libafl_tier_nb_tier1);
+        }
+        return LIBAFL_TRACE_SUPPORTED &&
+               qatomic_read(&libafl_trace_threshold) != 0;
+    }
+
+    // The hooks are generated the same way in both tiers, so the ids they
+    // return (and the coverage) do not depend on the tier of the code.
+    if (tiered) {
+        tcg_ctx->libafl_tier0 = true;
+        qatomic_inc(&libafl_tier_nb_tier0);
+    }
+
+    libafl_trace_gen_profile(tb, pc, threshold);
+    return false;
+}
+
+void libafl_trace_count(int nb_blocks)
+{
+    qatomic_inc(&libafl_trace_nb_traces);
+    qatomic_add(&libafl_trace_nb_merged, nb_blocks);
+}
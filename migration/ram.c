@@ -70,6 +70,10 @@
 #include "qemu/userfaultfd.h"
 #endif /* defined(__linux__) */
 
+//// --- Begin LibAFL code ---
+#include "io/channel-file.h"
+//// --- End LibAFL code ---
+
 /***********************************************************/
 /* ram save/restore */
 
@@ -4084,6 +4088,84 @@ static bool handle_zero_mapped_ram(RAMBlock *block, unsigned long from_bit_idx,
     return true;
 }
 
+//// --- Begin LibAFL code ---
+
+bool libafl_mapped_ram_lazy;
+
+/*
+ * Map the pages of @block from the mapped-ram file instead of reading them,
+ * so that the kernel only brings in the pages the guest touches. The mapping
+ * is private: guest writes never reach the file, and mapping the file again
+ * drops them. Discarding pages of the block maps anonymous memory over them,
+ * see ram_block_discard_range().
+ *
+ * Returns: true if the block is mapped, false if it must be read instead.
+ */
+static bool libafl_map_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                           long num_pages,
+                                           unsigned long *bitmap,
+                                           Error **errp)
+{
+    size_t host_page_size = qemu_real_host_page_size();
+    ram_addr_t length = num_pages << TARGET_PAGE_BITS;
+    unsigned long set_bit_idx = 0, clear_bit_idx;
+    QIOChannelFile *fioc;
+    struct stat st;
+    void *host;
+
+    fioc = (QIOChannelFile *)object_dynamic_cast(OBJECT(qemu_file_get_ioc(f)),
+                                                 TYPE_QIO_CHANNEL_FILE);
+    if (!fioc || migrate_multifd() || qemu_ram_is_shared(block) ||
+        block->fd >= 0 || block->page_size != host_page_size ||
+        !QEMU_IS_ALIGNED(block->pages_offset, host_page_size) ||
+        !QEMU_IS_ALIGNED(length, host_page_size) ||
+        fstat(fioc->fd, &st) < 0 ||
+        st.st_size < block->pages_offset + length) {
+        return false;
+    }
+
+    host = host_from_ram_block_offset(block, 0);
+    if (!host || !QEMU_PTR_IS_ALIGNED(host, host_page_size)) {
+        return false;
+    }
+
+    if (mmap(host, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fioc->fd, block->pages_offset) == MAP_FAILED) {
+        error_setg_errno(errp, errno, "(%s) failed to map pages from file",
+                         block->idstr);
+        return false;
+    }
+    /* The new mapping does not inherit the advice given to the old one */
+    libafl_ram_block_setup_madvise(block, host, length);
+    block->libafl_file_mapped = true;
+
+    /*
+     * Zero pages are holes in the file, unless they were written in an
+     * earlier iteration of the migration: only those need to be cleared.
+     */
+    for (clear_bit_idx = find_first_zero_bit(bitmap, num_pages);
+         clear_bit_idx < num_pages;
+         clear_bit_idx = find_next_zero_bit(bitmap, num_pages,
+                                            set_bit_idx + 1)) {
+        off_t start = block->pages_offset +
+                      ((off_t)clear_bit_idx << TARGET_PAGE_BITS);
+        off_t data;
+
+        set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1);
+
+        data = lseek(fioc->fd, start, SEEK_DATA);
+        if (data >= 0 && data < block->pages_offset +
+                                ((off_t)set_bit_idx << TARGET_PAGE_BITS)) {
+            memset(host + (clear_bit_idx << TARGET_PAGE_BITS), 0,
+                   (set_bit_idx - clear_bit_idx) << TARGET_PAGE_BITS);
+        }
+    }
+
+    return true;
+}
+
+//// --- End LibAFL code ---
+
 static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                      long num_pages, unsigned long *bitmap,
                                      Error **errp)
@@ -4094,6 +4176,18 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
     void *host;
     size_t read, unread, size;
 
+//// --- Begin LibAFL code ---
+    if (libafl_mapped_ram_lazy) {
+        if (libafl_map_ramblock_mapped_ram(f, block, num_pages, bitmap,
+                                           errp)) {
+            return true;
+        }
+        if (*errp) {
+            return false;
+        }
+    }
+//// --- End LibAFL code ---
+
     for (set_bit_idx = find_first_bit(bitmap, num_pages);
          set_bit_idx < num_pages;
          set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1)) {
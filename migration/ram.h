@@ -122,4 +122,11 @@ void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
 void ram_write_tracking_stop(void);
 
+//// --- Begin LibAFL code ---
+
+/* Map the pages of mapped-ram files instead of reading them. */
+extern bool libafl_mapped_ram_lazy;
+
+//// --- End LibAFL code ---
+
 #endif
@@ -72,6 +72,10 @@
 #include "system/qtest.h"
 #include "options.h"
 
+//// --- Begin LibAFL code ---
+#include "qemu/units.h"
+//// --- End LibAFL code ---
+
 const unsigned int postcopy_ram_discard_version;
 
 /* Subcommands for QEMU_VM_COMMAND */
@@ -3445,6 +3449,183 @@ err_drain:
     return false;
 }
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Like load_snapshot, from a migration stream instead of the disks, which are
+ * left untouched.
+ */
+static bool libafl_load_snapshot_stream(QEMUFile *f, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    int ret;
+
+    /*
+     * Flush the record/replay queue. Now the VM state is going
+     * to change. Therefore we don't need to preserve its consistency
+     */
+    replay_flush_events();
+
+    /* Flush all IO requests so they don't interfere with the new state.  */
+    bdrv_drain_all_begin();
+
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+    mis->from_src_file = f;
+
+    if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+        migration_incoming_state_destroy();
+        bdrv_drain_all_end();
+        return false;
+    }
+
+    ret = qemu_loadvm_state(f, errp);
+    migration_incoming_state_destroy();
+
+    bdrv_drain_all_end();
+
+    return ret >= 0;
+}
+
+bool libafl_load_snapshot_file(const char *filename, bool lazy, Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+    bool mapped_ram = s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    bool ret;
+
+    if (!migrate_can_snapshot(errp)) {
+        return false;
+    }
+
+    if (migrate_multifd()) {
+        error_setg(errp, "Snapshot files can not be loaded with multifd");
+        return false;
+    }
+
+    ioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!ioc) {
+        return false;
+    }
+    qio_channel_set_name(QIO_CHANNEL(ioc), "libafl-snapshot-file");
+    f = qemu_file_new_input(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    /*
+     * The file records whether it was saved with mapped-ram, the
+     * capability must match it for the time of the load.
+     */
+    s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] = true;
+    libafl_mapped_ram_lazy = lazy;
+    ret = libafl_load_snapshot_stream(f, errp);
+    libafl_mapped_ram_lazy = false;
+    s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] = mapped_ram;
+
+    return ret;
+}
+
+uint8_t *libafl_save_snapshot_buffer(size_t *size, Error **errp)
+{
+    RunState saved_state;
+    QIOChannelBuffer *ioc;
+    QEMUFile *f;
+    uint8_t *data;
+    int ret, ret2;
+
+    GLOBAL_STATE_CODE();
+
+#ifdef AS_LIB
+    /* vm_resume() below must not start a VM fast paused by the harness */
+    libafl_vm_leave_fast_pause();
+#endif
+    saved_state = runstate_get();
+
+    if (!migrate_can_snapshot(errp)) {
+        return NULL;
+    }
+
+    if (migration_is_blocked(errp)) {
+        return NULL;
+    }
+
+    if (migrate_multifd() || migrate_mapped_ram()) {
+        error_setg(errp, "Memory snapshots can not be saved with multifd "
+                   "or mapped-ram");
+        return NULL;
+    }
+
+    if (!replay_can_snapshot()) {
+        error_setg(errp, "Record/replay does not allow making snapshot "
+                   "right now. Try once more later.");
+        return NULL;
+    }
+
+    global_state_store();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    /*
+     * Zero pages only take a few bytes in the stream: reserve the size of
+     * RAM, the pages of the buffer are only allocated when written.
+     */
+    ioc = qio_channel_buffer_new(ram_bytes_total() + 16 * MiB);
+    qio_channel_set_name(QIO_CHANNEL(ioc), "libafl-snapshot-buffer");
+    f = qemu_file_new_output(QIO_CHANNEL(ioc));
+
+    ret = qemu_savevm_state(f, errp);
+    ret2 = qemu_fflush(f);
+    if (ret == 0 && ret2 < 0) {
+        error_setg_errno(errp, -ret2, "Error while writing VM state");
+        ret = ret2;
+    }
+
+    /* Closing the channel frees the buffer it allocated: take it first */
+    data = ioc->data;
+    *size = ioc->usage;
+    ioc->data = NULL;
+    ioc->capacity = ioc->usage = ioc->offset = 0;
+    qemu_fclose(f);
+    object_unref(OBJECT(ioc));
+
+    bdrv_drain_all_end();
+
+    vm_resume(saved_state);
+
+    if (ret < 0) {
+        g_free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+bool libafl_load_snapshot_buffer(const uint8_t *buf, size_t size,
+                                 Error **errp)
+{
+    QIOChannelBuffer *ioc;
+    QEMUFile *f;
+
+    if (!migrate_can_snapshot(errp)) {
+        return false;
+    }
+
+    if (migrate_multifd() || migrate_mapped_ram()) {
+        error_setg(errp, "Memory snapshots can not be loaded with multifd "
+                   "or mapped-ram");
+        return false;
+    }
+
+    ioc = qio_channel_buffer_new_external((uint8_t *)buf, size, size);
+    qio_channel_set_name(QIO_CHANNEL(ioc), "libafl-snapshot-buffer");
+    f = qemu_file_new_input(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    return libafl_load_snapshot_stream(f, errp);
+}
+
+//// --- End LibAFL code ---
+
 void load_snapshot_resume(RunState state)
 {
     vm_resume(state);
@@ -31,6 +31,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
 #include "qemu/seqlock.h"
+#include "qemu/stats64.h"
 #include "system/replay.h"
 #include "system/runstate.h"
 #include "hw/core/cpu.h"
@@ -266,10 +267,95 @@ void qemu_timer_notify_cb(void *opaque, QEMUClockType type)
 
 TimersState timers_state;
 
+//// --- Begin LibAFL code ---
+
+static bool libafl_idle_skip;
+static Stat64 libafl_idle_skip_nb;
+static Stat64 libafl_idle_skip_ns;
+
+/*
+ * The host cycle counter and get_clock() at cpu_timers_init, to convert the
+ * skipped time into host ticks for cpu_get_ticks().  The rate gets more
+ * precise as time goes.
+ */
+static int64_t libafl_idle_skip_ref_ticks;
+static int64_t libafl_idle_skip_ref_ns;
+
+void libafl_set_idle_skip(bool enable)
+{
+    qatomic_store_release(&libafl_idle_skip, enable);
+}
+
+static int64_t libafl_idle_skip_ns_to_ticks(int64_t ns)
+{
+    int64_t dticks = cpu_get_host_ticks() - libafl_idle_skip_ref_ticks;
+    int64_t dns = get_clock() - libafl_idle_skip_ref_ns;
+
+    if (dticks <= 0 || dns <= 0) {
+        return ns;
+    }
+
+    return (int64_t)((double)ns * dticks / dns);
+}
+
+void libafl_idle_skip_stats(uint64_t *nb_skips, uint64_t *skipped_ns)
+{
+    *nb_skips = stat64_get(&libafl_idle_skip_nb);
+    *skipped_ns = stat64_get(&libafl_idle_skip_ns);
+}
+
+/*
+ * Called with the BQL held by a vCPU thread about to sleep.  When every
+ * vCPU is idle, jump QEMU_CLOCK_VIRTUAL to its next deadline instead of
+ * waiting for it in real time, like icount with sleep=off but without
+ * counting instructions.  The jump goes into cpu_clock_offset, and into
+ * cpu_ticks_offset for the guest cycle counters (e.g. the x86 TSC) to see
+ * the same time pass.  Both are saved and restored with the rest of the
+ * timers state.
+ */
+void libafl_idle_skip_warp(void)
+{
+    int64_t deadline, deadline_ticks;
+
+    if (!qatomic_load_acquire(&libafl_idle_skip) || icount_enabled() ||
+        replay_mode != REPLAY_MODE_NONE || !runstate_is_running() ||
+        !timers_state.cpu_ticks_enabled || !all_cpu_threads_idle()) {
+        return;
+    }
+
+    /* No timer, or an expired one that the main loop is about to run */
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    if (deadline <= 0) {
+        return;
+    }
+
+    deadline_ticks = libafl_idle_skip_ns_to_ticks(deadline);
+
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    timers_state.cpu_clock_offset += deadline;
+    timers_state.cpu_ticks_offset += deadline_ticks;
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+
+    stat64_add(&libafl_idle_skip_nb, 1);
+    stat64_add(&libafl_idle_skip_ns, deadline);
+
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+}
+
+//// --- End LibAFL code ---
+
 /* initialize timers state and the cpu throttle for convenience */
 void cpu_timers_init(void)
 {
     seqlock_init(&timers_state.vm_clock_seqlock);
     qemu_spin_init(&timers_state.vm_clock_lock);
     vmstate_register(NULL, 0, &vmstate_timers, &timers_state);
+
+//// --- Begin LibAFL code ---
+    libafl_idle_skip_ref_ticks = cpu_get_host_ticks();
+    libafl_idle_skip_ref_ns = get_clock();
+//// --- End LibAFL code ---
 }
@@ -487,6 +487,9 @@ void qemu_process_cpu_events(CPUState *cpu)
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
         }
+//// --- Begin LibAFL code ---
+        libafl_idle_skip_warp();
+//// --- End LibAFL code ---
         qemu_cond_wait(cpu->halt_cond, &bql);
     }
     if (slept) {
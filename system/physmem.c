@@ -2718,6 +2718,38 @@ void qemu_ram_remap(ram_addr_t addr)
         }
     }
 }
+
+//// --- Begin LibAFL code ---
+
+void libafl_ram_block_setup_madvise(RAMBlock *rb, void *host, size_t length)
+{
+    memory_try_enable_merging(host, length);
+    qemu_ram_setup_dump(host, length);
+    qemu_madvise(host, length, QEMU_MADV_HUGEPAGE);
+    if (!qtest_enabled()) {
+        qemu_madvise(host, length, QEMU_MADV_DONTFORK);
+    }
+}
+
+/*
+ * Dropping the private copy of a page mapped from a snapshot file would bring
+ * the file contents back instead of zeroes: map anonymous memory over it.
+ */
+static int libafl_ram_block_discard_file_mapped(RAMBlock *rb, uint64_t offset,
+                                                size_t length)
+{
+    int ret = qemu_ram_remap_mmap(rb, offset, length);
+
+    if (ret) {
+        error_report("%s: Failed to remap range %s:%" PRIx64 " +%zx (%d)",
+                     __func__, rb->idstr, offset, length, ret);
+        return ret;
+    }
+    libafl_ram_block_setup_madvise(rb, rb->host + offset, length);
+    return 0;
+}
+
+//// --- End LibAFL code ---
 #endif /* !_WIN32 */
 
 /*
@@ -3158,6 +3190,19 @@ static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
     physical_memory_set_dirty_range(addr, length, dirty_log_mask);
 }
 
+//// --- Begin LibAFL code ---
+
+void libafl_invalidate_and_set_dirty(MemoryRegion* mr, hwaddr addr,
+                                     hwaddr length);
+
+void libafl_invalidate_and_set_dirty(MemoryRegion* mr, hwaddr addr,
+                                     hwaddr length)
+{
+    invalidate_and_set_dirty(mr, addr, length);
+}
+
+//// --- End LibAFL code ---
+
 void memory_region_flush_rom_device(MemoryRegion *mr, hwaddr addr, hwaddr size)
 {
     /*
@@ -4135,6 +4180,16 @@ int ram_block_discard_range(RAMBlock *rb, uint64_t offset, size_t length)
          */
         need_madvise = (rb->page_size == qemu_real_host_page_size());
         need_fallocate = rb->fd != -1;
+//// --- Begin LibAFL code ---
+#ifndef _WIN32
+        if (rb->libafl_file_mapped) {
+            ret = libafl_ram_block_discard_file_mapped(rb, offset, length);
+            trace_ram_block_discard_range(rb->idstr, host_startaddr, length,
+                                          false, false, ret);
+            goto err;
+        }
+#endif
+//// --- End LibAFL code ---
         if (need_fallocate) {
             /* For a file, this causes the area of the file to be zero'd
              * if read, and for hugetlbfs also causes it to be unmapped
@@ -61,6 +61,10 @@
 #include "system/tpm.h"
 #include "trace.h"
 
+//// --- Begin LibAFL code ---
+#include "system/cpu-timers.h"
+//// --- End LibAFL code ---
+
 static NotifierList exit_notifiers =
     NOTIFIER_LIST_INITIALIZER(exit_notifiers);
 
@@ -72,6 +76,7 @@ static QemuMutex vmstop_lock;
 
 //// --- Begin LibAFL code ---
 void libafl_exit_request_internal(CPUState* cpu, uint64_t pc, ShutdownCause cause, int signal);
+void libafl_exit_signal_vm_start(void);
 //// --- End LibAFL code ---
 
 typedef struct {
@@ -431,6 +436,10 @@ static uint32_t wakeup_reason_mask = ~(1 << QEMU_WAKEUP_REASON_NONE);
 //// --- Begin LibAFL code ---
 #ifdef AS_LIB
 static int return_requested;
+// return to the harness without leaving RUN_STATE_RUNNING
+static bool fast_return_enabled;
+// vCPUs have been paused by a fast return and wait for libafl_vm_resume_fast
+static bool fast_paused;
 #endif
 //// --- End LibAFL code ---
 
@@ -891,6 +900,53 @@ void qemu_system_return_request(void)
     return_requested = 1;
     qemu_notify_event();
 }
+
+void libafl_set_fast_return(bool enabled)
+{
+    fast_return_enabled = enabled;
+}
+
+bool libafl_vm_fast_paused(void)
+{
+    return fast_paused && runstate_is_running();
+}
+
+/*
+ * Stop the vCPUs and the virtual clock, but keep the VM in RUN_STATE_RUNNING.
+ * Compared to vm_stop(), this skips the runstate transition, the VM state
+ * change notifiers and the block layer drain / flush.
+ */
+static void libafl_vm_pause_fast(void)
+{
+    cpu_disable_ticks();
+    pause_all_vcpus();
+    fast_paused = true;
+}
+
+bool libafl_vm_resume_fast(void)
+{
+    if (!libafl_vm_fast_paused()) {
+        // Something performed a real runstate transition in between.
+        fast_paused = false;
+        return false;
+    }
+
+    fast_paused = false;
+    libafl_exit_signal_vm_start();
+    cpu_enable_ticks();
+    resume_all_vcpus();
+
+    return true;
+}
+
+void libafl_vm_leave_fast_pause(void)
+{
+    if (libafl_vm_fast_paused()) {
+        fast_paused = false;
+        /* The vCPUs and the ticks are already stopped */
+        vm_stop(RUN_STATE_RET);
+    }
+}
 #endif
 //// --- End LibAFL code ---
 
@@ -909,7 +965,11 @@ static bool main_loop_should_exit(int *status)
 #ifdef AS_LIB
     if (qemu_return_requested()) {
         // exit back to libafl qemu harness
-        vm_stop(RUN_STATE_RET);
+        if (fast_return_enabled && runstate_is_running()) {
+            libafl_vm_pause_fast();
+        } else {
+            vm_stop(RUN_STATE_RET);
+        }
         return true;
     }
 #endif
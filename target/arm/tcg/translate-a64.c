@@ -1690,9 +1690,28 @@ static inline void gen_check_sp_alignment(DisasContext *s)
  * match up with those in the manual.
  */
 
+//// --- Begin LibAFL code ---
+
+void libafl_gen_call(vaddr pc, vaddr ret_addr);
+void libafl_gen_ret(vaddr pc);
+
+//// --- End LibAFL code ---
+
 static bool trans_B(DisasContext *s, arg_i *a)
 {
     reset_btype(s);
+
+//// --- Begin LibAFL code ---
+
+    // Hot traces: translate the destination in the same TB.
+    if (translator_trace_can_continue(&s->base, s->pc_curr + a->imm)) {
+        gen_a64_update_pc(s, a->imm);
+        translator_trace_continue(&s->base, s->pc_curr + a->imm);
+        return true;
+    }
+
+//// --- End LibAFL code ---
+
     gen_goto_tb(s, 0, a->imm);
     return true;
 }
@@ -1705,6 +1724,13 @@ static bool trans_BL(DisasContext *s, arg_i *a)
     if (s->gcs_en) {
         gen_add_gcs_record(s, link);
     }
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + 4);
+
+//// --- End LibAFL code ---
+
     tcg_gen_mov_i64(cpu_reg(s, 30), link);
 
     reset_btype(s);
@@ -1810,6 +1836,13 @@ static bool trans_BLR(DisasContext *s, arg_r *a)
         gen_add_gcs_record(s, link);
     }
     gen_a64_set_pc(s, cpu_reg(s, a->rn));
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + 4);
+
+//// --- End LibAFL code ---
+
     tcg_gen_mov_i64(cpu_reg(s, 30), link);
 
     set_btype_for_blr(s);
@@ -1826,6 +1859,13 @@ static bool trans_RET(DisasContext *s, arg_r *a)
     } else {
         gen_a64_set_pc(s, target);
     }
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_ret(s->pc_curr);
+
+//// --- End LibAFL code ---
+
     s->base.is_jmp = DISAS_JUMP;
     return true;
 }
@@ -1882,6 +1922,13 @@ static bool trans_BLRAZ(DisasContext *s, arg_braz *a)
         gen_add_gcs_record(s, link);
     }
     gen_a64_set_pc(s, dst);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + 4);
+
+//// --- End LibAFL code ---
+
     tcg_gen_mov_i64(cpu_reg(s, 30), link);
 
     set_btype_for_blr(s);
@@ -1904,6 +1951,13 @@ static bool trans_RETA(DisasContext *s, arg_reta *a)
     } else {
         gen_a64_set_pc(s, dst);
     }
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_ret(s->pc_curr);
+
+//// --- End LibAFL code ---
+
     s->base.is_jmp = DISAS_JUMP;
     return true;
 }
@@ -1937,6 +1991,13 @@ static bool trans_BLRA(DisasContext *s, arg_bra *a)
         gen_add_gcs_record(s, link);
     }
     gen_a64_set_pc(s, dst);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + 4);
+
+//// --- End LibAFL code ---
+
     tcg_gen_mov_i64(cpu_reg(s, 30), link);
 
     set_btype_for_blr(s);
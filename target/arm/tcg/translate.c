@@ -2446,6 +2446,8 @@ static bool store_reg_kind(DisasContext *s, int rd,
 //// --- Begin LibAFL code ---
 
 void libafl_gen_cmp(target_ulong pc, TCGv op0, TCGv op1, MemOp ot);
+void libafl_gen_call(vaddr pc, vaddr ret_addr);
+void libafl_gen_ret(vaddr pc);
 
 //// --- End LibAFL code ---
 
@@ -3483,6 +3485,15 @@ static bool trans_BX(DisasContext *s, arg_BX *a)
     if (!ENABLE_ARCH_4T) {
         return false;
     }
+
+//// --- Begin LibAFL code ---
+
+    if (a->rm == 14) {
+        libafl_gen_ret(s->pc_curr);
+    }
+
+//// --- End LibAFL code ---
+
     gen_bx_excret(s, load_reg(s, a->rm));
     return true;
 }
@@ -3518,6 +3529,13 @@ static bool trans_BLX_r(DisasContext *s, arg_BLX_r *a)
     }
     tmp = load_reg(s, a->rm);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + curr_insn_len(s));
+
+//// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
@@ -3964,6 +3982,17 @@ static bool op_load_ri(DisasContext *s, arg_ldst_ri *a,
      * ensure correct behavior with overlapping index registers.
      */
     op_addr_ri_post(s, a, addr);
+
+//// --- Begin LibAFL code ---
+
+    // ldr pc, [sp], #4: post-indexed, which always writes back (w is only
+    // set for T32), popping upwards. Other forms leave sp alone.
+    if (a->rt == 15 && a->rn == 13 && !a->p && a->u) {
+        libafl_gen_ret(s->pc_curr);
+    }
+
+//// --- End LibAFL code ---
+
     store_reg_from_load(s, a->rt, tmp);
     return true;
 }
@@ -5270,6 +5299,15 @@ static bool do_ldm(DisasContext *s, arg_ldst_block *a)
 
     op_addr_block_post(s, a, addr, n);
 
+//// --- Begin LibAFL code ---
+
+    // pop {..., pc}
+    if (!exc_return && a->rn == 13 && (list & (1 << 15))) {
+        libafl_gen_ret(s->pc_curr);
+    }
+
+//// --- End LibAFL code ---
+
     if (loaded_base) {
         /* Note that we reject base == pc above.  */
         store_reg(s, a->rn, loaded_var);
@@ -5384,6 +5422,13 @@ static bool trans_B_cond_thumb(DisasContext *s, arg_ci *a)
 static bool trans_BL(DisasContext *s, arg_i *a)
 {
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + curr_insn_len(s));
+
+//// --- End LibAFL code ---
+
     gen_jmp(s, jmp_diff(s, a->imm));
     return true;
 }
@@ -5404,6 +5449,13 @@ static bool trans_BLX_i(DisasContext *s, arg_BLX_i *a)
     }
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
     store_cpu_field_constant(!s->thumb, thumb);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + curr_insn_len(s));
+
+//// --- End LibAFL code ---
+
     /* This jump is computed from an aligned PC: subtract off the low bits. */
     gen_jmp(s, jmp_diff(s, a->imm - (s->pc_curr & 3)));
     return true;
@@ -5423,6 +5475,13 @@ static bool trans_BL_suffix(DisasContext *s, arg_BL_suffix *a)
     assert(!arm_dc_feature(s, ARM_FEATURE_THUMB2));
     tcg_gen_addi_i32(tmp, cpu_R[14], (a->imm << 1) | 1);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | 1);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + curr_insn_len(s));
+
+//// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
@@ -5439,6 +5498,13 @@ static bool trans_BLX_suffix(DisasContext *s, arg_BLX_suffix *a)
     tcg_gen_addi_i32(tmp, cpu_R[14], a->imm << 1);
     tcg_gen_andi_i32(tmp, tmp, 0xfffffffc);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | 1);
+
+//// --- Begin LibAFL code ---
+
+    libafl_gen_call(s->pc_curr, s->pc_curr + curr_insn_len(s));
+
+//// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
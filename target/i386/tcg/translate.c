@@ -42,7 +42,9 @@
 //// --- Begin LibAFL code ---
 
 #include "libafl/exit.h"
+#include "libafl/hooks/tcg/call.h"
 #include "libafl/hooks/tcg/cmp.h"
+#include "libafl/ibc.h"
 
 //// --- End LibAFL code ---
 
@@ -148,6 +150,13 @@ typedef struct DisasContext {
     sigjmp_buf jmpbuf;
     TCGOp *prev_insn_start;
     TCGOp *prev_insn_end;
+
+//// --- Begin LibAFL code ---
+
+    /* The DISAS_JUMP ending the TB cannot change the TB flags */
+    bool libafl_ibc;
+
+//// --- End LibAFL code ---
 } DisasContext;
 
 /*
@@ -2327,7 +2336,13 @@ gen_eob(DisasContext *s, int mode)
     } else if (mode == DISAS_JUMP &&
                /* give irqs a chance to happen */
                !inhibit_reset) {
-        tcg_gen_lookup_and_goto_ptr();
+//// --- Begin LibAFL code ---
+        if (s->libafl_ibc) {
+            libafl_gen_lookup_and_goto_ptr(cpu_eip);
+        } else {
+            tcg_gen_lookup_and_goto_ptr();
+        }
+//// --- End LibAFL code ---
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -2386,6 +2401,9 @@ static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
             tcg_gen_movi_tl(cpu_eip, new_eip);
         }
         if (s->jmp_opt) {
+//// --- Begin LibAFL code ---
+            s->libafl_ibc = true;
+//// --- End LibAFL code ---
             gen_eob(s, DISAS_JUMP);   /* jump to another page */
         } else {
             gen_eob(s, DISAS_EOB_ONLY);  /* exit to main loop */
@@ -3179,10 +3197,11 @@ static void gen_multi0F(DisasContext *s, X86DecodedInsn *decode)
             gen_bnd_jmp(s);
             s->base.is_jmp = DISAS_JUMP;
 
-            // gen helper to signal to get out
+            // gen helper to handle the hypercall, or signal to get out
             TCGv_i64 new_pc = tcg_temp_new_i64();
             tcg_gen_extu_tl_i64(new_pc, s->T0);
-            gen_helper_libafl_qemu_handle_custom_insn(tcg_env, new_pc, tcg_constant_i32(LIBAFL_CUSTOM_INSN_NYX));
+            gen_update_cc_op(s);
+            gen_helper_libafl_qemu_handle_nyx_hypercall(tcg_env, new_pc);
             break;
 //// --- End LibAFL code ---
 
@@ -3789,6 +3808,10 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->cs_base = dc->base.tb->cs_base;
     dc->pc_save = dc->base.pc_next;
     dc->flags = flags;
+
+//// --- Begin LibAFL code ---
+    dc->libafl_ibc = false;
+//// --- End LibAFL code ---
 #ifndef CONFIG_USER_ONLY
     dc->cpl = cpl;
     dc->iopl = iopl;
@@ -620,6 +620,14 @@ static void gen_ctr_jal(DisasContext *ctx, int rd, target_ulong imm)
 }
 #endif
 
+//// --- Begin LibAFL code ---
+
+void libafl_gen_call(vaddr pc, vaddr ret_addr);
+void libafl_gen_ret(vaddr pc);
+void libafl_gen_lookup_and_goto_ptr(TCGv pc);
+
+//// --- End LibAFL code ---
+
 static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
 {
     TCGv succ_pc = dest_gpr(ctx, rd);
@@ -642,9 +650,36 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     }
 #endif
 
+//// --- Begin LibAFL code ---
+
+    // Direct calls: jal x1 / jal x5
+    if (rd == xRA || rd == xT0) {
+        libafl_gen_call(ctx->base.pc_next,
+                        ctx->base.pc_next + ctx->cur_insn_len);
+    }
+
+//// --- End LibAFL code ---
+
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+//// --- Begin LibAFL code ---
+
+    // Hot traces: translate the destination in the same TB.
+    target_ulong dest = ctx->base.pc_next + imm;
+    if (get_xl(ctx) == MXL_RV32) {
+        dest = (int32_t)dest;
+    }
+
+    if (!ctx->itrigger && imm >= (target_long)ctx->cur_insn_len &&
+        translator_trace_can_continue(&ctx->base, dest)) {
+        gen_update_pc(ctx, imm);
+        translator_trace_continue(&ctx->base, dest);
+        return;
+    }
+
+//// --- End LibAFL code ---
+
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -72,10 +72,32 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+//// --- Begin LibAFL code ---
+
+    /*
+     * Age of the regions, for eviction.  The clock ticks every time a
+     * region is (re)assigned to a context, and a region is stamped with
+     * the current tick when it is assigned and when one of its TBs is found
+     * through the QHT.  Pointer-sized, for atomic accesses on every host.
+     */
+    size_t clock;
+    size_t *last_use;
+
+//// --- End LibAFL code ---
 };
 
 static struct tcg_region_state region;
 
+//// --- Begin LibAFL code ---
+
+/* Number of regions to aim for, so that eviction does not drop too much. */
+#define LIBAFL_TCG_EVICT_REGIONS 8
+/* ... as long as regions stay reasonably large. */
+#define LIBAFL_TCG_EVICT_REGION_MIN (1 * MiB)
+
+//// --- End LibAFL code ---
+
 /*
  * This is an array of struct tcg_region_tree's, with padding.
  * We use void * to simplify the computation of region_trees[i]; each
@@ -181,6 +203,12 @@ static void tcg_region_trees_init(void)
 {
     size_t i;
 
+//// --- Begin LibAFL code ---
+
+    region.last_use = g_new0(size_t, region.n);
+
+//// --- End LibAFL code ---
+
     tree_size = ROUND_UP(sizeof(struct tcg_region_tree), qemu_dcache_linesize);
     region_trees = qemu_memalign(qemu_dcache_linesize, region.n * tree_size);
     for (i = 0; i < region.n; i++) {
@@ -311,6 +339,108 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+//// --- Begin LibAFL code ---
+
+static size_t tcg_region_tree_idx(struct tcg_region_tree *rt)
+{
+    return ((void *)rt - region_trees) / tree_size;
+}
+
+/* Call with region.lock held */
+static void tcg_region_stamp(size_t idx)
+{
+    qatomic_set(&region.clock, region.clock + 1);
+    qatomic_set(&region.last_use[idx], region.clock);
+}
+
+void tcg_region_touch(const void *tc_ptr)
+{
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree(tc_ptr);
+
+    if (rt) {
+        size_t *last_use = &region.last_use[tcg_region_tree_idx(rt)];
+        size_t clock = qatomic_read(&region.clock);
+
+        /*
+         * Racy, but a stale stamp only makes eviction less accurate.
+         * The clock rarely ticks: skip the store, and the cache line
+         * bouncing between vCPUs, when the stamp is already current.
+         */
+        if (qatomic_read(last_use) != clock) {
+            qatomic_set(last_use, clock);
+        }
+    }
+}
+
+/* Call from a safe-work context */
+ssize_t tcg_region_evict_victim(void)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    ssize_t victim = -1;
+
+    qemu_mutex_lock(&region.lock);
+    /* Free regions are left, nothing to evict. */
+    if (region.current == region.n) {
+        for (size_t i = 0; i < region.n; i++) {
+            bool in_use = false;
+
+            for (unsigned int j = 0; j < n_ctxs; j++) {
+                const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+
+                if (tcg_region_tree_idx(
+                        tc_ptr_to_region_tree(s->code_gen_buffer)) == i) {
+                    in_use = true;
+                    break;
+                }
+            }
+
+            if (!in_use && (victim < 0 ||
+                            qatomic_read(&region.last_use[i]) <
+                            qatomic_read(&region.last_use[victim]))) {
+                victim = i;
+            }
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    return victim;
+}
+
+void tcg_region_foreach_tb(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/* Call from a safe-work context, once all the TBs of @idx are invalidated */
+void tcg_region_reuse(TCGContext *s, size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    size_t size_full = s->code_gen_buffer_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(idx, &start, &end);
+
+    qemu_mutex_lock(&region.lock);
+    /* The region left by @s is now full, the victim is not anymore. */
+    region.agg_size_full += size_full - TCG_HIGHWATER;
+    region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+    tcg_region_assign(s, idx);
+    tcg_region_stamp(idx);
+    qemu_mutex_unlock(&region.lock);
+}
+
+//// --- End LibAFL code ---
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -363,6 +493,9 @@ static bool tcg_region_alloc__locked(TCGContext *s)
         return true;
     }
     tcg_region_assign(s, region.current);
+//// --- Begin LibAFL code ---
+    tcg_region_stamp(region.current);
+//// --- End LibAFL code ---
     region.current++;
     return false;
 }
@@ -412,6 +545,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+//// --- Begin LibAFL code ---
+    memset(region.last_use, 0, region.n * sizeof(region.last_use[0]));
+//// --- End LibAFL code ---
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -424,8 +560,20 @@ void tcg_region_reset_all(void)
 
 static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
 {
+//// --- Begin LibAFL code ---
+
+    /*
+     * Eviction works at region granularity: even with a single TCG context
+     * (user-mode, or one vCPU thread) split the buffer in a few regions, the
+     * context simply moves to the next one when the current one is full.
+     */
+    size_t n_evict_regions = MAX(1, MIN(LIBAFL_TCG_EVICT_REGIONS,
+                                        tb_size / LIBAFL_TCG_EVICT_REGION_MIN));
+
+//// --- End LibAFL code ---
+
 #ifdef CONFIG_USER_ONLY
-    return 1;
+    return n_evict_regions;
 #else
     size_t n_regions;
 
@@ -438,7 +586,7 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
      * Use a single region if all we have is one vCPU thread.
      */
     if (max_threads == 1) {
-        return 1;
+        return n_evict_regions;
     }
 
     /*
@@ -64,6 +64,7 @@
 
 //// --- Begin LibAFL code ---
 #include "libafl/tcg.h"
+#include "libafl/profile.h"
 //// --- End LibAFL code ---
 
 /* Forward declarations for functions declared in tcg-target.c.inc and
@@ -248,6 +249,14 @@ static TCGAtomAlign atom_and_align_for_opc(TCGContext *s, MemOp opc,
 bool tcg_use_softmmu;
 #endif
 
+//// --- Begin LibAFL code ---
+
+LibaflDirectMap libafl_direct_map[LIBAFL_DIRECT_MAP_MAX];
+int libafl_direct_map_nb;
+int libafl_direct_map_mmu_idx = -1;
+
+//// --- End LibAFL code ---
+
 TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 
@@ -1995,6 +2004,12 @@ void tcg_func_start(TCGContext *s)
     s->emit_before_op = NULL;
     QSIMPLEQ_INIT(&s->labels);
 
+    //// --- Begin LibAFL code ---
+
+    s->libafl_tier0 = false;
+
+    //// --- End LibAFL code ---
+
     tcg_debug_assert(s->addr_type <= TCG_TYPE_REG);
 }
 
@@ -2636,6 +2651,12 @@ void tcg_gen_callN(void *func, TCGHelperInfo *info,
         g_once_init_leave(HELPER_INFO_INIT(info), HELPER_INFO_INIT_VAL(info));
     }
 
+    //// --- Begin LibAFL code ---
+    if (unlikely(qatomic_read(&libafl_profile_helper_calls))) {
+        libafl_profile_gen_call(info);
+    }
+    //// --- End LibAFL code ---
+
     total_args = info->nr_out + info->nr_in + 2;
     op = tcg_op_alloc(INDEX_op_call, total_args);
 
@@ -6885,7 +6906,17 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     /* Do not reuse any EBB that may be allocated within the TB. */
     tcg_temp_ebb_reset_freed(s);
 
-    tcg_optimize(s);
+    //// --- Begin LibAFL code ---
+
+    /*
+     * Tier-0 code skips the optimizer.  Without TCG_TARGET_HAS_tst the
+     * optimizer is also what lowers the TST conditions, so it must run.
+     */
+    if (!TCG_TARGET_HAS_tst || !s->libafl_tier0) {
+        tcg_optimize(s);
+    }
+
+    //// --- End LibAFL code ---
 
     reachable_code_pass(s);
     liveness_pass_0(s);
@@ -0,0 +1,102 @@
+/*
+ * Snapshots taken and loaded between two fast runs
+ *
+ * A fast return leaves the VM in RUN_STATE_RUNNING with its vCPUs paused.
+ * Saving or loading a snapshot then must neither start the guest behind the
+ * harness, nor leave the VM stopped for the next run.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "system/runstate.h"
+
+#include "libafl/qemu_snapshot.h"
+
+#include "libafl-test.h"
+
+#define RUN_NS (10 * SCALE_MS)
+
+static char *image;
+
+static void test_snapshot(enum libafl_qemu_snapshot_backend backend)
+{
+    char name[] = "fast";
+    int64_t saved_clock;
+
+    g_assert(libafl_set_qemu_snapshot_backend(
+        backend, LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE));
+
+    g_assert(libafl_test_run_fast(RUN_NS));
+    g_assert(libafl_vm_fast_paused());
+
+    saved_clock = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    libafl_save_qemu_snapshot(name, true);
+
+    /* The guest must not run until the next run */
+    g_usleep(50 * 1000);
+    g_assert(!runstate_is_running());
+    g_assert_cmpint(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), ==, saved_clock);
+
+    g_assert(libafl_test_run_fast(RUN_NS));
+    g_assert(libafl_vm_fast_paused());
+    g_assert_cmpint(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), >, saved_clock);
+
+    libafl_load_qemu_snapshot(name, true);
+
+    g_usleep(50 * 1000);
+    g_assert(!runstate_is_running());
+    g_assert_cmpint(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), ==, saved_clock);
+
+    /* The next runs restart the VM, and return fast again */
+    g_assert(libafl_test_run_fast(RUN_NS));
+    g_assert(libafl_vm_fast_paused());
+    g_assert(libafl_test_run_fast(RUN_NS));
+    g_assert(libafl_vm_fast_paused());
+}
+
+static void test_memory(void)
+{
+    test_snapshot(LIBAFL_QEMU_SNAPSHOT_MEMORY);
+    libafl_delete_qemu_snapshot((char *)"fast");
+}
+
+static void test_qcow2(void)
+{
+    if (!image) {
+        g_test_skip("qemu-img not available");
+        return;
+    }
+
+    test_snapshot(LIBAFL_QEMU_SNAPSHOT_QCOW2);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *args = NULL;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    image = libafl_test_mkimg(16);
+    if (image) {
+        args = g_strdup_printf("-drive if=none,id=disk0,format=qcow2,file=%s",
+                               image);
+    }
+    libafl_test_init(args);
+
+    g_test_add_func("/libafl/fast-return-snapshot/memory", test_memory);
+    g_test_add_func("/libafl/fast-return-snapshot/qcow2", test_qcow2);
+
+    ret = g_test_run();
+
+    if (image) {
+        unlink(image);
+        g_free(image);
+    }
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+/*
+ * Idle skip and the guest cycle counters
+ *
+ * The guest halts itself. The time skipped while every vCPU is halted must
+ * pass for the counters derived from cpu_get_ticks(), e.g. the x86 TSC, as
+ * it does for the virtual clock.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "hw/core/cpu.h"
+#include "system/cpu-timers.h"
+
+#include "libafl/system.h"
+
+#include "libafl-test.h"
+
+#define SKIP_NS (5 * NANOSECONDS_PER_SECOND)
+
+/* get_clock() and the host cycle counter before QEMU was initialized */
+static int64_t ref_ns, ref_ticks;
+
+static void test_tsc(void)
+{
+    int64_t clock, ticks;
+    uint64_t nb_skips, skipped_ns;
+    double rate, dclock, dticks;
+
+    libafl_qemu_set_idle_skip(true);
+
+    clock = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    ticks = cpu_get_ticks();
+
+    g_assert(libafl_test_run_fast(SKIP_NS));
+    g_assert(first_cpu->halted);
+
+    dclock = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - clock;
+    dticks = cpu_get_ticks() - ticks;
+
+    /*
+     * Apart from the few instructions before hlt, the virtual time that
+     * passed is the skipped one.
+     */
+    libafl_qemu_idle_skip_stats(&nb_skips, &skipped_ns);
+    g_assert_cmpuint(nb_skips, >, 0);
+    g_assert_cmpfloat(dclock, >=, SKIP_NS);
+    g_assert_cmpfloat(skipped_ns, >=, dclock - SKIP_NS / 2);
+
+    /* The guest cycle counter sees the same time pass, at the host rate */
+    rate = (double)(cpu_get_host_ticks() - ref_ticks) /
+           (get_clock() - ref_ns);
+    g_assert_cmpfloat(dticks, >=, 0.9 * rate * dclock);
+    g_assert_cmpfloat(dticks, <=, 1.1 * rate * dclock);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *bios = NULL;
+    g_autofree char *args = NULL;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    bios = libafl_test_mkbios();
+    args = g_strdup_printf("-bios %s", bios);
+
+    ref_ns = get_clock();
+    ref_ticks = cpu_get_host_ticks();
+    libafl_test_init(args);
+
+    g_test_add_func("/libafl/idle-skip/tsc", test_tsc);
+
+    ret = g_test_run();
+
+    unlink(bios);
+    return ret;
+}
@@ -0,0 +1,137 @@
+/*
+ * Helpers for the tests of the LibAFL API
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "system/runstate.h"
+
+#include "libafl/system.h"
+
+#include "libafl-test.h"
+
+#define LIBAFL_TEST_RUN_TIMEOUT_MS 10000
+
+static QEMUTimer *deadline_timer;
+static QEMUTimer *timeout_timer;
+static bool deadline_reached;
+
+char *libafl_test_mkimg(unsigned size_mb)
+{
+    const char *qemu_img = getenv("LIBAFL_TEST_QEMU_IMG");
+    g_autofree char *size = g_strdup_printf("%uM", size_mb);
+    GError *err = NULL;
+    char *path;
+    int exit_status = -1;
+    int fd;
+
+    if (!qemu_img || access(qemu_img, X_OK)) {
+        return NULL;
+    }
+
+    fd = g_file_open_tmp("libafl-test-XXXXXX.qcow2", &path, &err);
+    g_assert_no_error(err);
+    close(fd);
+
+    const char *args[] = { qemu_img, "create", "-q", "-f", "qcow2", path,
+                           size, NULL };
+    g_assert(g_spawn_sync(NULL, (char **)args, NULL, 0, NULL, NULL, NULL,
+                          NULL, &exit_status, NULL));
+    g_assert_cmpint(exit_status, ==, 0);
+
+    return path;
+}
+
+char *libafl_test_mkbios(void)
+{
+    static const uint8_t halt_loop[] = {
+        0xfa,       /* cli */
+        0xf4,       /* hlt */
+        0xeb, 0xfd, /* jmp hlt */
+    };
+    const size_t size = 64 * 1024;
+    g_autofree uint8_t *bios = g_malloc0(size);
+    GError *err = NULL;
+    char *path;
+    int fd;
+
+    /* At the reset vector, 16 bytes below the end of the image */
+    memcpy(bios + size - 16, halt_loop, sizeof(halt_loop));
+
+    fd = g_file_open_tmp("libafl-test-XXXXXX.bin", &path, &err);
+    g_assert_no_error(err);
+    g_assert_cmpint(write(fd, bios, size), ==, size);
+    close(fd);
+
+    return path;
+}
+
+static void deadline_cb(void *opaque)
+{
+    deadline_reached = true;
+    qemu_system_return_request();
+}
+
+static void timeout_cb(void *opaque)
+{
+    qemu_system_return_request();
+}
+
+void libafl_test_init(const char *extra_args)
+{
+    const char *bios_dir = getenv("LIBAFL_TEST_BIOS_DIR");
+    const char *args[] = { "libafl-test", "-machine", "q35", "-accel", "tcg",
+                           "-nodefaults", "-display", "none", "-S" };
+    /* Kept for the lifetime of QEMU, which holds pointers into it */
+    GPtrArray *argv = g_ptr_array_new();
+    char **extra;
+
+    for (size_t i = 0; i < ARRAY_SIZE(args); i++) {
+        g_ptr_array_add(argv, (char *)args[i]);
+    }
+    if (bios_dir) {
+        g_ptr_array_add(argv, (char *)"-L");
+        g_ptr_array_add(argv, (char *)bios_dir);
+    }
+    if (extra_args && *extra_args) {
+        extra = g_strsplit(extra_args, " ", -1);
+        for (char **arg = extra; *arg; arg++) {
+            g_ptr_array_add(argv, *arg);
+        }
+    }
+    g_ptr_array_add(argv, NULL);
+
+    libafl_qemu_init(argv->len - 1, (char **)argv->pdata);
+
+    deadline_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, deadline_cb, NULL);
+    timeout_timer = timer_new_ms(QEMU_CLOCK_REALTIME, timeout_cb, NULL);
+}
+
+static bool libafl_test_run_for(int64_t ns, int (*run)(void))
+{
+    deadline_reached = false;
+    timer_mod(deadline_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + ns);
+    timer_mod(timeout_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                             LIBAFL_TEST_RUN_TIMEOUT_MS);
+
+    run();
+
+    timer_del(deadline_timer);
+    timer_del(timeout_timer);
+
+    return deadline_reached;
+}
+
+bool libafl_test_run(int64_t ns)
+{
+    return libafl_test_run_for(ns, libafl_qemu_run);
+}
+
+bool libafl_test_run_fast(int64_t ns)
+{
+    return libafl_test_run_for(ns, libafl_qemu_run_fast);
+}
@@ -0,0 +1,44 @@
+/*
+ * Helpers for the tests of the LibAFL API
+ *
+ * The tests link against the emulator built as a shared library, and drive
+ * it like a fuzzer does: from the main thread, between calls to the run
+ * functions, with the BQL held.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef LIBAFL_TEST_H
+#define LIBAFL_TEST_H
+
+/*
+ * Creates a qcow2 image of size_mb MiB with qemu-img. Returns its path, to
+ * free and unlink, or NULL if qemu-img is not available.
+ */
+char *libafl_test_mkimg(unsigned size_mb);
+
+/*
+ * Creates an x86 BIOS image whose reset vector halts the vCPU, with
+ * interrupts off, for -bios. Returns its path, to free and unlink.
+ */
+char *libafl_test_mkbios(void);
+
+/*
+ * Starts QEMU with an x86_64 q35 machine, stopped and without default
+ * devices, followed by extra_args, split on spaces. Once per process.
+ */
+void libafl_test_init(const char *extra_args);
+
+/*
+ * Runs the VM with libafl_qemu_run_fast() until ns of virtual time have
+ * elapsed. Returns false if the guest did not reach it within a few seconds
+ * of real time, e.g. because the VM was left stopped.
+ */
+bool libafl_test_run_fast(int64_t ns);
+
+/* Same, with libafl_qemu_run(): the VM is stopped when it returns. */
+bool libafl_test_run(int64_t ns);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Translation cache of the vectored memory accesses
+ *
+ * The cache must not return the old host page of a guest page that was
+ * remapped, even before the vCPU has processed the TLB flush.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "exec/cpu-common.h"
+#include "system/memory.h"
+#include "system/address-spaces.h"
+#include "hw/core/cpu.h"
+
+#include "libafl/memory.h"
+
+#include "libafl-test.h"
+
+/* In the RAM of the machine, identity mapped in real mode */
+#define PAGE_ADDR 0x4000000
+#define PAGE_SIZE 4096
+
+static uint8_t read_byte(void)
+{
+    uint8_t byte;
+    struct libafl_mem_op op = {
+        .addr = PAGE_ADDR,
+        .buf = &byte,
+        .len = 1,
+    };
+
+    g_assert_cmpuint(libafl_qemu_read_vectored(first_cpu, &op, 1), ==, 1);
+    return byte;
+}
+
+static void test_remap(void)
+{
+    MemoryRegion *overlay = g_new0(MemoryRegion, 1);
+    uint8_t byte = 0x5a;
+    uint64_t hits, misses;
+
+    cpu_physical_memory_write(PAGE_ADDR, &byte, 1);
+    libafl_qemu_mem_cache_flush(first_cpu);
+
+    g_assert_cmpuint(read_byte(), ==, 0x5a);
+    g_assert_cmpuint(read_byte(), ==, 0x5a);
+    libafl_qemu_mem_cache_stats(first_cpu, &hits, &misses);
+    g_assert_cmpuint(hits, >, 0);
+
+    /* Another page of RAM over the cached one */
+    memory_region_init_ram_nomigrate(overlay, NULL, "libafl-test-overlay",
+                                     PAGE_SIZE, &error_fatal);
+    memset(memory_region_get_ram_ptr(overlay), 0xa5, PAGE_SIZE);
+    memory_region_add_subregion_overlap(get_system_memory(), PAGE_ADDR,
+                                        overlay, 1);
+    g_assert_cmpuint(read_byte(), ==, 0xa5);
+
+    /* Once the vCPU has flushed its TLB too */
+    g_assert(libafl_test_run_fast(1000000));
+    g_assert_cmpuint(read_byte(), ==, 0xa5);
+
+    /* And back */
+    memory_region_del_subregion(get_system_memory(), overlay);
+    g_assert_cmpuint(read_byte(), ==, 0x5a);
+    g_assert(libafl_test_run_fast(1000000));
+    g_assert_cmpuint(read_byte(), ==, 0x5a);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    libafl_test_init(NULL);
+
+    g_test_add_func("/libafl/mem-cache/remap", test_remap);
+
+    return g_test_run();
+}
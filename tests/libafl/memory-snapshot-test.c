@@ -0,0 +1,73 @@
+/*
+ * Snapshots of the memory backend saved and loaded back
+ *
+ * The migration stream is kept in memory, optionally compressed: loading it
+ * must bring back the guest RAM as it was when it was saved.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/cpu-common.h"
+
+#include "libafl/qemu_snapshot.h"
+
+#include "libafl-test.h"
+
+#define RAM_ADDR 0x100000
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = seed + i;
+    }
+}
+
+static void test_round_trip(const void *opaque)
+{
+    enum libafl_qemu_snapshot_compression compression =
+        GPOINTER_TO_INT(opaque);
+    uint8_t saved[5000], later[5000], buf[5000];
+
+    g_assert(libafl_set_qemu_snapshot_backend(LIBAFL_QEMU_SNAPSHOT_MEMORY,
+                                              compression));
+
+    fill(saved, sizeof(saved), 0x21);
+    fill(later, sizeof(later), 0x99);
+
+    cpu_physical_memory_write(RAM_ADDR, saved, sizeof(saved));
+    libafl_save_qemu_snapshot((char *)"round-trip", true);
+
+    cpu_physical_memory_write(RAM_ADDR, later, sizeof(later));
+    libafl_load_qemu_snapshot((char *)"round-trip", true);
+
+    cpu_physical_memory_read(RAM_ADDR, buf, sizeof(buf));
+    g_assert(!memcmp(buf, saved, sizeof(saved)));
+
+    /* The snapshot can be loaded again */
+    cpu_physical_memory_write(RAM_ADDR, later, sizeof(later));
+    libafl_load_qemu_snapshot((char *)"round-trip", true);
+
+    cpu_physical_memory_read(RAM_ADDR, buf, sizeof(buf));
+    g_assert(!memcmp(buf, saved, sizeof(saved)));
+
+    libafl_delete_qemu_snapshot((char *)"round-trip");
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    libafl_test_init(NULL);
+
+    g_test_add_data_func("/libafl/memory-snapshot/none",
+                         GINT_TO_POINTER(LIBAFL_QEMU_SNAPSHOT_COMPRESSION_NONE),
+                         test_round_trip);
+    g_test_add_data_func("/libafl/memory-snapshot/zlib",
+                         GINT_TO_POINTER(LIBAFL_QEMU_SNAPSHOT_COMPRESSION_ZLIB),
+                         test_round_trip);
+
+    return g_test_run();
+}
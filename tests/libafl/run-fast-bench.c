@@ -0,0 +1,73 @@
+/*
+ * Round trips through libafl_qemu_run and libafl_qemu_run_fast
+ *
+ * Each run lets a halted guest reach a virtual clock deadline, skipped over
+ * with idle skip, and returns: the time of a run is the cost of returning to
+ * the harness and of resuming the VM. Both entry points go through the main
+ * loop; the fast one skips the runstate transitions, the VM state change
+ * notifiers and the drain and flush of the block devices.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#include "libafl/system.h"
+
+#include "libafl-test.h"
+
+#define RUN_NS (100 * SCALE_US)
+
+static void bench(const void *opaque)
+{
+    bool fast = GPOINTER_TO_INT(opaque);
+    bool (*run)(int64_t ns) = fast ? libafl_test_run_fast : libafl_test_run;
+    unsigned long nb_runs = 0;
+
+    g_test_timer_start();
+    do {
+        g_assert(run(RUN_NS));
+        nb_runs++;
+    } while (g_test_timer_elapsed() < 2.0);
+
+    g_test_message("%s: %lu runs, %.2f us/run",
+                   fast ? "libafl_qemu_run_fast" : "libafl_qemu_run",
+                   nb_runs, g_test_timer_last() * 1e6 / nb_runs);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *bios = NULL;
+    g_autofree char *image = NULL;
+    g_autofree char *args = NULL;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    bios = libafl_test_mkbios();
+    image = libafl_test_mkimg(16);
+    if (image) {
+        /* A block device, for the drain and flush of vm_stop */
+        args = g_strdup_printf("-bios %s -drive if=none,id=disk0,format=qcow2,"
+                               "file=%s", bios, image);
+    } else {
+        args = g_strdup_printf("-bios %s", bios);
+    }
+    libafl_test_init(args);
+    libafl_qemu_set_idle_skip(true);
+
+    g_test_add_data_func("/libafl/run/speed", GINT_TO_POINTER(false), bench);
+    g_test_add_data_func("/libafl/run-fast/speed", GINT_TO_POINTER(true),
+                         bench);
+
+    ret = g_test_run();
+
+    unlink(bios);
+    if (image) {
+        unlink(image);
+    }
+    return ret;
+}
@@ -0,0 +1,136 @@
+/*
+ * SYX snapshots exported to a file and imported back
+ *
+ * The block device writes done before the snapshot live in the COW cache
+ * only, so the file must carry them along with the guest RAM.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/cpu-common.h"
+#include "system/block-backend.h"
+
+#include "libafl/syx-snapshot/syx-snapshot.h"
+
+#include "libafl-test.h"
+
+#define DISK_OFFSET (64 * 1024)
+#define RAM_ADDR 0x100000
+
+static char *image;
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = seed + i;
+    }
+}
+
+static void check_disk(BlockBackend *blk, const uint8_t *expected, size_t len)
+{
+    g_autofree uint8_t *buf = g_malloc(len);
+
+    g_assert_cmpint(blk_pread(blk, DISK_OFFSET, len, buf, 0), ==, 0);
+    g_assert(!memcmp(buf, expected, len));
+}
+
+static void check_ram(const uint8_t *expected, size_t len)
+{
+    g_autofree uint8_t *buf = g_malloc(len);
+
+    cpu_physical_memory_read(RAM_ADDR, buf, len);
+    g_assert(!memcmp(buf, expected, len));
+}
+
+static void test_round_trip(void)
+{
+    /* Not aligned on COW cache chunks */
+    uint8_t boot[3000], fuzz[3000];
+    g_autofree char *path = NULL;
+    BlockBackend *blk;
+    SyxSnapshot *snapshot, *imported;
+    SyxSnapshotExport *ex;
+    int fd;
+
+    if (!image) {
+        g_test_skip("qemu-img not available");
+        return;
+    }
+
+    blk = blk_by_name("disk0");
+    g_assert(blk);
+
+    fill(boot, sizeof(boot), 0x11);
+    fill(fuzz, sizeof(fuzz), 0x77);
+
+    /* Written before the snapshot: only in the cache, never in the image */
+    syx_snapshot_init(true);
+    g_assert_cmpint(blk_pwrite(blk, DISK_OFFSET, sizeof(boot), boot, 0), ==,
+                    0);
+    cpu_physical_memory_write(RAM_ADDR, boot, sizeof(boot));
+
+    snapshot = syx_snapshot_new(true, true, DEVICE_SNAPSHOT_ALL, NULL);
+
+    /* A restore drops the writes done since the snapshot only */
+    g_assert_cmpint(blk_pwrite(blk, DISK_OFFSET, sizeof(fuzz), fuzz, 0), ==,
+                    0);
+    check_disk(blk, fuzz, sizeof(fuzz));
+    syx_snapshot_root_restore(snapshot);
+    check_disk(blk, boot, sizeof(boot));
+
+    fd = g_file_open_tmp("libafl-test-XXXXXX.syx", &path, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+
+    ex = syx_snapshot_export(snapshot, path);
+    g_assert(ex);
+    g_assert(syx_snapshot_export_finish(ex));
+
+    /* The import must bring back the disk and RAM from the file alone */
+    g_assert_cmpint(blk_pwrite(blk, DISK_OFFSET, sizeof(fuzz), fuzz, 0), ==,
+                    0);
+    cpu_physical_memory_write(RAM_ADDR, fuzz, sizeof(fuzz));
+
+    imported = syx_snapshot_import(path, true, true);
+    g_assert(imported);
+    check_disk(blk, boot, sizeof(boot));
+    check_ram(boot, sizeof(boot));
+
+    /* And restoring it works like restoring the exported snapshot */
+    g_assert_cmpint(blk_pwrite(blk, DISK_OFFSET, sizeof(fuzz), fuzz, 0), ==,
+                    0);
+    syx_snapshot_root_restore(imported);
+    check_disk(blk, boot, sizeof(boot));
+
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *args = NULL;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    image = libafl_test_mkimg(16);
+    if (image) {
+        args = g_strdup_printf("-drive if=none,id=disk0,format=qcow2,file=%s",
+                               image);
+    }
+    libafl_test_init(args);
+
+    g_test_add_func("/libafl/syx-snapshot/export/round-trip",
+                    test_round_trip);
+
+    ret = g_test_run();
+
+    if (image) {
+        unlink(image);
+        g_free(image);
+    }
+
+    return ret;
+}
@@ -0,0 +1,150 @@
+/*
+ * Export and import of the TB cache
+ *
+ * The import translates again the exported blocks of the current CPU state
+ * whose guest code did not change, and counts the others.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "tcg/tcg.h"
+
+#include "libafl/tb_cache.h"
+
+#include "libafl-test.h"
+
+static char *cache_path;
+static int64_t nb_exported;
+
+static void do_nothing(CPUState *cpu, run_on_cpu_data data)
+{
+}
+
+/* Empties the code cache, while the vCPU is paused. */
+static void flush_tbs(void)
+{
+    queue_tb_flush(first_cpu);
+    /* Queued after the flush */
+    run_on_cpu(first_cpu, do_nothing, RUN_ON_CPU_NULL);
+    g_assert_cmpuint(tcg_nb_tbs(), ==, 0);
+}
+
+/* Applies edit to every record of the exported cache, into a new file. */
+static char *edit_cache(void (*edit)(struct libafl_tb_cache_record *rec))
+{
+    g_autofree gchar *contents = NULL;
+    struct libafl_tb_cache_header *header;
+    struct libafl_tb_cache_record *recs;
+    GError *err = NULL;
+    gsize len;
+    char *path;
+    int fd;
+
+    g_assert(g_file_get_contents(cache_path, &contents, &len, &err));
+    header = (struct libafl_tb_cache_header *)contents;
+    recs = (struct libafl_tb_cache_record *)(contents + sizeof(*header));
+    for (uint64_t i = 0; i < header->nb_records; i++) {
+        edit(&recs[i]);
+    }
+
+    fd = g_file_open_tmp("libafl-test-XXXXXX.tbc", &path, &err);
+    g_assert_no_error(err);
+    close(fd);
+    g_assert(g_file_set_contents(path, contents, len, &err));
+
+    return path;
+}
+
+static void test_import(void)
+{
+    struct libafl_tb_cache_import_stats stats;
+
+    flush_tbs();
+
+    g_assert_cmpint(libafl_tb_cache_import(first_cpu, cache_path, &stats),
+                    >, 0);
+    g_assert_cmpuint(stats.nb_translated + stats.nb_other_state, ==,
+                     nb_exported);
+    g_assert_cmpuint(stats.nb_changed, ==, 0);
+    g_assert_cmpuint(tcg_nb_tbs(), ==, stats.nb_translated);
+}
+
+static void other_state(struct libafl_tb_cache_record *rec)
+{
+    rec->flags ^= 1;
+}
+
+static void test_other_state(void)
+{
+    g_autofree char *path = edit_cache(other_state);
+    struct libafl_tb_cache_import_stats stats;
+
+    flush_tbs();
+
+    g_assert_cmpint(libafl_tb_cache_import(first_cpu, path, &stats), ==, 0);
+    g_assert_cmpuint(stats.nb_other_state, ==, nb_exported);
+    g_assert_cmpuint(tcg_nb_tbs(), ==, 0);
+
+    unlink(path);
+}
+
+static void changed_code(struct libafl_tb_cache_record *rec)
+{
+    rec->hash ^= 1;
+}
+
+static void test_changed_code(void)
+{
+    g_autofree char *path = edit_cache(changed_code);
+    struct libafl_tb_cache_import_stats stats;
+
+    flush_tbs();
+
+    g_assert_cmpint(libafl_tb_cache_import(first_cpu, path, &stats), ==, 0);
+    g_assert_cmpuint(stats.nb_changed, >, 0);
+    g_assert_cmpuint(stats.nb_changed + stats.nb_other_state, ==,
+                     nb_exported);
+    g_assert_cmpuint(tcg_nb_tbs(), ==, 0);
+
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *bios = NULL;
+    g_autofree char *args = NULL;
+    GError *err = NULL;
+    int ret;
+    int fd;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* The guest halts with interrupts off: its state then stays the same */
+    bios = libafl_test_mkbios();
+    args = g_strdup_printf("-bios %s", bios);
+    libafl_test_init(args);
+    g_assert(libafl_test_run_fast(SCALE_MS));
+
+    fd = g_file_open_tmp("libafl-test-XXXXXX.tbc", &cache_path, &err);
+    g_assert_no_error(err);
+    close(fd);
+    nb_exported = libafl_tb_cache_export(first_cpu, cache_path);
+    g_assert_cmpint(nb_exported, >, 0);
+
+    g_test_add_func("/libafl/tb-cache/import", test_import);
+    g_test_add_func("/libafl/tb-cache/other-state", test_other_state);
+    g_test_add_func("/libafl/tb-cache/changed-code", test_changed_code);
+
+    ret = g_test_run();
+
+    unlink(cache_path);
+    g_free(cache_path);
+    unlink(bios);
+    return ret;
+}
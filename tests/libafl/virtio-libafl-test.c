@@ -0,0 +1,178 @@
+/*
+ * Delivery of test cases through the virtio-libafl device
+ *
+ * The test plays the guest agent: it lays out a split virtqueue in guest RAM,
+ * posts a buffer and checks what the guest sees once the fuzzer delivered a
+ * test case in it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/cpu-common.h"
+#include "hw/pci/pci_device.h"
+#include "hw/pci/pci_host.h"
+#include "hw/virtio/virtio.h"
+#include "hw/virtio/virtio-libafl.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#include "libafl-test.h"
+
+/* In the RAM of the machine */
+#define DESC_ADDR 0x5000000
+#define AVAIL_ADDR 0x5001000
+#define USED_ADDR 0x5002000
+#define BUF_ADDR 0x6000000
+
+static VirtIOLibAFL *vl;
+static uint16_t avail_idx;
+
+static void write_le16(hwaddr addr, uint16_t val)
+{
+    val = cpu_to_le16(val);
+    cpu_physical_memory_write(addr, &val, sizeof(val));
+}
+
+static uint16_t read_le16(hwaddr addr)
+{
+    uint16_t val;
+
+    cpu_physical_memory_read(addr, &val, sizeof(val));
+    return le16_to_cpu(val);
+}
+
+static uint32_t read_le32(hwaddr addr)
+{
+    uint32_t val;
+
+    cpu_physical_memory_read(addr, &val, sizeof(val));
+    return le32_to_cpu(val);
+}
+
+/* What the driver of the guest agent does at probe time. */
+static void setup_queue(void)
+{
+    VirtIODevice *vdev;
+    PCIDevice *pdev;
+
+    vl = VIRTIO_LIBAFL(object_resolve_path_type("", TYPE_VIRTIO_LIBAFL,
+                                                NULL));
+    g_assert_nonnull(vl);
+    vdev = VIRTIO_DEVICE(vl);
+    pdev = PCI_DEVICE(qdev_get_parent_bus(DEVICE(vl))->parent);
+
+    pci_host_config_write_common(pdev, PCI_COMMAND, pci_config_size(pdev),
+                                 PCI_COMMAND_MASTER, 2);
+    g_assert_cmpint(virtio_set_features(vdev, 1ULL << VIRTIO_F_VERSION_1),
+                    ==, 0);
+    g_assert_cmpint(virtio_queue_get_num(vdev, 0) *
+                    sizeof(struct vring_desc), <=, AVAIL_ADDR - DESC_ADDR);
+    virtio_queue_set_rings(vdev, 0, DESC_ADDR, AVAIL_ADDR, USED_ADDR);
+    virtio_set_status(vdev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                      VIRTIO_CONFIG_S_DRIVER | VIRTIO_CONFIG_S_FEATURES_OK |
+                      VIRTIO_CONFIG_S_DRIVER_OK);
+}
+
+/* Posts a device-writable buffer of len bytes at addr. */
+static void post_buffer(hwaddr addr, uint32_t len)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vl);
+    int num = virtio_queue_get_num(vdev, 0);
+    struct vring_desc desc = {
+        .addr = cpu_to_le64(addr),
+        .len = cpu_to_le32(len),
+        .flags = cpu_to_le16(VRING_DESC_F_WRITE),
+    };
+
+    cpu_physical_memory_write(DESC_ADDR, &desc, sizeof(desc));
+    write_le16(AVAIL_ADDR + offsetof(struct vring_avail, ring) +
+               (avail_idx % num) * sizeof(uint16_t), 0);
+    avail_idx++;
+    write_le16(AVAIL_ADDR + offsetof(struct vring_avail, idx), avail_idx);
+
+    virtio_queue_notify(vdev, 0);
+    g_assert_nonnull(vl->elem);
+}
+
+/*
+ * Delivers len bytes in the buffer posted at addr, and checks the used ring
+ * and the content of the buffer as seen by the guest.
+ */
+static void deliver(hwaddr addr, uint32_t len)
+{
+    int num = virtio_queue_get_num(VIRTIO_DEVICE(vl), 0);
+    g_autofree uint8_t *expected = g_malloc(len);
+    g_autofree uint8_t *seen = g_malloc(len);
+    hwaddr used_elem;
+    uint32_t size;
+    uint8_t *buf;
+
+    buf = libafl_qemu_virtio_buffer(&size);
+    g_assert_nonnull(buf);
+    g_assert_cmpuint(size, >=, len);
+
+    for (uint32_t i = 0; i < len; i++) {
+        expected[i] = i * 7 + avail_idx;
+    }
+    memcpy(buf, expected, len);
+
+    g_assert_true(libafl_qemu_virtio_deliver(len));
+    g_assert_false(libafl_qemu_virtio_done());
+    g_assert_null(vl->elem);
+
+    g_assert_cmpuint(read_le16(USED_ADDR + offsetof(struct vring_used, idx)),
+                     ==, avail_idx);
+    used_elem = USED_ADDR + offsetof(struct vring_used, ring) +
+                ((avail_idx - 1) % num) * sizeof(struct vring_used_elem);
+    g_assert_cmpuint(read_le32(used_elem +
+                               offsetof(struct vring_used_elem, len)),
+                     ==, len);
+
+    cpu_physical_memory_read(addr, seen, len);
+    g_assert_cmpmem(seen, len, expected, len);
+
+    /* The guest owns the buffer again: the next test case must not show */
+    memset(buf, 0, len);
+    cpu_physical_memory_read(addr, seen, len);
+    g_assert_cmpmem(seen, len, expected, len);
+}
+
+static void test_deliver_mapped(void)
+{
+    size_t page_size = qemu_real_host_page_size();
+
+    for (int i = 0; i < 2; i++) {
+        post_buffer(BUF_ADDR, page_size);
+        if (i) {
+            g_assert_true(libafl_qemu_virtio_done());
+        }
+        g_assert_cmpuint(vl->nb_mapped_sg, ==, 1);
+
+        deliver(BUF_ADDR, page_size);
+        g_assert_cmpuint(vl->nb_mapped_sg, ==, 0);
+    }
+}
+
+static void test_deliver_copied(void)
+{
+    /* Not made of whole host pages */
+    post_buffer(BUF_ADDR + 64, 256);
+    g_assert_cmpuint(vl->nb_mapped_sg, ==, 0);
+
+    deliver(BUF_ADDR + 64, 256);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    libafl_test_init("-device virtio-libafl-pci");
+    setup_queue();
+
+    g_test_add_func("/libafl/virtio/deliver-mapped", test_deliver_mapped);
+    g_test_add_func("/libafl/virtio/deliver-copied", test_deliver_copied);
+
+    return g_test_run();
+}
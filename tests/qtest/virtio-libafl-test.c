@@ -0,0 +1,69 @@
+/*
+ * QTest test cases for the virtio LibAFL test case injection device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qobject/qdict.h"
+
+static void realize(void)
+{
+    QTestState *s = qtest_init("-nodefaults"
+                               " -device virtio-libafl-pci,id=vl");
+    QDict *ret = qtest_qmp(
+        s,
+        "{ 'execute': 'qom-get', 'arguments': "     \
+        "{ 'path': '/machine/peripheral/vl', "      \
+        "  'property': 'buf-size' } }");
+
+    g_assert(!qdict_haskey(ret, "error"));
+    g_assert_cmpint(qdict_get_int(ret, "return"), ==, 1 << 20);
+
+    qobject_unref(ret);
+    qtest_quit(s);
+}
+
+static void bad_buf_size(void)
+{
+    QTestState *s = qtest_init("-nodefaults");
+    QDict *ret = qtest_qmp(
+        s,
+        "{ 'execute': 'device_add', 'arguments': "  \
+        "{ 'driver': 'virtio-libafl-pci', "         \
+        "  'buf-size': 4097 } }");
+
+    g_assert(qdict_haskey(ret, "error"));
+
+    qobject_unref(ret);
+    qtest_quit(s);
+}
+
+static void single_instance(void)
+{
+    QTestState *s = qtest_init("-nodefaults"
+                               " -device virtio-libafl-pci,id=vl");
+    QDict *ret = qtest_qmp(
+        s,
+        "{ 'execute': 'device_add', 'arguments': "  \
+        "{ 'driver': 'virtio-libafl-pci' } }");
+
+    g_assert(qdict_haskey(ret, "error"));
+
+    qobject_unref(ret);
+    qtest_quit(s);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("virtio-libafl/realize", realize);
+    qtest_add_func("virtio-libafl/bad-buf-size", bad_buf_size);
+    qtest_add_func("virtio-libafl/single-instance", single_instance);
+
+    return g_test_run();
+}